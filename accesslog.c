@@ -0,0 +1,120 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "accesslog.h"
+
+#define LOG_URI 4096 // longer uris are cut, and will not replay as sent
+#define LOG_LINE (2 * LOG_URI + 512)
+
+int access_log_fd = -1;
+
+struct access_rec {
+    uint64_t arrived;
+    int status;
+    int has_request;
+    char client[INET6_ADDRSTRLEN];
+    char method[16];
+    char uri[LOG_URI];
+    char proto[16];
+};
+
+static __thread struct access_rec rec;
+
+int access_log_open(const char *path) {
+    access_log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    return access_log_fd < 0 ? -1 : 0;
+}
+
+uint64_t access_log_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void access_log_begin(uint64_t arrived) {
+    rec.arrived = arrived;
+    rec.status = 0;
+    rec.has_request = 0;
+}
+
+static void peer_name(int fd, char *out, size_t cap) {
+    struct sockaddr_storage sa;
+    socklen_t len = sizeof(sa);
+
+    snprintf(out, cap, "-");
+    if (fd < 0 || getpeername(fd, (struct sockaddr *) &sa, &len) < 0)
+        return;
+    if (sa.ss_family == AF_INET)
+        inet_ntop(AF_INET, &((struct sockaddr_in *) &sa)->sin_addr, out, cap);
+    else if (sa.ss_family == AF_INET6)
+        inet_ntop(AF_INET6, &((struct sockaddr_in6 *) &sa)->sin6_addr, out, cap);
+    else if (sa.ss_family == AF_UNIX)
+        snprintf(out, cap, "unix");
+}
+
+static void slice_to(struct http_slice s, char *out, size_t cap) {
+    size_t n = s.len < cap - 1 ? s.len : cap - 1;
+    memcpy(out, s.p, n);
+    out[n] = '\0';
+}
+
+void access_log_request(int fd, struct http_slice method,
+                        struct http_slice uri, struct http_slice proto) {
+    if (access_log_fd < 0)
+        return;
+    peer_name(fd, rec.client, sizeof(rec.client));
+    slice_to(method, rec.method, sizeof(rec.method));
+    slice_to(uri, rec.uri, sizeof(rec.uri));
+    slice_to(proto, rec.proto, sizeof(rec.proto));
+    rec.has_request = 1;
+}
+
+void access_log_status(int status) {
+    rec.status = status;
+}
+
+// s as a quoted JSON string at out; returns the bytes written
+static size_t json_string(char *out, size_t cap, const char *s) {
+    size_t n = 0;
+
+    out[n++] = '"';
+    for (; *s && n + 8 < cap; s++) {
+        unsigned char ch = *s;
+        if (ch == '"' || ch == '\\') {
+            out[n++] = '\\';
+            out[n++] = ch;
+        } else if (ch < 0x20) {
+            n += sprintf(out + n, "\\u%04x", ch);
+        } else {
+            out[n++] = ch;
+        }
+    }
+    out[n++] = '"';
+    return n;
+}
+
+void access_log_end(void) {
+    char line[LOG_LINE];
+    uint64_t now = access_log_now();
+    size_t n;
+
+    if (access_log_fd < 0 || !rec.has_request)
+        return;
+    n = snprintf(line, sizeof(line), "{\"ts\": %lu.%06lu, \"client\": \"%s\", \"method\": ",
+                 (unsigned long) (rec.arrived / 1000000000ull),
+                 (unsigned long) (rec.arrived % 1000000000ull / 1000), rec.client);
+    n += json_string(line + n, sizeof(line) - n, rec.method);
+    n += snprintf(line + n, sizeof(line) - n, ", \"uri\": ");
+    n += json_string(line + n, sizeof(line) - n, rec.uri);
+    n += snprintf(line + n, sizeof(line) - n, ", \"proto\": ");
+    n += json_string(line + n, sizeof(line) - n, rec.proto);
+    n += snprintf(line + n, sizeof(line) - n, ", \"status\": %d, \"resp_us\": %lu}\n",
+                  rec.status, (unsigned long) ((now - rec.arrived) / 1000));
+    if (write(access_log_fd, line, n) < 0)
+        perror("access log");
+    rec.has_request = 0;
+}
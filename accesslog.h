@@ -0,0 +1,42 @@
+#ifndef __ACCESSLOG_H__
+#define __ACCESSLOG_H__
+
+#include <stdint.h>
+#include "http_parse.h"
+
+//
+// Access log, one JSON object per line (JSONL), for wclient -l to replay:
+//
+//   {"ts": 1760000000.123456, "client": "127.0.0.1", "method": "GET",
+//    "uri": "/spin.cgi?1", "proto": "HTTP/1.0", "status": 200,
+//    "resp_us": 1000873}
+//
+// ts is when the connection was accepted (or the h2 stream queued), in
+// wall-clock seconds, and resp_us runs from then until the worker is done,
+// so it includes time spent waiting in the queue. Lines are written with
+// a single write() to an O_APPEND file, so workers need no lock; they are
+// in completion order, not arrival order.
+//
+
+extern int access_log_fd; // wserver -l, -1 = off
+
+// open (append to) the log; 0 on success
+int access_log_open(const char *path);
+
+// wall clock in nanoseconds, the arrival time to pass to access_log_begin
+uint64_t access_log_now(void);
+
+// this thread starts serving a request that arrived at the given time
+void access_log_begin(uint64_t arrived);
+
+// its request line, and the connection it came on (for the client field)
+void access_log_request(int fd, struct http_slice method,
+                        struct http_slice uri, struct http_slice proto);
+
+// status code of the response sent
+void access_log_status(int status);
+
+// write the line; requests without a request line are not logged
+void access_log_end(void);
+
+#endif // __ACCESSLOG_H__
@@ -0,0 +1,105 @@
+#!/usr/bin/env bash
+# Scheduling benchmark: runs wserver over a matrix of -t/-b/-s settings
+# against a synthetic document root and records what wclient measures.
+#
+# Knobs (environment):
+#   BENCH_THREADS   worker counts to try        (default "1 4")
+#   BENCH_BUFFERS   queue sizes to try          (default "8 32")
+#   BENCH_SCHED     policies to try             (default "FIFO SFF")
+#   BENCH_CONNS     client connections          (default 16)
+#   BENCH_DURATION  seconds measured per run    (default 3)
+#   BENCH_WARMUP    seconds of warmup per run   (default 0.5)
+#   BENCH_RATE      requests/s for open loop; empty = closed loop
+#   BENCH_PORT      port to use                 (default 16000)
+#
+# Results: bench/results.csv (one row per run and size class) and
+# bench/results.json (configuration plus wclient's full report per run).
+set -euo pipefail
+
+THREADS=${BENCH_THREADS:-"1 4"}
+BUFFERS=${BENCH_BUFFERS:-"8 32"}
+SCHED=${BENCH_SCHED:-"FIFO SFF"}
+CONNS=${BENCH_CONNS:-16}
+DURATION=${BENCH_DURATION:-3}
+WARMUP=${BENCH_WARMUP:-0.5}
+RATE=${BENCH_RATE:-}
+PORT=${BENCH_PORT:-16000}
+
+DIR=bench
+ROOT=$DIR/www
+LOG=$DIR/server.log
+CSV=$DIR/results.csv
+JSON=$DIR/results.json
+CLASSES="small large pareto"
+
+trap 'kill $SVR 2>/dev/null || true' EXIT
+SVR=
+
+# same files every time: sizes come from a fixed seed
+make_root() {
+  rm -rf $ROOT; mkdir -p $ROOT
+  : > $DIR/uris
+  awk 'BEGIN {
+    srand(42)
+    for (i = 0; i < 40; i++)                # like small.txt: 1-8 KB
+      printf "small/%02d %d 8\n", i, 1024 + int(rand() * 7168)
+    for (i = 0; i < 4; i++)                 # like big.txt: 1-2 MB
+      printf "large/%02d %d 1\n", i, 1048576 + int(rand() * 1048576)
+    for (i = 0; i < 40; i++) {              # heavy tail: pareto, alpha 1.2
+      s = int(2048 / (1 - rand()) ^ (1 / 1.2))
+      if (s > 8388608) s = 8388608
+      printf "pareto/%02d %d 4\n", i, s
+    }
+  }' | while read -r name size weight; do
+    mkdir -p $ROOT/$(dirname $name)
+    head -c $size /dev/zero > $ROOT/$name.txt
+    echo "/$name.txt $weight $(dirname $name)" >> $DIR/uris
+  done
+}
+
+wait_for_bind() {
+  for i in {1..50}; do
+    grep -q "\[pid.*listening on port $PORT" $LOG && return
+    sleep .1
+  done
+  echo "ERROR: server did not bind in time"; exit 1
+}
+
+# field from wclient's report: json_num <json> <key> [class]
+json_num() {
+  local text=$1
+  [ -n "${3:-}" ] && text=$(echo "$1" | grep "\"$3\": {")
+  echo "$text" | sed -n "s/.*\"$2\": \([0-9.]*\).*/\1/p" | head -1
+}
+
+mkdir -p $DIR
+make_root
+echo "threads,buffers,sched,mode,class,requests,throughput_rps,mean_us,p50_us,p99_us,p999_us" > $CSV
+echo "[" > $JSON
+first=1
+
+for t in $THREADS; do
+  for b in $BUFFERS; do
+    for s in $SCHED; do
+      echo "== -t $t -b $b -s $s"
+      ./wserver -d $ROOT -p $PORT -t $t -b $b -s $s > $LOG 2>&1 &
+      SVR=$!; wait_for_bind
+      out=$(./wclient -c $CONNS -d $DURATION -w $WARMUP ${RATE:+-r $RATE} \
+              -f $DIR/uris localhost $PORT || true)
+      kill $SVR; wait $SVR 2>/dev/null || true; SVR=
+
+      mode=$([ -n "$RATE" ] && echo open || echo closed)
+      all=$(echo "$out" | grep '"latency_us"' | head -1)
+      echo "$t,$b,$s,$mode,all,$(json_num "$out" requests),$(json_num "$out" throughput_rps),$(json_num "$all" mean),$(json_num "$all" p50),$(json_num "$all" p99),$(json_num "$all" p999)" >> $CSV
+      for c in $CLASSES; do
+        echo "$t,$b,$s,$mode,$c,$(json_num "$out" requests $c),,$(json_num "$out" mean $c),$(json_num "$out" p50 $c),$(json_num "$out" p99 $c),$(json_num "$out" p999 $c)" >> $CSV
+      done
+      [ $first = 1 ] || echo "," >> $JSON; first=0
+      echo "{\"threads\": $t, \"buffers\": $b, \"sched\": \"$s\", \"result\": $out}" >> $JSON
+      tail -n 4 $CSV
+    done
+  done
+done
+echo "]" >> $JSON
+echo
+echo "results in $CSV and $JSON"
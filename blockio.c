@@ -1,67 +1,584 @@
 #include <string.h>
 #include <stdint.h>
 #include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include "io_helper.h"
 #include "blockio.h"
 
 
 #define BLOCK_SIZE 256
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#define HASH_SIZE (2 * BLOCKIO_FRAMES) // power of two
+#define MAP_STEP (64 * 1024)           // mappings grow by this much
 
+int blockio_mmap;
 
-// will allocate a new block at the end of the file
+struct blockio_stats blockio_stats;
+struct blockio_file_stats blockio_files[BLOCKIO_MAX_FILES];
+int blockio_nfiles;
+
+// open files, same index as blockio_files
+static struct {
+    int fd;      // -1 if not open
+    int nblocks; // blocks in the file
+    char *map;     // address space reserved for the file in mmap mode
+    size_t mapped; // bytes of it mapped so far
+    int pins;      // blocks of the mapping pinned
+} files[BLOCKIO_MAX_FILES];
+static int last_file = -1; // most lookups are for the same file again
+
+struct frame {
+    int file;     // index into files, -1 if the frame is empty
+    int blocknum;
+    int pins;
+    int dirty;
+    int ref;      // used since the clock hand last went by
+    int hnext;    // next frame in the same hash chain
+};
+
+static struct frame frames[BLOCKIO_FRAMES];
+static _Alignas(8) char frame_data[BLOCKIO_FRAMES][BLOCK_SIZE]; // nodes are cast onto frames
+static int hash[HASH_SIZE];
+static int hand;
+static int initialized;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void blockio_stats_add(struct blockio_stats *into, const struct blockio_stats *d) {
+    into->opens += d->opens;
+    into->reads += d->reads;
+    into->writes += d->writes;
+    into->bytes_read += d->bytes_read;
+    into->bytes_written += d->bytes_written;
+    into->ns += d->ns;
+    into->hits += d->hits;
+}
+
+// count d for file f and in the total
+static void charge(int f, struct blockio_stats d) {
+    blockio_stats_add(&blockio_stats, &d);
+    blockio_stats_add(&blockio_files[f].st, &d);
+}
+
+static void init(void) {
+    for (int i = 0; i < BLOCKIO_FRAMES; i++)
+        frames[i].file = -1;
+    for (int i = 0; i < HASH_SIZE; i++)
+        hash[i] = -1;
+    initialized = 1;
+    atexit(blockio_flush); // nothing changed is lost if a caller forgets
+}
+
+static void close_file(int f) {
+    if (files[f].map)
+        munmap(files[f].map, BLOCKIO_MAP_MAX);
+    files[f].map = NULL;
+    close_or_die(files[f].fd);
+    files[f].fd = -1;
+}
+
+static void drop(int i);
+
+// whether any block of file f is pinned
+static int pinned(int f) {
+    if (blockio_mmap)
+        return files[f].pins > 0;
+    for (int i = 0; i < BLOCKIO_FRAMES; i++) {
+        if (frames[i].file == f && frames[i].pins > 0)
+            return 1;
+    }
+    return 0;
+}
+
+// a slot for another file once all of them are taken: one whose file was
+// closed, or else one with no block pinned, which is written back (or
+// unmapped) and closed. Its per file counts are lost, the totals keep them
+static int recycle(void) {
+    for (int f = 0; f < BLOCKIO_MAX_FILES; f++) {
+        if (files[f].fd < 0)
+            return f;
+    }
+    for (int f = 0; f < BLOCKIO_MAX_FILES; f++) {
+        if (pinned(f))
+            continue;
+        for (int i = 0; i < BLOCKIO_FRAMES; i++) {
+            if (frames[i].file == f)
+                drop(i);
+        }
+        close_file(f);
+        if (last_file == f)
+            last_file = -1;
+        return f;
+    }
+    fprintf(stderr, "blockio: blocks of all %d files are pinned\n", BLOCKIO_MAX_FILES);
+    abort();
+}
+
+// index of filename in files, opening it if it is not open
+static int file_index(const char *filename, int create) {
+    int f = last_file;
+
+    if (!initialized)
+        init();
+    if (f < 0 || strcmp(blockio_files[f].file, filename) != 0) {
+        for (f = 0; f < blockio_nfiles; f++) {
+            if (strcmp(blockio_files[f].file, filename) == 0)
+                break;
+        }
+        if (f == blockio_nfiles) {
+            if (strlen(filename) >= sizeof(blockio_files[f].file)) {
+                fprintf(stderr, "blockio: file name %s is too long\n", filename);
+                exit(1);
+            }
+            if (blockio_nfiles < BLOCKIO_MAX_FILES)
+                blockio_nfiles++;
+            else
+                f = recycle();
+            memset(&blockio_files[f], 0, sizeof(blockio_files[f]));
+            strcpy(blockio_files[f].file, filename);
+            files[f].fd = -1;
+        }
+        last_file = f;
+    }
+    if (files[f].fd < 0) {
+        uint64_t t = now_ns();
+        struct stat st;
+        files[f].fd = open_or_die(filename, O_RDWR | (create ? O_CREAT : 0), 0666);
+        fstat_or_die(files[f].fd, &st);
+        files[f].nblocks = st.st_size / BLOCK_SIZE;
+        if (blockio_mmap) {
+            // reserved once, so the file can be mapped further in place
+            // and pointers into it stay good as it grows
+            files[f].map = mmap(NULL, BLOCKIO_MAP_MAX, PROT_NONE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            assert(files[f].map != MAP_FAILED);
+            files[f].mapped = 0;
+        }
+        charge(f, (struct blockio_stats){.opens = 1, .ns = now_ns() - t});
+    }
+    return f;
+}
+
+// block blocknum of file f in its mapping, mapping more of the file if
+// it has grown past what is mapped
+static char *mapped(int f, int blocknum) {
+    size_t end = (size_t)(blocknum + 1) * BLOCK_SIZE;
+
+    if (end > files[f].mapped) {
+        uint64_t t = now_ns();
+        if (blocknum >= files[f].nblocks) { // grown by another process
+            struct stat st;
+            fstat_or_die(files[f].fd, &st);
+            files[f].nblocks = st.st_size / BLOCK_SIZE;
+        }
+        assert(blocknum < files[f].nblocks);
+        size_t len = ((size_t)files[f].nblocks * BLOCK_SIZE + MAP_STEP - 1) / MAP_STEP * MAP_STEP;
+        assert(len <= BLOCKIO_MAP_MAX);
+        char *p = mmap(files[f].map, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                       files[f].fd, 0);
+        assert(p == files[f].map);
+        files[f].mapped = len;
+        charge(f, (struct blockio_stats){.ns = now_ns() - t});
+    }
+    return files[f].map + (size_t)blocknum * BLOCK_SIZE;
+}
+
+static int hash_of(int f, int blocknum) {
+    return ((unsigned)blocknum * 2654435761u ^ (unsigned)f) & (HASH_SIZE - 1);
+}
+
+static int lookup(int f, int blocknum) {
+    int i = hash[hash_of(f, blocknum)];
+    while (i >= 0 && (frames[i].file != f || frames[i].blocknum != blocknum))
+        i = frames[i].hnext;
+    return i;
+}
+
+static void hash_remove(int i) {
+    int *p = &hash[hash_of(frames[i].file, frames[i].blocknum)];
+    while (*p != i)
+        p = &frames[*p].hnext;
+    *p = frames[i].hnext;
+}
+
+static void write_frame(int i) {
+    struct frame *fr = &frames[i];
+    uint64_t t = now_ns();
+    ssize_t rc = pwrite(files[fr->file].fd, frame_data[i], BLOCK_SIZE,
+                        (off_t)fr->blocknum * BLOCK_SIZE);
+    assert(rc == BLOCK_SIZE);
+    fr->dirty = 0;
+    charge(fr->file, (struct blockio_stats){.writes = 1, .bytes_written = BLOCK_SIZE,
+                                            .ns = now_ns() - t});
+}
+
+// empty the frame, writing it back first if it changed
+static void drop(int i) {
+    if (frames[i].dirty)
+        write_frame(i);
+    hash_remove(i);
+    frames[i].file = -1;
+}
+
+// a frame to reuse: the first unpinned one the clock hand finds that
+// was not used since it last went by
+static int victim(void) {
+    for (int n = 0; n < 2 * BLOCKIO_FRAMES + 1; n++) {
+        int i = hand;
+        hand = (hand + 1) % BLOCKIO_FRAMES;
+        if (frames[i].file < 0)
+            return i;
+        if (frames[i].pins > 0)
+            continue;
+        if (frames[i].ref) {
+            frames[i].ref = 0;
+            continue;
+        }
+        drop(i);
+        return i;
+    }
+    fprintf(stderr, "blockio: all %d frames are pinned\n", BLOCKIO_FRAMES);
+    abort();
+}
+
+// pin block blocknum of file f; on a miss it is read from disk if load
+// is set, and starts out zeroed otherwise
+static int pin(int f, int blocknum, int load) {
+    int i = lookup(f, blocknum);
+
+    if (i >= 0) {
+        charge(f, (struct blockio_stats){.hits = 1});
+    } else {
+        i = victim();
+        frames[i] = (struct frame){.file = f, .blocknum = blocknum,
+                                   .hnext = hash[hash_of(f, blocknum)]};
+        hash[hash_of(f, blocknum)] = i;
+        memset(frame_data[i], 0, BLOCK_SIZE);
+        if (load) {
+            uint64_t t = now_ns();
+            ssize_t rc = pread(files[f].fd, frame_data[i], BLOCK_SIZE,
+                               (off_t)blocknum * BLOCK_SIZE);
+            assert(rc >= 0);
+            charge(f, (struct blockio_stats){.reads = 1, .bytes_read = rc,
+                                             .ns = now_ns() - t});
+        }
+    }
+    frames[i].pins++;
+    frames[i].ref = 1;
+    return i;
+}
+
+char *pin_block(const char *filename, int blocknum) {
+    int f = file_index(filename, 0);
+    if (blockio_mmap) {
+        char *p = mapped(f, blocknum);
+        files[f].pins++;
+        return p;
+    }
+    return frame_data[pin(f, blocknum, 1)];
+}
+
+void unpin_block(char *frame, int dirty) {
+    if (blockio_mmap) {
+        // changes are already in the page cache; only the pin is counted
+        int f = 0;
+        while (f < blockio_nfiles && !(files[f].map && frame >= files[f].map &&
+                                       frame < files[f].map + BLOCKIO_MAP_MAX))
+            f++;
+        assert(f < blockio_nfiles && files[f].pins > 0);
+        files[f].pins--;
+        return;
+    }
+    int i = (frame - frame_data[0]) / BLOCK_SIZE;
+    assert(frames[i].pins > 0);
+    frames[i].pins--;
+    if (dirty)
+        frames[i].dirty = 1;
+}
+
+static int cmp_frame(const void *a, const void *b) {
+    const struct frame *x = &frames[*(const int *)a], *y = &frames[*(const int *)b];
+    if (x->file != y->file)
+        return x->file - y->file;
+    return x->blocknum - y->blocknum;
+}
+
+void blockio_flush(void) {
+    static int dirty[BLOCKIO_FRAMES];
+    int n = 0;
+
+    for (int i = 0; i < BLOCKIO_FRAMES; i++) {
+        if (frames[i].file >= 0 && frames[i].dirty)
+            dirty[n++] = i;
+    }
+    qsort(dirty, n, sizeof(dirty[0]), cmp_frame);
+
+    // one pwritev per run of consecutive blocks in a file
+    for (int start = 0; start < n;) {
+        struct frame *first = &frames[dirty[start]];
+        struct iovec iov[BLOCKIO_FRAMES < IOV_MAX ? BLOCKIO_FRAMES : IOV_MAX];
+        int k = 0;
+        while (start + k < n && k < (int)(sizeof(iov) / sizeof(iov[0])) &&
+               frames[dirty[start + k]].file == first->file &&
+               frames[dirty[start + k]].blocknum == first->blocknum + k) {
+            iov[k].iov_base = frame_data[dirty[start + k]];
+            iov[k].iov_len = BLOCK_SIZE;
+            k++;
+        }
+        uint64_t t = now_ns();
+        ssize_t rc = pwritev(files[first->file].fd, iov, k,
+                             (off_t)first->blocknum * BLOCK_SIZE);
+        assert(rc == (ssize_t)k * BLOCK_SIZE);
+        charge(first->file, (struct blockio_stats){.writes = 1, .bytes_written = rc,
+                                                   .ns = now_ns() - t});
+        for (int j = 0; j < k; j++)
+            frames[dirty[start + j]].dirty = 0;
+        start += k;
+    }
+}
+
+void blockio_invalidate(const char *filename, int blocknum) {
+    int i, f = file_index(filename, 0);
+    if (!blockio_mmap && (i = lookup(f, blocknum)) >= 0 && frames[i].pins == 0)
+        drop(i);
+}
+
+void blockio_advise_scan(const char *filename) {
+    int f = file_index(filename, 0);
+    if (blockio_mmap) {
+        if (files[f].nblocks > 0) {
+            mapped(f, files[f].nblocks - 1); // all of it
+            madvise(files[f].map, files[f].mapped, MADV_SEQUENTIAL);
+        }
+    } else {
+        posix_fadvise(files[f].fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+}
+
+void blockio_close(void) {
+    if (!initialized)
+        return;
+    blockio_flush();
+    for (int i = 0; i < BLOCKIO_FRAMES; i++) {
+        if (frames[i].file >= 0)
+            drop(i);
+    }
+    for (int f = 0; f < blockio_nfiles; f++) {
+        if (files[f].fd >= 0)
+            close_file(f);
+    }
+}
+
+// freed blocks wait on a list in the file for alloc_block to hand out
+// again: block 0 holds its head at FREE_HDR_OFF, and each free block
+// the next one where a next pointer goes
+#define FREE_HDR_OFF 240
+#define FREE_MAGIC 0x314b4c42 // "BLK1"
+
+struct free_hdr {
+    uint32_t magic; // anything else means an empty list
+    int32_t head;   // -1 at the end
+    int32_t count;
+};
+
+static struct free_hdr read_free_hdr(const char *blk0) {
+    struct free_hdr h;
+    memcpy(&h, blk0 + FREE_HDR_OFF, sizeof(h));
+    if (h.magic != FREE_MAGIC)
+        h = (struct free_hdr){FREE_MAGIC, -1, 0};
+    return h;
+}
+
+int blockio_free_count(const char *filename) {
+    char *blk0 = pin_block(filename, 0);
+    int count = read_free_hdr(blk0).count;
+    unpin_block(blk0, 0);
+    return count;
+}
+
+// a block off the free list, zeroed, or -1 if the list is empty
+static int pop_free(const char *filename, int f) {
+    if (files[f].nblocks == 0)
+        return -1;
+    char *blk0 = pin_block(filename, 0);
+    struct free_hdr h = read_free_hdr(blk0);
+    int blocknum = h.head;
+    if (blocknum != -1) {
+        char *p = pin_block(filename, blocknum);
+        memcpy(&h.head, p + BLOCK_SIZE - sizeof(h.head), sizeof(h.head));
+        memset(p, 0, BLOCK_SIZE);
+        unpin_block(p, 1);
+        h.count--;
+        memcpy(blk0 + FREE_HDR_OFF, &h, sizeof(h));
+    }
+    unpin_block(blk0, blocknum != -1);
+    return blocknum;
+}
+
+// another process may have grown the file since it was opened
+static void refresh_size(int f) {
+    struct stat st;
+    fstat_or_die(files[f].fd, &st);
+    if (st.st_size / BLOCK_SIZE > files[f].nblocks)
+        files[f].nblocks = st.st_size / BLOCK_SIZE;
+}
+
+// will allocate a block, reusing a freed one if there is one and
+// adding one at the end of the file otherwise
 int alloc_block(const char *filename) {
-    int fd = open_or_die(filename, O_RDWR | O_CREAT, 0666); // open file for RW
-    // find end of file
-    off_t off = lseek_or_die(fd, 0, SEEK_END);
-    int blocknum = off / BLOCK_SIZE;
-    // write a zero block
-    char buf[BLOCK_SIZE] = {0}; // set the block to zero bytes
-    write_or_die(fd, buf, BLOCK_SIZE);
-    close_or_die(fd);
+    int f = file_index(filename, 1); // open file for RW, creating it
+
+    refresh_size(f);
+    int reused = pop_free(filename, f);
+    if (reused != -1)
+        return reused;
+    int blocknum = files[f].nblocks++;
+
+    // write the zero block right away, so the file grows now
+    if (blockio_mmap) {
+        static const char zero[BLOCK_SIZE];
+        uint64_t t = now_ns();
+        ssize_t rc = pwrite(files[f].fd, zero, BLOCK_SIZE, (off_t)blocknum * BLOCK_SIZE);
+        assert(rc == BLOCK_SIZE);
+        charge(f, (struct blockio_stats){.writes = 1, .bytes_written = BLOCK_SIZE,
+                                         .ns = now_ns() - t});
+        return blocknum;
+    }
+    int i = pin(f, blocknum, 0);
+    write_frame(i);
+    frames[i].pins--;
     return blocknum; //return block index(0 based)
 }
 
+void alloc_blocks(const char *filename, int n, int *out) {
+    int f = file_index(filename, 1), k = 0;
+
+    refresh_size(f);
+    while (k < n && (out[k] = pop_free(filename, f)) != -1)
+        k++;
+    if (k == n)
+        return;
+
+    // the rest are new: writing the last one grows the file past them all
+    static const char zero[BLOCK_SIZE];
+    int first = files[f].nblocks;
+    files[f].nblocks += n - k;
+    uint64_t t = now_ns();
+    ssize_t rc = pwrite(files[f].fd, zero, BLOCK_SIZE, (off_t)(files[f].nblocks - 1) * BLOCK_SIZE);
+    assert(rc == BLOCK_SIZE);
+    charge(f, (struct blockio_stats){.writes = 1, .bytes_written = BLOCK_SIZE,
+                                     .ns = now_ns() - t});
+    for (int j = first; k < n; j++)
+        out[k++] = j;
+}
+
+int blockio_size(const char *filename) {
+    int f = file_index(filename, 0);
+    refresh_size(f);
+    return files[f].nblocks;
+}
+
+void write_blocks(const char *filename, int first, int n, const char *data) {
+    int f = file_index(filename, 1);
+
+    // pooled copies of the blocks would hide what is written now
+    for (int b = first; !blockio_mmap && b < first + n; b++) {
+        int i = lookup(f, b);
+        if (i >= 0) {
+            assert(frames[i].pins == 0);
+            frames[i].dirty = 0;
+            drop(i);
+        }
+    }
+    uint64_t t = now_ns();
+    size_t len = (size_t)n * BLOCK_SIZE, done = 0;
+    while (done < len) {
+        ssize_t rc = pwrite(files[f].fd, data + done, len - done,
+                            (off_t)first * BLOCK_SIZE + done);
+        assert(rc > 0);
+        done += rc;
+    }
+    charge(f, (struct blockio_stats){.writes = 1, .bytes_written = len,
+                                     .ns = now_ns() - t});
+    if (first + n > files[f].nblocks)
+        files[f].nblocks = first + n;
+}
+
+void blockio_forget(const char *filename) {
+    int f;
+    for (f = 0; f < blockio_nfiles; f++) {
+        if (strcmp(blockio_files[f].file, filename) == 0)
+            break;
+    }
+    if (f == blockio_nfiles || files[f].fd < 0)
+        return;
+    for (int i = 0; i < BLOCKIO_FRAMES; i++) {
+        if (frames[i].file == f) {
+            assert(frames[i].pins == 0);
+            frames[i].dirty = 0;
+            drop(i);
+        }
+    }
+    assert(files[f].pins == 0);
+    close_file(f);
+}
+
 // reads block into buffer(must be a least block_size)
 void read_block(const char *filename, int blocknum, char buf[BLOCK_SIZE]) {
-    int fd = open_or_die(filename, O_RDONLY, 0); 
-    lseek_or_die(fd, (off_t)blocknum * BLOCK_SIZE, SEEK_SET); // seek byte offset to find appropriate block for reading
-    read_or_die(fd, buf, BLOCK_SIZE);  // read 256 bytes into buffer
-    close_or_die(fd);
+    char *p = pin_block(filename, blocknum);
+    memcpy(buf, p, BLOCK_SIZE);
+    unpin_block(p, 0);
 }
 
-// write buffer into block
+// write buffer into block; the whole block is replaced, so a miss does
+// not read it first
 void write_block(const char *filename, int blocknum, const char buf[BLOCK_SIZE]) {
-    int fd = open_or_die(filename, O_RDWR, 0);
-    lseek_or_die(fd, (off_t)blocknum * BLOCK_SIZE, SEEK_SET); //same as read
-    write_or_die(fd, buf, BLOCK_SIZE); //same as read
-    close_or_die(fd);
+    if (blockio_mmap) {
+        memcpy(mapped(file_index(filename, 0), blocknum), buf, BLOCK_SIZE);
+        return;
+    }
+    int i = pin(file_index(filename, 0), blocknum, 0);
+    memcpy(frame_data[i], buf, BLOCK_SIZE);
+    unpin_block(frame_data[i], 1);
 }
 
-// free a block by zeroing it out
+// free a block: it is zeroed and goes on the free list
 void free_block(const char *filename, int blocknum) {
-    int fd = open_or_die(filename, O_RDWR, 0);
-    lseek_or_die(fd, (off_t)blocknum * BLOCK_SIZE, SEEK_SET); 
-    char buf[BLOCK_SIZE] = {0}; // set the block to zero bytes
-    write_or_die(fd, buf, BLOCK_SIZE);
-    close_or_die(fd);
+    assert(blocknum > 0); // block 0 holds the list
+    char *blk0 = pin_block(filename, 0);
+    struct free_hdr h = read_free_hdr(blk0);
+    char *p = pin_block(filename, blocknum);
+    memset(p, 0, BLOCK_SIZE);
+    memcpy(p + BLOCK_SIZE - sizeof(h.head), &h.head, sizeof(h.head));
+    unpin_block(p, 1);
+    h.head = blocknum;
+    h.count++;
+    memcpy(blk0 + FREE_HDR_OFF, &h, sizeof(h));
+    unpin_block(blk0, 1);
 }
 
 
-// write the next‐block index into the last 4 bytes of block
+// write the next‐block index into the last 4 bytes of block
 void set_next_block(const char *file, int blocknum, int32_t next) {
-    int fd = open_or_die(file, O_RDWR, 0);
-    // seek to byte offset blocknum*256 + 252
-    lseek_or_die(fd, (off_t)blocknum * BLOCK_SIZE + BLOCK_SIZE - sizeof(int32_t), SEEK_SET);
-    write_or_die(fd, &next, sizeof(next));
-    close_or_die(fd);
+    char *p = pin_block(file, blocknum);
+    memcpy(p + BLOCK_SIZE - sizeof(next), &next, sizeof(next));
+    unpin_block(p, 1);
 }
 
-// read the next‐block index from the last 4 bytes of block
+// read the next‐block index from the last 4 bytes of block
 int32_t get_next_block(const char *file, int blocknum) {
     int32_t next;
-    int fd = open_or_die(file, O_RDONLY, 0);
-    lseek_or_die(fd, (off_t)blocknum * BLOCK_SIZE + BLOCK_SIZE - sizeof(next), SEEK_SET);
-    read_or_die(fd, &next, sizeof(next));
-    close_or_die(fd);
+    char *p = pin_block(file, blocknum);
+    memcpy(&next, p + BLOCK_SIZE - sizeof(next), sizeof(next));
+    unpin_block(p, 0);
     return next;
 }
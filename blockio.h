@@ -6,11 +6,92 @@
 
 #define BLOCK_SIZE 256 // Each block is 256 bytes
 
+// Blocks go through a buffer pool: BLOCKIO_FRAMES cached blocks, picked
+// for reuse by the clock algorithm, over files that stay open until
+// blockio_close(). A miss reads the block with one pread(); changed
+// blocks are only written back when their frame is reused or on
+// blockio_flush(), which writes runs of adjacent blocks with one
+// pwritev() each.
+#define BLOCKIO_FRAMES 1024
+
+// With blockio_mmap set (before the first call) there is no pool: each
+// file is mapped shared and blocks are used in place, so pinning a block
+// is pointer arithmetic and changes need no write back. The mapping
+// grows in place when the file does, up to BLOCKIO_MAP_MAX bytes. Pins
+// are still counted per file, so a mapping is only unmapped when none of
+// its blocks is in use.
+extern int blockio_mmap;
+#define BLOCKIO_MAP_MAX (1ul << 30)
+
+// I/O done since the process started, in total and per file
+struct blockio_stats {
+    unsigned long opens, reads, writes;        // system calls
+    unsigned long bytes_read, bytes_written;
+    uint64_t ns;                               // time spent in them
+    unsigned long hits;                        // blocks found in the pool
+};
+
+#define BLOCKIO_MAX_FILES 64 // open at once in one process
+#define BLOCKIO_NAME_MAX 136  // bytes in a file name, with the NUL
+
+struct blockio_file_stats {
+    char file[BLOCKIO_NAME_MAX];
+    struct blockio_stats st;
+};
+
+extern struct blockio_stats blockio_stats;
+extern struct blockio_file_stats blockio_files[BLOCKIO_MAX_FILES];
+extern int blockio_nfiles;
+
+void blockio_stats_add(struct blockio_stats *into, const struct blockio_stats *d);
+
+// the block's frame, read in on a miss; it stays in the pool until
+// unpinned, and dirty says whether the caller changed it
+char *pin_block(const char *filename, int blocknum);
+void unpin_block(char *frame, int dirty);
+
+// write back every dirty block
+void blockio_flush(void);
+
+// write back the block if dirty and forget it, so the next access reads
+// what is on disk (another process may have changed it)
+void blockio_invalidate(const char *filename, int blocknum);
+
+// the file is about to be read front to back
+void blockio_advise_scan(const char *filename);
+
+// flush, empty the pool and close the files
+void blockio_close(void);
+
+// the original interface, now on top of the pool. free_block puts the
+// block on a free list kept in the file, with its head in bytes
+// [240, 252) of block 0, and alloc_block takes blocks from that list
+// before it grows the file. Block 0 itself is never freed.
 int alloc_block(const char *filename);
+
+// n blocks into out: freed ones first, then new ones, which are
+// consecutive and cost a single write however many there are. They are
+// zero, and a miss on them (write_block) does not read them.
+void alloc_blocks(const char *filename, int n, int *out);
 void read_block(const char *filename, int blocknum, char buf[BLOCK_SIZE]);
 void write_block(const char *filename, int blocknum, const char buf[BLOCK_SIZE]);
 void free_block(const char *filename, int blocknum);
 void set_next_block(const char *file, int blocknum, int32_t next);
 int32_t get_next_block(const char *file, int blocknum);
 
-#endif // BLOCKIO_H
\ No newline at end of file
+// blocks in the file, counting any another process added
+int blockio_size(const char *filename);
+
+// write n blocks from data to the file, from block first on, with one
+// pwrite(); first may be the end of the file, which then grows. For
+// bulk loads, which build whole blocks themselves.
+void write_blocks(const char *filename, int first, int n, const char *data);
+
+// drop the file's blocks from the pool, changed or not, and close it:
+// the file is about to be removed or replaced
+void blockio_forget(const char *filename);
+
+// blocks on the free list
+int blockio_free_count(const char *filename);
+
+#endif // BLOCKIO_H
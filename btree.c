@@ -0,0 +1,314 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "io_helper.h"
+#include "blockio.h"
+#include "btree.h"
+
+#define BTREE_MAGIC 0x31525442 // "BTR1"
+
+#define LEAF_MAX 20  // entries in a leaf
+#define INNER_MAX 15 // keys in an inner node, with one more child
+
+// block 0
+struct meta {
+    uint32_t magic;
+    int32_t root;
+};
+
+struct leaf {
+    uint16_t is_leaf, n;
+    int32_t next; // leaf to the right, -1 for the last
+    struct btree_entry e[LEAF_MAX];
+};
+
+// child[i] holds the entries below key[i], child[i + 1] those from it on
+struct inner {
+    uint16_t is_leaf, n;
+    int32_t unused;
+    int32_t child[INNER_MAX + 1];
+    struct btree_entry key[INNER_MAX];
+};
+
+_Static_assert(sizeof(struct leaf) <= BLOCK_SIZE, "leaf does not fit a block");
+_Static_assert(sizeof(struct inner) <= BLOCK_SIZE, "inner node does not fit a block");
+
+static int cmp(const struct btree_entry *a, const struct btree_entry *b) {
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+    if (a->block != b->block)
+        return a->block < b->block ? -1 : 1;
+    if (a->slot != b->slot)
+        return a->slot < b->slot ? -1 : 1;
+    return 0;
+}
+
+// first position in e[0..n) whose entry is >= x
+static int lower_bound(const struct btree_entry *e, int n, const struct btree_entry *x) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cmp(&e[mid], x) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// the child of an inner node that x belongs under
+static int child_index(const struct inner *in, const struct btree_entry *x) {
+    int i = lower_bound(in->key, in->n, x);
+    if (i < in->n && cmp(&in->key[i], x) == 0)
+        i++;
+    return i;
+}
+
+static int32_t root_of(const char *file) {
+    struct meta *m = (struct meta *)pin_block(file, 0);
+    assert(m->magic == BTREE_MAGIC);
+    int32_t root = m->root;
+    unpin_block((char *)m, 0);
+    return root;
+}
+
+void btree_create(const char *file) {
+    int meta = alloc_block(file);
+    int root = alloc_block(file);
+
+    struct leaf *l = (struct leaf *)pin_block(file, root);
+    l->is_leaf = 1;
+    l->n = 0;
+    l->next = -1;
+    unpin_block((char *)l, 1);
+
+    struct meta *m = (struct meta *)pin_block(file, meta);
+    m->magic = BTREE_MAGIC;
+    m->root = root;
+    unpin_block((char *)m, 1);
+}
+
+static int cmp_void(const void *a, const void *b) {
+    return cmp(a, b);
+}
+
+void btree_sort(struct btree_entry *e, int n) {
+    qsort(e, n, sizeof(e[0]), cmp_void);
+}
+
+void btree_build(const char *file, const struct btree_entry *e, int n) {
+    int nleaves = n ? (n + LEAF_MAX - 1) / LEAF_MAX : 1, total = 1 + nleaves;
+    for (int m = nleaves; m > 1; total += m)
+        m = (m + INNER_MAX) / (INNER_MAX + 1);
+
+    // the whole tree is laid out in memory: the meta block, the leaves
+    // left to right, then each level of inner nodes up to the root
+    char *buf = calloc(total, BLOCK_SIZE);
+    int32_t *level = malloc(nleaves * sizeof(level[0]));
+    struct btree_entry *low = calloc(nleaves, sizeof(low[0])); // first entry under each node
+    assert(buf && level && low);
+    int32_t page = 1;
+    for (int i = 0; i < nleaves; i++, page++) {
+        struct leaf *l = (struct leaf *)(buf + (size_t)page * BLOCK_SIZE);
+        l->is_leaf = 1;
+        l->n = n - i * LEAF_MAX < LEAF_MAX ? n - i * LEAF_MAX : LEAF_MAX;
+        l->next = i + 1 < nleaves ? page + 1 : -1;
+        memcpy(l->e, &e[i * LEAF_MAX], l->n * sizeof(l->e[0]));
+        level[i] = page;
+        if (l->n > 0)
+            low[i] = l->e[0];
+    }
+
+    // nodes of a level are spread evenly over the ones above, so none is
+    // left with a single child
+    for (int m = nleaves; m > 1;) {
+        int groups = (m + INNER_MAX) / (INNER_MAX + 1);
+        for (int g = 0; g < groups; g++, page++) {
+            int from = (long)g * m / groups, to = (long)(g + 1) * m / groups;
+            struct inner *in = (struct inner *)(buf + (size_t)page * BLOCK_SIZE);
+            in->is_leaf = 0;
+            in->n = to - from - 1;
+            for (int k = from; k < to; k++) {
+                in->child[k - from] = level[k];
+                if (k > from)
+                    in->key[k - from - 1] = low[k];
+            }
+            level[g] = page; // g <= from, so nothing still needed is overwritten
+            low[g] = low[from];
+        }
+        m = groups;
+    }
+
+    struct meta *meta = (struct meta *)buf;
+    meta->magic = BTREE_MAGIC;
+    meta->root = level[0];
+    write_blocks(file, 0, total, buf);
+    free(buf);
+    free(level);
+    free(low);
+}
+
+// put x under page; if page had to split, 1 is returned, with the first
+// entry of the new right half in *sep and its page in *right
+static int insert(const char *file, int32_t page, const struct btree_entry *x,
+                  struct btree_entry *sep, int32_t *right) {
+    char *p = pin_block(file, page);
+
+    if (((struct leaf *)p)->is_leaf) {
+        struct leaf *l = (struct leaf *)p;
+        int i = lower_bound(l->e, l->n, x);
+        if (l->n < LEAF_MAX) {
+            memmove(&l->e[i + 1], &l->e[i], (l->n - i) * sizeof(l->e[0]));
+            l->e[i] = *x;
+            l->n++;
+            unpin_block(p, 1);
+            return 0;
+        }
+
+        // full: the lower half stays, the upper half moves to a new leaf
+        struct btree_entry all[LEAF_MAX + 1];
+        memcpy(all, l->e, i * sizeof(all[0]));
+        all[i] = *x;
+        memcpy(&all[i + 1], &l->e[i], (LEAF_MAX - i) * sizeof(all[0]));
+        int half = (LEAF_MAX + 1) / 2;
+
+        *right = alloc_block(file);
+        struct leaf *r = (struct leaf *)pin_block(file, *right);
+        r->is_leaf = 1;
+        r->n = LEAF_MAX + 1 - half;
+        memcpy(r->e, &all[half], r->n * sizeof(all[0]));
+        r->next = l->next;
+        l->next = *right;
+        l->n = half;
+        memcpy(l->e, all, half * sizeof(all[0]));
+        *sep = r->e[0];
+        unpin_block((char *)r, 1);
+        unpin_block(p, 1);
+        return 1;
+    }
+
+    struct inner *in = (struct inner *)p;
+    int i = child_index(in, x);
+    int32_t child = in->child[i];
+    unpin_block(p, 0);
+
+    struct btree_entry csep;
+    int32_t cright;
+    if (!insert(file, child, x, &csep, &cright))
+        return 0;
+
+    // the child split: csep and cright go in at i
+    in = (struct inner *)pin_block(file, page);
+    if (in->n < INNER_MAX) {
+        memmove(&in->key[i + 1], &in->key[i], (in->n - i) * sizeof(in->key[0]));
+        memmove(&in->child[i + 2], &in->child[i + 1], (in->n - i) * sizeof(in->child[0]));
+        in->key[i] = csep;
+        in->child[i + 1] = cright;
+        in->n++;
+        unpin_block((char *)in, 1);
+        return 0;
+    }
+
+    // full as well: the middle key moves up, what is right of it moves out
+    struct btree_entry keys[INNER_MAX + 1];
+    int32_t children[INNER_MAX + 2];
+    memcpy(keys, in->key, i * sizeof(keys[0]));
+    keys[i] = csep;
+    memcpy(&keys[i + 1], &in->key[i], (INNER_MAX - i) * sizeof(keys[0]));
+    memcpy(children, in->child, (i + 1) * sizeof(children[0]));
+    children[i + 1] = cright;
+    memcpy(&children[i + 2], &in->child[i + 1], (INNER_MAX - i) * sizeof(children[0]));
+    int mid = (INNER_MAX + 1) / 2;
+
+    *right = alloc_block(file);
+    struct inner *r = (struct inner *)pin_block(file, *right);
+    r->is_leaf = 0;
+    r->n = INNER_MAX - mid;
+    memcpy(r->key, &keys[mid + 1], r->n * sizeof(keys[0]));
+    memcpy(r->child, &children[mid + 1], (r->n + 1) * sizeof(children[0]));
+    in->n = mid;
+    memcpy(in->key, keys, mid * sizeof(keys[0]));
+    memcpy(in->child, children, (mid + 1) * sizeof(children[0]));
+    *sep = keys[mid];
+    unpin_block((char *)r, 1);
+    unpin_block((char *)in, 1);
+    return 1;
+}
+
+void btree_insert(const char *file, int32_t key, int32_t block, int32_t slot) {
+    struct btree_entry x = {key, block, slot}, sep;
+    int32_t root = root_of(file), right;
+
+    if (!insert(file, root, &x, &sep, &right))
+        return;
+
+    // the root split: the tree grows a level
+    int32_t newroot = alloc_block(file);
+    struct inner *in = (struct inner *)pin_block(file, newroot);
+    in->is_leaf = 0;
+    in->n = 1;
+    in->key[0] = sep;
+    in->child[0] = root;
+    in->child[1] = right;
+    unpin_block((char *)in, 1);
+
+    struct meta *m = (struct meta *)pin_block(file, 0);
+    m->root = newroot;
+    unpin_block((char *)m, 1);
+}
+
+// the leaf that x is in, or would go in
+static int32_t find_leaf(const char *file, const struct btree_entry *x) {
+    int32_t page = root_of(file);
+    for (;;) {
+        struct inner *in = (struct inner *)pin_block(file, page);
+        if (in->is_leaf) {
+            unpin_block((char *)in, 0);
+            return page;
+        }
+        int32_t child = in->child[child_index(in, x)];
+        unpin_block((char *)in, 0);
+        page = child;
+    }
+}
+
+int btree_delete(const char *file, int32_t key, int32_t block, int32_t slot) {
+    struct btree_entry x = {key, block, slot};
+    struct leaf *l = (struct leaf *)pin_block(file, find_leaf(file, &x));
+    int i = lower_bound(l->e, l->n, &x);
+
+    if (i == l->n || cmp(&l->e[i], &x) != 0) {
+        unpin_block((char *)l, 0);
+        return 0;
+    }
+    memmove(&l->e[i], &l->e[i + 1], (l->n - i - 1) * sizeof(l->e[0]));
+    l->n--;
+    unpin_block((char *)l, 1);
+    return 1;
+}
+
+void btree_seek(struct btree_cursor *c, const char *file, int32_t key) {
+    struct btree_entry x = {key, INT32_MIN, INT32_MIN};
+
+    c->file = file;
+    c->page = find_leaf(file, &x);
+    struct leaf *l = (struct leaf *)pin_block(file, c->page);
+    c->pos = lower_bound(l->e, l->n, &x);
+    unpin_block((char *)l, 0);
+}
+
+int btree_next(struct btree_cursor *c, struct btree_entry *e) {
+    while (c->page != -1) {
+        struct leaf *l = (struct leaf *)pin_block(c->file, c->page);
+        if (c->pos < l->n) {
+            *e = l->e[c->pos++];
+            unpin_block((char *)l, 0);
+            return 1;
+        }
+        int32_t next = l->next;
+        unpin_block((char *)l, 0);
+        c->page = next;
+        c->pos = 0;
+    }
+    return 0;
+}
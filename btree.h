@@ -0,0 +1,48 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <stdint.h>
+
+// A B+tree in its own file, one node per blockio block. Entries are
+// (key, block, slot): the key and where its row is in the table file.
+// They are ordered by all three, so a key may appear more than once and
+// every entry is still unique. Leaves are chained left to right for
+// range scans. Deletes only take the entry out of its leaf; nodes are
+// not merged, so a leaf may end up empty and a scan steps over it.
+
+struct btree_entry {
+    int32_t key;
+    int32_t block; // where the row is in the table file
+    int32_t slot;
+};
+
+// a position in the leaves, see btree_seek
+struct btree_cursor {
+    const char *file;
+    int32_t page; // -1 past the last leaf
+    int pos;
+};
+
+// make file an empty tree (the file must not exist yet)
+void btree_create(const char *file);
+
+// sort entries into tree order
+void btree_sort(struct btree_entry *e, int n);
+
+// make file a tree holding the n entries, which must be in tree order,
+// with leaves filled up and built bottom up, level by level, in one
+// write (the file must not exist yet)
+void btree_build(const char *file, const struct btree_entry *e, int n);
+
+void btree_insert(const char *file, int32_t key, int32_t block, int32_t slot);
+
+// 1 if the entry was there
+int btree_delete(const char *file, int32_t key, int32_t block, int32_t slot);
+
+// put c before the first entry with a key >= key
+void btree_seek(struct btree_cursor *c, const char *file, int32_t key);
+
+// the entry at c, moving c past it; 0 when there are no more
+int btree_next(struct btree_cursor *c, struct btree_entry *e);
+
+#endif // BTREE_H
@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "catalog.h"
+
+#define CATALOG_MAGIC 0x31544143 // "CAT1"
+
+// which schema.db a catalog was built from; all zero if there was none
+struct stamp
+{
+    uint64_t size, ino;
+    int64_t sec, nsec;
+};
+
+// catalog.bin starts with this, then has a hash table of nslots
+// uint32_t offsets of table records, 0 for a free slot, then the
+// records, each as put_table writes it. A lookup only reads the slots
+// it probes and the one record, however many tables there are
+struct catalog_header
+{
+    uint32_t magic;
+    uint32_t ntables;
+    uint32_t nslots; // a power of 2, at least twice ntables
+    uint32_t unused;
+    struct stamp stamp;
+};
+
+// the tables while the catalog is built from schema.db
+static struct table_desc *tables;
+static int ntables, table_cap;
+static int32_t *slots; // hash table: index into tables, -1 for a free slot
+static uint32_t nslots;
+
+// the catalog in use: catalog.bin mapped, or the image of it that was
+// just built, if it could not be written
+static char *image;
+static size_t image_len;
+static int image_mapped;
+static struct stamp loaded;
+static struct table_desc current; // what catalog_table returned last
+static int lock_fd = -1, lock_depth;
+
+static void stamp_of(const struct stat *sb, struct stamp *st)
+{
+    st->size = sb->st_size;
+    st->ino = sb->st_ino;
+    st->sec = sb->st_mtim.tv_sec;
+    st->nsec = sb->st_mtim.tv_nsec;
+}
+
+// FNV-1a
+static uint32_t hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+static int find(const char *tbl)
+{
+    if (!nslots)
+        return -1;
+    for (uint32_t i = hash(tbl) & (nslots - 1);; i = (i + 1) & (nslots - 1))
+    {
+        if (slots[i] < 0)
+            return -1;
+        if (strcmp(tables[slots[i]].name, tbl) == 0)
+            return slots[i];
+    }
+}
+
+static void rehash(uint32_t n)
+{
+    free(slots);
+    nslots = n;
+    slots = malloc(nslots * sizeof(slots[0]));
+    memset(slots, 0xff, nslots * sizeof(slots[0]));
+    for (int t = 0; t < ntables; t++)
+    {
+        uint32_t i = hash(tables[t].name) & (nslots - 1);
+        while (slots[i] >= 0)
+            i = (i + 1) & (nslots - 1);
+        slots[i] = t;
+    }
+}
+
+static void clear(void)
+{
+    ntables = 0;
+    rehash(16);
+}
+
+// a new, zeroed descriptor for tbl, which is not in the catalog yet
+static struct table_desc *add(const char *tbl)
+{
+    if (ntables == table_cap)
+    {
+        table_cap = table_cap ? 2 * table_cap : 16;
+        tables = realloc(tables, table_cap * sizeof(tables[0]));
+    }
+    struct table_desc *t = &tables[ntables++];
+    memset(t, 0, sizeof(*t));
+    snprintf(t->name, sizeof(t->name), "%s", tbl);
+
+    // at most half full, so probes stay short
+    if (2 * (uint32_t)ntables > nslots)
+        rehash(2 * nslots);
+    else
+    {
+        uint32_t i = hash(tbl) & (nslots - 1);
+        while (slots[i] >= 0)
+            i = (i + 1) & (nslots - 1);
+        slots[i] = ntables - 1;
+    }
+    return t;
+}
+
+/*
+Builds the catalog from schema.db: a tbl|columns; line for each table,
+and an idx:<name>|<table>|<column>; line for each CREATE INDEX. Tables
+with an integer id column have the id index from CREATE TABLE as well,
+which is there before the table's line is
+*/
+static void build(struct stamp *st)
+{
+    clear();
+    FILE *fp = fopen(SCHEMA_FILE, "r");
+    memset(st, 0, sizeof(*st));
+    if (!fp)
+        return;
+    struct stat sb;
+    if (fstat(fileno(fp), &sb) == 0)
+        stamp_of(&sb, st);
+
+    char line[512], name[64], tbl[64], column[64], err[128];
+    while (fgets(line, sizeof(line), fp))
+    {
+        struct table_desc *t;
+        if (sscanf(line, "idx:%63[^|]|%63[^|]|%63[^;]", name, tbl, column) == 3)
+        {
+            int i = find(tbl), col;
+            if (i < 0 || (t = &tables[i])->nidx == MAX_INDEXES ||
+                (col = schema_column(&t->s, column)) < 0)
+                continue;
+            struct index_def *idx = &t->idx[t->nidx++];
+            strcpy(idx->name, name);
+            strcpy(idx->column, column);
+            idx->col = col;
+            snprintf(idx->file, sizeof(idx->file), "%s.%s.idx", tbl, name);
+            continue;
+        }
+
+        char *bar = strchr(line, '|'), *semi = strchr(line, ';');
+        if (!bar || !semi || semi < bar || bar - line >= (long)sizeof(tbl) || bar == line)
+            continue;
+        *bar = *semi = '\0';
+        struct schema s;
+        if (find(line) >= 0 || !schema_parse(bar + 1, &s, err, sizeof(err)))
+            continue;
+        t = add(line);
+        t->s = s;
+
+        int id = schema_column(&s, "id");
+        struct index_def *idx = &t->idx[0];
+        snprintf(idx->file, sizeof(idx->file), "%s.idx", t->name);
+        if (id >= 0 && s.col[id].type != COL_CHAR)
+        {
+            strcpy(idx->name, "primary");
+            strcpy(idx->column, "id");
+            idx->col = id;
+            t->nidx = 1;
+        }
+    }
+    fclose(fp);
+}
+
+struct buf
+{
+    char *data;
+    size_t len, cap;
+};
+
+static void put(struct buf *b, const void *p, size_t n)
+{
+    if (b->len + n > b->cap)
+    {
+        b->cap = b->cap ? 2 * b->cap : 4096;
+        if (b->cap < b->len + n)
+            b->cap = b->len + n;
+        b->data = realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+}
+
+static void put_u8(struct buf *b, int v)
+{
+    uint8_t x = v;
+    put(b, &x, 1);
+}
+
+static void put_u16(struct buf *b, int v)
+{
+    uint16_t x = v;
+    put(b, &x, 2);
+}
+
+static void put_str(struct buf *b, const char *s)
+{
+    put_u8(b, strlen(s));
+    put(b, s, strlen(s));
+}
+
+// names are stored with a length byte and no padding, numbers in as few
+// bytes as they need
+static void put_table(struct buf *b, const struct table_desc *t)
+{
+    put_str(b, t->name);
+    put_u8(b, t->s.ncols);
+    for (int c = 0; c < t->s.ncols; c++)
+    {
+        put_str(b, t->s.col[c].name);
+        put_u8(b, t->s.col[c].type);
+        put_u16(b, t->s.col[c].size);
+        put_u16(b, t->s.col[c].offset);
+    }
+    put_u16(b, t->s.row_size);
+    put_u16(b, t->s.slots);
+    put_u8(b, t->nidx);
+    for (int i = 0; i < t->nidx; i++)
+    {
+        put_str(b, t->idx[i].name);
+        put_u8(b, t->idx[i].col);
+        put_str(b, t->idx[i].file);
+    }
+}
+
+static void set_image(char *data, size_t len, int mapped)
+{
+    if (image_mapped)
+        munmap(image, image_len);
+    else
+        free(image);
+    image = data;
+    image_len = len;
+    image_mapped = mapped;
+}
+
+/*
+Lays the tables that build found out as catalog.bin and makes that the
+catalog in use. It is written through a temp file, so readers never see
+half of it, and not at all if there was no schema.db
+*/
+static void save(const struct stamp *st)
+{
+    struct catalog_header hdr = {CATALOG_MAGIC, ntables, nslots, 0, *st};
+    struct buf b = {0};
+    put(&b, &hdr, sizeof(hdr));
+    uint32_t *offsets = calloc(nslots, sizeof(offsets[0]));
+    put(&b, offsets, nslots * sizeof(offsets[0]));
+    for (uint32_t i = 0; i < nslots; i++)
+    {
+        if (slots[i] >= 0)
+        {
+            offsets[i] = b.len;
+            put_table(&b, &tables[slots[i]]);
+        }
+    }
+    memcpy(b.data + sizeof(hdr), offsets, nslots * sizeof(offsets[0]));
+    free(offsets);
+    set_image(b.data, b.len, 0);
+
+    if (!st->ino)
+        return;
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), "%s.%d", CATALOG_FILE, getpid());
+    FILE *fp = fopen(tmp, "w");
+    if (fp)
+    {
+        fwrite(b.data, 1, b.len, fp);
+        if (fclose(fp) != 0 || rename(tmp, CATALOG_FILE) != 0)
+            unlink(tmp);
+    }
+}
+
+struct reader
+{
+    const char *p, *end;
+    int ok;
+};
+
+static void get(struct reader *r, void *out, size_t n)
+{
+    if ((size_t)(r->end - r->p) < n)
+    {
+        r->ok = 0;
+        memset(out, 0, n);
+        return;
+    }
+    memcpy(out, r->p, n);
+    r->p += n;
+}
+
+static int get_u8(struct reader *r)
+{
+    uint8_t x;
+    get(r, &x, 1);
+    return x;
+}
+
+static int get_u16(struct reader *r)
+{
+    uint16_t x;
+    get(r, &x, 2);
+    return x;
+}
+
+static void get_str(struct reader *r, char *out, size_t size)
+{
+    size_t n = get_u8(r);
+    if (n >= size)
+        r->ok = 0;
+    get(r, out, n < size ? n : 0);
+    out[n < size ? n : 0] = '\0';
+}
+
+// the rest of a table record, after its name
+static int get_table(struct reader *r, struct table_desc *t)
+{
+    t->s.ncols = get_u8(r);
+    if (t->s.ncols > SCHEMA_MAX_COLS)
+        return 0;
+    for (int c = 0; c < t->s.ncols && r->ok; c++)
+    {
+        struct column *col = &t->s.col[c];
+        get_str(r, col->name, sizeof(col->name));
+        col->type = get_u8(r);
+        col->size = get_u16(r);
+        col->offset = get_u16(r);
+        if (col->type > COL_CHAR || col->offset + col->size > SCHEMA_ROW_BYTES)
+            return 0;
+    }
+    t->s.row_size = get_u16(r);
+    t->s.slots = get_u16(r);
+    if (t->s.row_size == 0 || t->s.row_size * t->s.slots > SCHEMA_ROW_BYTES)
+        return 0;
+    t->nidx = get_u8(r);
+    if (t->nidx > MAX_INDEXES)
+        return 0;
+    for (int i = 0; i < t->nidx && r->ok; i++)
+    {
+        struct index_def *idx = &t->idx[i];
+        get_str(r, idx->name, sizeof(idx->name));
+        idx->col = get_u8(r);
+        get_str(r, idx->file, sizeof(idx->file));
+        if (idx->col >= t->s.ncols)
+            return 0;
+        strcpy(idx->column, t->s.col[idx->col].name);
+    }
+    return r->ok;
+}
+
+/*
+Maps catalog.bin if it was built from the schema.db that st describes
+Returns 0 if it is not there or is for another schema.db
+*/
+static int load(const struct stamp *st)
+{
+    int fd = open(CATALOG_FILE, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat sb;
+    char *data = MAP_FAILED;
+    if (fstat(fd, &sb) == 0 && sb.st_size >= (off_t)sizeof(struct catalog_header))
+        data = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return 0;
+
+    const struct catalog_header *hdr = (const struct catalog_header *)data;
+    if (hdr->magic != CATALOG_MAGIC || memcmp(&hdr->stamp, st, sizeof(*st)) != 0 ||
+        hdr->nslots == 0 || (hdr->nslots & (hdr->nslots - 1)) ||
+        hdr->nslots > (sb.st_size - sizeof(*hdr)) / sizeof(uint32_t))
+    {
+        munmap(data, sb.st_size);
+        return 0;
+    }
+    set_image(data, sb.st_size, 1);
+    return 1;
+}
+
+/*
+Looks tbl up in the catalog in use and decodes its record into t
+Returns 1 if it is there, 0 if not, -1 if the record is damaged
+*/
+static int lookup(const char *tbl, struct table_desc *t)
+{
+    const struct catalog_header *hdr = (const struct catalog_header *)image;
+    const uint32_t *offsets = (const uint32_t *)(image + sizeof(*hdr));
+    uint32_t mask = hdr->nslots - 1, i = hash(tbl) & mask;
+
+    for (uint32_t probes = 0; probes < hdr->nslots; probes++, i = (i + 1) & mask)
+    {
+        if (offsets[i] == 0)
+            return 0;
+        if (offsets[i] >= image_len)
+            return -1;
+        struct reader r = {image + offsets[i], image + image_len, 1};
+        get_str(&r, t->name, sizeof(t->name));
+        if (!r.ok)
+            return -1;
+        if (strcmp(t->name, tbl) == 0)
+            return get_table(&r, t) ? 1 : -1;
+    }
+    return 0;
+}
+
+void catalog_lock(void)
+{
+    if (lock_depth++ > 0)
+        return;
+    lock_fd = open(SCHEMA_FILE, O_RDWR | O_CREAT, 0666);
+    if (lock_fd >= 0)
+        flock(lock_fd, LOCK_EX);
+}
+
+void catalog_unlock(void)
+{
+    if (--lock_depth > 0 || lock_fd < 0)
+        return;
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    lock_fd = -1;
+}
+
+void catalog_reload(void)
+{
+    catalog_lock();
+    build(&loaded);
+    save(&loaded);
+    catalog_unlock();
+}
+
+// schema.db changed since the catalog in use was built: another process
+// may have saved a catalog.bin for it by now, and if not it is built
+// here. Either happens under the lock, so catalog.bin is only ever
+// replaced by one built from what schema.db holds then
+static void refresh(const struct stamp *now)
+{
+    if (!now->ino) // no schema.db, no tables, and nothing to save
+    {
+        build(&loaded);
+        save(&loaded);
+        return;
+    }
+    if (load(now))
+    {
+        loaded = *now;
+        return;
+    }
+    catalog_lock();
+    struct stamp locked = {0};
+    struct stat sb;
+    if (stat(SCHEMA_FILE, &sb) == 0)
+        stamp_of(&sb, &locked);
+    if (load(&locked))
+        loaded = locked;
+    else
+        catalog_reload();
+    catalog_unlock();
+}
+
+const struct table_desc *catalog_table(const char *tbl)
+{
+    // a stat per lookup; schema.db is only read when it changed
+    struct stamp now = {0};
+    struct stat sb;
+    if (stat(SCHEMA_FILE, &sb) == 0)
+        stamp_of(&sb, &now);
+    if (!image || memcmp(&now, &loaded, sizeof(now)) != 0)
+        refresh(&now);
+
+    int found = lookup(tbl, &current);
+    if (found < 0)
+    {
+        // a damaged catalog.bin: the one built now replaces it
+        catalog_reload();
+        found = lookup(tbl, &current);
+    }
+    return found > 0 ? &current : NULL;
+}
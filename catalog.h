@@ -0,0 +1,50 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "schema.h"
+
+// Every table in schema.db, parsed once: its columns and row layout and
+// the indexes on it. The parsed form is kept in catalog.bin together
+// with a hash table on the table names, and stamped with the size, mtime
+// and inode of the schema.db it came from. A process maps catalog.bin
+// instead of scanning and parsing schema.db, and a lookup only decodes
+// the one table, however many there are. Before each lookup schema.db
+// is stat'ed; when the stamp no longer matches, the catalog is built
+// again from schema.db and catalog.bin rewritten.
+
+#define SCHEMA_FILE "schema.db"
+#define CATALOG_FILE "catalog.bin"
+
+#define MAX_INDEXES 8 // per table, the id index included
+
+// an index on one integer column, each entry pointing at a row
+struct index_def
+{
+    char name[64];
+    char column[64];
+    int col;        // the column's index in the table's schema
+    char file[136]; // <table>.idx or <table>.<name>.idx
+};
+
+struct table_desc
+{
+    char name[64];
+    struct schema s;
+    int nidx;
+    struct index_def idx[MAX_INDEXES]; // the id index, if any, first
+};
+
+// the named table, NULL if schema.db has none by that name. The
+// descriptor is valid until the next catalog_table or catalog_reload
+const struct table_desc *catalog_table(const char *tbl);
+
+// schema.db's lock, held while it is appended to and while the catalog
+// is built from it and saved. It can be taken again by the holder. A
+// table's lock, when one is needed too, is taken first
+void catalog_lock(void);
+void catalog_unlock(void);
+
+// build the catalog from schema.db now, after it was appended to
+void catalog_reload(void);
+
+#endif // CATALOG_H
@@ -0,0 +1,159 @@
+#include <pthread.h>
+#include "io_helper.h"
+#include "request.h"
+#include "coalesce.h"
+
+int coalesce_enabled = 0;
+
+// dynamic routes that are safe to share: script, and required query prefix
+static const struct { char *script, *prefix; } idempotent[] = {
+    {"./spin.cgi", ""},
+    {"./sql.cgi", "SELECT"},
+    {"./sql.cgi", "DUMP"},
+};
+
+// one CGI run in progress, and everyone waiting on it
+struct flight {
+    char *key;             // filename?cgiargs
+    int joinable;          // no write was running when it started
+    unsigned long writes;  // writes started before it
+    int done, rc;
+    char *out;
+    size_t outlen;
+    int refs;              // callers still to copy the output
+    int fanout;            // requests served by this run
+    pthread_cond_t cv;
+    struct flight *next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct flight *flights; // runs in progress
+
+// dynamic requests that are not idempotent, started and still running.
+// A run only serves later requests while no write overlaps it, so a
+// write that finished before a request came in is never missed
+static unsigned long writes_begun;
+static int writes_active;
+
+// counters
+static unsigned long runs;     // CGI processes actually started
+static unsigned long hits;     // requests that joined a run
+static int max_fanout;
+
+int coalesce_idempotent(char *filename, char *cgiargs) {
+    for (size_t i = 0; i < sizeof(idempotent) / sizeof(idempotent[0]); i++) {
+        if (strcmp(filename, idempotent[i].script) == 0 &&
+            strncasecmp(cgiargs, idempotent[i].prefix,
+                        strlen(idempotent[i].prefix)) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+void coalesce_write_begin(void) {
+    if (!coalesce_enabled)
+        return;
+    pthread_mutex_lock(&lock);
+    writes_begun++;
+    writes_active++;
+    pthread_mutex_unlock(&lock);
+}
+
+void coalesce_write_end(void) {
+    if (!coalesce_enabled)
+        return;
+    pthread_mutex_lock(&lock);
+    writes_active--;
+    pthread_mutex_unlock(&lock);
+}
+
+// copy the shared output for one caller; called with lock held
+static int flight_take(struct flight *f, char **out, size_t *outlen) {
+    int rc = f->rc;
+    if (rc == 0) {
+        *out = malloc(f->outlen ? f->outlen : 1);
+        assert(*out != NULL);
+        memcpy(*out, f->out, f->outlen);
+        *outlen = f->outlen;
+    }
+    if (--f->refs == 0) {
+        pthread_cond_destroy(&f->cv);
+        free(f->out);
+        free(f->key);
+        free(f);
+    }
+    return rc;
+}
+
+int coalesce_run_cgi(char *filename, char *cgiargs, char **out, size_t *outlen) {
+    struct flight *f;
+    int rc;
+
+    if (!coalesce_enabled)
+        return request_run_cgi(filename, cgiargs, out, outlen);
+    if (!coalesce_idempotent(filename, cgiargs)) {
+        coalesce_write_begin();
+        rc = request_run_cgi(filename, cgiargs, out, outlen);
+        coalesce_write_end();
+        return rc;
+    }
+
+    size_t klen = strlen(filename) + strlen(cgiargs) + 2;
+    char *key = malloc(klen);
+    assert(key != NULL);
+    snprintf(key, klen, "%s?%s", filename, cgiargs);
+
+    pthread_mutex_lock(&lock);
+    for (f = flights; f; f = f->next) {
+        if (strcmp(f->key, key) == 0 && f->joinable && f->writes == writes_begun)
+            break;
+    }
+    if (f) {
+        // same request already running: wait for its output
+        free(key);
+        f->refs++;
+        f->fanout++;
+        hits++;
+        while (!f->done)
+            pthread_cond_wait(&f->cv, &lock);
+        rc = flight_take(f, out, outlen);
+        pthread_mutex_unlock(&lock);
+        return rc;
+    }
+
+    f = calloc(1, sizeof *f);
+    assert(f != NULL);
+    f->key = key;
+    f->joinable = writes_active == 0;
+    f->writes = writes_begun;
+    f->refs = f->fanout = 1;
+    pthread_cond_init(&f->cv, NULL);
+    f->next = flights;
+    flights = f;
+    runs++;
+    pthread_mutex_unlock(&lock);
+
+    rc = request_run_cgi(filename, cgiargs, &f->out, &f->outlen);
+
+    pthread_mutex_lock(&lock);
+    // later arrivals start a fresh run, results are never reused
+    struct flight **pp = &flights;
+    while (*pp != f)
+        pp = &(*pp)->next;
+    *pp = f->next;
+    f->rc = rc;
+    f->done = 1;
+    if (f->fanout > max_fanout)
+        max_fanout = f->fanout;
+    pthread_cond_broadcast(&f->cv);
+    rc = flight_take(f, out, outlen);
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+void coalesce_report(void) {
+    pthread_mutex_lock(&lock);
+    printf("[pid %d] coalesce: %lu runs, %lu coalesced, max fanout %d\n",
+           getpid(), runs, hits, max_fanout);
+    pthread_mutex_unlock(&lock);
+}
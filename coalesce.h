@@ -0,0 +1,31 @@
+#ifndef __COALESCE_H__
+#define __COALESCE_H__
+
+#include <stddef.h>
+
+//
+// Single-flight for dynamic requests: while a CGI run for some
+// (filename, cgiargs) is in progress, identical requests on idempotent
+// routes wait for it and get a copy of its output instead of forking
+// their own process. A request only joins a run that no write (a
+// dynamic request on another route) overlapped, so it never gets data
+// older than a write that finished before it came in.
+//
+
+extern int coalesce_enabled; // wserver -c
+
+// 1 if concurrent runs of this request may share one result
+int coalesce_idempotent(char *filename, char *cgiargs);
+
+// like request_run_cgi(), sharing the run when allowed
+int coalesce_run_cgi(char *filename, char *cgiargs, char **out, size_t *outlen);
+
+// around a dynamic request that is not idempotent and runs outside
+// coalesce_run_cgi(): runs it overlaps are not shared with later requests
+void coalesce_write_begin(void);
+void coalesce_write_end(void);
+
+// one line of counters on stdout
+void coalesce_report(void);
+
+#endif // __COALESCE_H__
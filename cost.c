@@ -0,0 +1,146 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include "cost.h"
+
+#define COST_ROUTES 1024      // hash table slots; unseen routes past this
+                              // share the dynamic mean
+#define COST_ALPHA 0.25       // weight of the newest sample
+#define STATIC_OVERHEAD 4096  // fixed cost of a static hit, in bytes
+#define DYNAMIC_PRIOR 10e6    // ns, for dynamic requests before any sample
+#define STATIC_PRIOR 2.0      // ns per byte before any sample
+
+struct route {
+    char *key;                // NULL if the slot is free
+    double ewma;              // ns
+    unsigned long samples;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct route routes[COST_ROUTES];
+static int nroutes;
+static double static_ns_per_byte = STATIC_PRIOR;
+static double dynamic_mean = DYNAMIC_PRIOR;
+static int have_static, have_dynamic;
+
+uint64_t cost_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double ewma(double old, double sample, int first) {
+    return first ? sample : old + COST_ALPHA * (sample - old);
+}
+
+// script?args with digit runs folded, unless the args are only a number;
+// %xx escapes are kept so "%20" does not turn into "%#"
+static void route_key(char *filename, char *cgiargs, char *key, size_t cap) {
+    size_t n = snprintf(key, cap, "%s?", filename);
+    char *a = cgiargs;
+    int numeric = *a != '\0';
+
+    for (char *p = a; *p; p++) {
+        if (!isdigit((unsigned char) *p)) {
+            numeric = 0;
+            break;
+        }
+    }
+    while (*a && n + 1 < cap) {
+        if (a[0] == '%' && isxdigit((unsigned char) a[1]) &&
+            isxdigit((unsigned char) a[2]) && n + 3 < cap) {
+            memcpy(key + n, a, 3);
+            n += 3;
+            a += 3;
+        } else if (!numeric && isdigit((unsigned char) *a)) {
+            key[n++] = '#';
+            while (isdigit((unsigned char) *a))
+                a++;
+        } else {
+            key[n++] = *a++;
+        }
+    }
+    key[n] = '\0';
+}
+
+// slot for key, adding it if there is room; COST_UNTRACKED when full.
+// called with lock held
+static int route_find(char *key) {
+    unsigned long h = 5381;
+    for (char *p = key; *p; p++)
+        h = h * 33 + (unsigned char) *p;
+
+    for (int i = 0; i < COST_ROUTES; i++) {
+        int slot = (h + i) % COST_ROUTES;
+        if (!routes[slot].key) {
+            if (nroutes >= COST_ROUTES / 2)
+                return COST_UNTRACKED; // keep probes short
+            routes[slot].key = strdup(key);
+            if (!routes[slot].key)
+                return COST_UNTRACKED;
+            nroutes++;
+            return slot;
+        }
+        if (strcmp(routes[slot].key, key) == 0)
+            return slot;
+    }
+    return COST_UNTRACKED;
+}
+
+uint64_t cost_estimate(int is_static, char *filename, char *cgiargs,
+                       off_t size, int *route) {
+    char key[256];
+    double est;
+
+    pthread_mutex_lock(&lock);
+    if (is_static) {
+        *route = COST_STATIC;
+        est = static_ns_per_byte * (size + STATIC_OVERHEAD);
+    } else {
+        route_key(filename, cgiargs, key, sizeof(key));
+        *route = route_find(key);
+        if (*route >= 0 && routes[*route].samples > 0)
+            est = routes[*route].ewma;
+        else
+            est = dynamic_mean;
+    }
+    pthread_mutex_unlock(&lock);
+    return (uint64_t) est;
+}
+
+void cost_observe(int route, off_t size, uint64_t ns) {
+    if (route == COST_NONE)
+        return;
+    pthread_mutex_lock(&lock);
+    if (route == COST_STATIC) {
+        double per_byte = (double) ns / (size + STATIC_OVERHEAD);
+        static_ns_per_byte = ewma(static_ns_per_byte, per_byte, !have_static);
+        have_static = 1;
+    } else {
+        if (route >= 0) {
+            struct route *r = &routes[route];
+            r->ewma = ewma(r->ewma, ns, r->samples == 0);
+            r->samples++;
+        }
+        dynamic_mean = ewma(dynamic_mean, ns, !have_dynamic);
+        have_dynamic = 1;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void cost_report(void) {
+    pthread_mutex_lock(&lock);
+    printf("[pid %d] cost: static %.2f ns/byte, dynamic mean %.3f ms\n",
+           getpid(), static_ns_per_byte, dynamic_mean / 1e6);
+    for (int i = 0; i < COST_ROUTES; i++) {
+        if (routes[i].key && routes[i].samples > 0)
+            printf("[pid %d] cost: %s %.3f ms (%lu samples)\n", getpid(),
+                   routes[i].key, routes[i].ewma / 1e6, routes[i].samples);
+    }
+    pthread_mutex_unlock(&lock);
+    fflush(stdout);
+}
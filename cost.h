@@ -0,0 +1,36 @@
+#ifndef __COST_H__
+#define __COST_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+//
+// Expected service time for SFF.
+//
+// Static files are ranked by size, scaled by a learned cost per byte.
+// Dynamic requests are ranked by an EWMA of how long the same route took
+// before; a route is the script plus its arguments with digit runs
+// folded to '#', so "SELECT ... WHERE id=7" and "... id=9" share an
+// estimate. Purely numeric arguments (spin.cgi?5) are kept as they are.
+// All estimates are in nanoseconds, so static and dynamic jobs in one
+// queue compare directly.
+//
+
+#define COST_STATIC -1    // route of a static file
+#define COST_UNTRACKED -2 // dynamic route that did not fit in the table
+#define COST_NONE -3      // not a request, nothing to learn
+
+// estimate for one request; *route identifies it for cost_observe()
+uint64_t cost_estimate(int is_static, char *filename, char *cgiargs,
+                       off_t size, int *route);
+
+// feed back the measured service time of a request
+void cost_observe(int route, off_t size, uint64_t ns);
+
+// monotonic clock in nanoseconds
+uint64_t cost_now(void);
+
+// learned estimates on stdout
+void cost_report(void);
+
+#endif // __COST_H__
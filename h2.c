@@ -0,0 +1,856 @@
+#include <pthread.h>
+#include <sys/uio.h>
+#include "io_helper.h"
+#include "request.h"
+#include "hpack.h"
+#include "coalesce.h"
+#include "h2.h"
+#include "accesslog.h"
+
+#define MAXBUF (8192)
+
+// frame types (RFC 7540 section 6)
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_PRIORITY 0x2
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PUSH_PROMISE 0x5
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+// frame flags
+#define H2_END_STREAM 0x1
+#define H2_ACK 0x1
+#define H2_END_HEADERS 0x4
+#define H2_PADDED 0x8
+#define H2_PRIO 0x20
+
+// error codes (section 7)
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_REFUSED_STREAM 0x7
+#define H2_COMPRESSION_ERROR 0x9
+
+// settings (section 6.5.2)
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+
+#define H2_DEFAULT_WINDOW 65535
+#define H2_MAX_WINDOW 0x7fffffff
+#define H2_DEFAULT_FRAME 16384 // also the largest frame we accept
+#define H2_MAX_STREAMS 100     // concurrent streams per connection
+#define H2_MAX_HEADER_BLOCK (64 * 1024)
+
+static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+#define PREFACE_LEN 24
+#define PREFACE_LINE 16 // "PRI * HTTP/2.0\r\n", parsed by request_handle()
+
+struct h2_conn {
+    int fd;
+    pthread_mutex_t lock;      // protects the fields below, serializes writes
+    int refs;                  // reader thread + live streams
+    int closed;                // connection is gone, drop further output
+    int64_t send_window;       // connection-level flow control window
+    int32_t initial_window;    // peer SETTINGS_INITIAL_WINDOW_SIZE
+    uint32_t max_frame;        // peer SETTINGS_MAX_FRAME_SIZE
+    int nstreams;
+    struct h2_stream *streams; // live streams
+
+    // only touched by the reader thread
+    uint32_t last_stream;      // highest stream id the peer opened
+    int goaway;                // peer sent GOAWAY, no new streams
+    int preface_off;           // preface bytes consumed before the handoff
+    char *pending;             // bytes request_handle() read past the
+    size_t npending, pending_off; // request, to be read before the socket
+    struct h2_stream *upgrade; // stream 1 of an upgraded connection
+    struct hpack_table hpack;
+};
+
+struct h2_stream {
+    struct h2_conn *conn;
+    uint32_t id;
+    int64_t send_window;
+    int reset;                 // peer sent RST_STREAM
+    int sending;               // response started, body waits on the window
+    char method[16];
+    char uri[MAXBUF];
+    char *body;                // response body being sent
+    size_t body_len, body_off;
+    int body_mapped;           // body is an mmap of a static file
+    struct h2_stream *next;
+};
+
+static uint32_t get32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// read exactly n bytes, starting with what request_handle() left over
+static int read_full(struct h2_conn *c, void *buf, size_t n) {
+    size_t got = 0;
+    if (c->pending_off < c->npending) {
+        got = c->npending - c->pending_off;
+        if (got > n)
+            got = n;
+        memcpy(buf, c->pending + c->pending_off, got);
+        c->pending_off += got;
+    }
+    while (got < n) {
+        ssize_t rc = read(c->fd, (char *) buf + got, n - got);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return -1;
+        got += rc;
+    }
+    return 0;
+}
+
+//
+// Write one frame; called with c->lock held. A failed write marks the
+// connection closed rather than killing the server.
+//
+static void send_frame(struct h2_conn *c, int type, int flags, uint32_t sid,
+                       const void *payload, size_t len) {
+    uint8_t hdr[9];
+    struct iovec iov[2];
+    struct msghdr msg;
+
+    if (c->closed)
+        return;
+    hdr[0] = len >> 16;
+    hdr[1] = len >> 8;
+    hdr[2] = len;
+    hdr[3] = type;
+    hdr[4] = flags;
+    put32(hdr + 5, sid & 0x7fffffff);
+
+    // header and payload in one call, so Nagle never splits them
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = (void *) payload;
+    iov[1].iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len ? 2 : 1;
+
+    while (msg.msg_iovlen > 0) {
+        ssize_t rc = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0) {
+            c->closed = 1;
+            return;
+        }
+        while (msg.msg_iovlen > 0 && (size_t) rc >= msg.msg_iov->iov_len) {
+            rc -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + rc;
+            msg.msg_iov->iov_len -= rc;
+        }
+    }
+}
+
+static void send_rst(struct h2_conn *c, uint32_t sid, uint32_t err) {
+    uint8_t p[4];
+    put32(p, err);
+    send_frame(c, H2_RST_STREAM, 0, sid, p, 4);
+}
+
+static void send_window_update(struct h2_conn *c, uint32_t sid, uint32_t inc) {
+    uint8_t p[4];
+    put32(p, inc);
+    send_frame(c, H2_WINDOW_UPDATE, 0, sid, p, 4);
+}
+
+//
+// Connection and stream lifetime: the reader thread holds one reference
+// and every live stream holds one. Whoever drops the last one frees the
+// connection, after unlocking.
+//
+static struct h2_conn *conn_new(int fd, const char *pending, size_t npending) {
+    struct h2_conn *c = calloc(1, sizeof *c);
+    if (!c)
+        return NULL;
+    if (npending > 0) {
+        if (!(c->pending = malloc(npending))) {
+            free(c);
+            return NULL;
+        }
+        memcpy(c->pending, pending, npending);
+        c->npending = npending;
+    }
+    // the worker closes its fd when request_handle() returns
+    if ((c->fd = dup(fd)) < 0) {
+        free(c->pending);
+        free(c);
+        return NULL;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    c->refs = 1;
+    c->send_window = H2_DEFAULT_WINDOW;
+    c->initial_window = H2_DEFAULT_WINDOW;
+    c->max_frame = H2_DEFAULT_FRAME;
+    hpack_table_init(&c->hpack, HPACK_TABLE_SIZE);
+    return c;
+}
+
+static void conn_destroy(struct h2_conn *c) {
+    close(c->fd);
+    free(c->pending);
+    hpack_table_free(&c->hpack);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
+// called with c->lock held
+static struct h2_stream *stream_new(struct h2_conn *c, uint32_t sid) {
+    struct h2_stream *st = calloc(1, sizeof *st);
+    if (!st)
+        return NULL;
+    st->conn = c;
+    st->id = sid;
+    st->send_window = c->initial_window;
+    st->next = c->streams;
+    c->streams = st;
+    c->nstreams++;
+    c->refs++;
+    return st;
+}
+
+// called with c->lock held; returns 1 if the connection must be destroyed
+static int stream_free(struct h2_conn *c, struct h2_stream *st) {
+    struct h2_stream **pp = &c->streams;
+    while (*pp && *pp != st)
+        pp = &(*pp)->next;
+    if (*pp)
+        *pp = st->next;
+    c->nstreams--;
+
+    if (st->body && st->body_mapped)
+        munmap(st->body, st->body_len);
+    else
+        free(st->body);
+    free(st);
+    return --c->refs == 0;
+}
+
+static struct h2_stream *stream_find(struct h2_conn *c, uint32_t sid) {
+    struct h2_stream *st;
+    for (st = c->streams; st; st = st->next)
+        if (st->id == sid)
+            return st;
+    return NULL;
+}
+
+//
+// Send as much of the body as both windows allow; called with c->lock
+// held. The stream is freed once everything went out.
+//
+static int stream_flush(struct h2_conn *c, struct h2_stream *st) {
+    while (!c->closed && st->body_off < st->body_len) {
+        int64_t win = c->send_window < st->send_window ?
+                      c->send_window : st->send_window;
+        if (win <= 0)
+            return 0; // picked up again on WINDOW_UPDATE
+
+        size_t n = st->body_len - st->body_off;
+        if ((int64_t) n > win)
+            n = win;
+        if (n > c->max_frame)
+            n = c->max_frame;
+        int flags = (st->body_off + n == st->body_len) ? H2_END_STREAM : 0;
+        send_frame(c, H2_DATA, flags, st->id, st->body + st->body_off, n);
+        st->body_off += n;
+        c->send_window -= n;
+        st->send_window -= n;
+    }
+    return stream_free(c, st);
+}
+
+static void flush_all(struct h2_conn *c) {
+    struct h2_stream *st, *next;
+    for (st = c->streams; st; st = next) {
+        next = st->next;
+        if (st->sending)
+            stream_flush(c, st); // reader still holds a reference
+    }
+}
+
+//
+// Responses (worker threads)
+//
+static void stream_respond(struct h2_stream *st, int status, char *ctype,
+                           char *body, size_t len, int mapped) {
+    struct h2_conn *c = st->conn;
+    uint8_t block[1024];
+    char clen[32];
+    size_t n = 0;
+    int destroy;
+
+    access_log_status(status);
+    sprintf(clen, "%lu", (unsigned long) len);
+    n += hpack_encode_status(block + n, sizeof(block) - n, status);
+    n += hpack_encode_header(block + n, sizeof(block) - n,
+                             "server", "OSTEP WebServer");
+    n += hpack_encode_header(block + n, sizeof(block) - n,
+                             "content-type", ctype);
+    n += hpack_encode_header(block + n, sizeof(block) - n,
+                             "content-length", clen);
+
+    pthread_mutex_lock(&c->lock);
+    st->body = body;
+    st->body_len = len;
+    st->body_mapped = mapped;
+    if (c->closed || st->reset) {
+        destroy = stream_free(c, st);
+    } else {
+        send_frame(c, H2_HEADERS,
+                   H2_END_HEADERS | (len == 0 ? H2_END_STREAM : 0),
+                   st->id, block, n);
+        st->sending = 1;
+        destroy = stream_flush(c, st);
+    }
+    pthread_mutex_unlock(&c->lock);
+    if (destroy)
+        conn_destroy(c);
+}
+
+static void stream_error(struct h2_stream *st, int status, char *cause,
+                         char *shortmsg, char *longmsg) {
+    char *body = malloc(MAXBUF);
+    assert(body != NULL);
+
+    // same page as request_error()
+    snprintf(body, MAXBUF, ""
+      "<!doctype html>\r\n"
+      "<head>\r\n"
+      "  <title>OSTEP WebServer Error</title>\r\n"
+      "</head>\r\n"
+      "<body>\r\n"
+      "  <h2>%d: %s</h2>\r\n"
+      "  <p>%s: %s</p>\r\n"
+      "</body>\r\n"
+      "</html>\r\n", status, shortmsg, longmsg, cause);
+    stream_respond(st, status, "text/html", body, strlen(body), 0);
+}
+
+//
+// Splits CGI output into its header lines and the body (CGI/1.1 section 6).
+// Returns the length of the header block, 0 if there is none.
+//
+static size_t cgi_headers(char *out, size_t len, int *status,
+                          char *ctype, size_t ctsize) {
+    size_t off = 0;
+
+    while (off < len) {
+        char *line = out + off;
+        char *nl = memchr(line, '\n', len - off);
+        if (!nl)
+            return 0;
+        size_t linelen = nl - line;
+        if (linelen > 0 && line[linelen - 1] == '\r')
+            linelen--;
+        off = nl - out + 1;
+        if (linelen == 0)
+            return off;
+
+        if (strncasecmp(line, "Content-Type:", 13) == 0) {
+            char *v = line + 13;
+            while (*v == ' ')
+                v++;
+            size_t vlen = line + linelen - v;
+            if (vlen >= ctsize)
+                vlen = ctsize - 1;
+            memcpy(ctype, v, vlen);
+            ctype[vlen] = '\0';
+        } else if (strncasecmp(line, "Status:", 7) == 0) {
+            *status = atoi(line + 7);
+        }
+    }
+    return 0;
+}
+
+void h2_stream_handle(struct h2_stream *st) {
+    char filename[MAXBUF], cgiargs[MAXBUF], filetype[MAXBUF];
+    struct stat sbuf;
+    int is_static;
+
+    printf("method:%s uri:%s version:HTTP/2\n", st->method, st->uri);
+    access_log_request(st->conn->fd,
+                       (struct http_slice){st->method, strlen(st->method)},
+                       (struct http_slice){st->uri, strlen(st->uri)},
+                       (struct http_slice){"HTTP/2", 6});
+
+    if (strcasecmp(st->method, "GET")) {
+      stream_error(st, 501, st->method, "Not Implemented",
+                   "server does not implement this method");
+      return;
+    }
+    if (strstr(st->uri, "..")) {
+      stream_error(st, 403, st->uri, "Forbidden",
+                   "Parent-directory (..) access not allowed");
+      return;
+    }
+
+    is_static = request_parse_uri(st->uri, filename, cgiargs);
+    if (stat(filename, &sbuf) < 0) {
+      stream_error(st, 404, filename, "Not found",
+                   "server could not find this file");
+      return;
+    }
+
+    if (is_static) {
+      if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) {
+        stream_error(st, 403, filename, "Forbidden",
+                     "server could not read this file");
+        return;
+      }
+      char *srcp = NULL;
+      if (sbuf.st_size > 0) {
+        int srcfd = open_or_die(filename, O_RDONLY, 0);
+        srcp = mmap_or_die(0, sbuf.st_size, PROT_READ, MAP_PRIVATE, srcfd, 0);
+        close_or_die(srcfd);
+      }
+      request_get_filetype(filename, filetype);
+      stream_respond(st, 200, filetype, srcp, sbuf.st_size, 1);
+    } else {
+      if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {
+        stream_error(st, 403, filename, "Forbidden",
+                     "server could not run this CGI program");
+        return;
+      }
+      char *out;
+      size_t outlen;
+      if (coalesce_run_cgi(filename, cgiargs, &out, &outlen) < 0) {
+        stream_error(st, 500, filename, "Internal Server Error",
+                     "server could not run this CGI program");
+        return;
+      }
+      int status = 200;
+      strcpy(filetype, "text/plain");
+      size_t hlen = cgi_headers(out, outlen, &status, filetype, MAXBUF);
+      memmove(out, out + hlen, outlen - hlen);
+      stream_respond(st, status, filetype, out, outlen - hlen, 0);
+    }
+}
+
+//
+// Reader thread
+//
+
+// called with c->lock held
+static uint32_t apply_settings(struct h2_conn *c, const uint8_t *p, size_t len) {
+    if (len % 6)
+        return H2_FRAME_SIZE_ERROR;
+    for (size_t i = 0; i < len; i += 6) {
+        int id = (p[i] << 8) | p[i + 1];
+        uint32_t val = get32(p + i + 2);
+        if (id == H2_SETTINGS_INITIAL_WINDOW_SIZE) {
+            if (val > H2_MAX_WINDOW)
+                return H2_FLOW_CONTROL_ERROR;
+            // the change applies to every open stream (section 6.9.2)
+            int64_t delta = (int64_t) val - c->initial_window;
+            for (struct h2_stream *st = c->streams; st; st = st->next)
+                st->send_window += delta;
+            c->initial_window = val;
+        } else if (id == H2_SETTINGS_MAX_FRAME_SIZE) {
+            if (val < H2_DEFAULT_FRAME || val > 0xffffff)
+                return H2_PROTOCOL_ERROR;
+            c->max_frame = val;
+        }
+    }
+    return H2_NO_ERROR;
+}
+
+static void header_cb(void *arg, const char *name, size_t nlen,
+                      const char *value, size_t vlen) {
+    struct h2_stream *st = arg;
+    char *dst = NULL;
+    size_t cap = 0;
+
+    if (nlen == 7 && memcmp(name, ":method", 7) == 0) {
+        dst = st->method;
+        cap = sizeof(st->method);
+    } else if (nlen == 5 && memcmp(name, ":path", 5) == 0) {
+        dst = st->uri;
+        cap = sizeof(st->uri);
+    }
+    if (dst && vlen < cap) {
+        memcpy(dst, value, vlen);
+        dst[vlen] = '\0';
+    }
+}
+
+// rank and classify the stream the same way the accept loop does
+static void stream_submit(struct h2_stream *st) {
+    char uri[MAXBUF], filename[MAXBUF], cgiargs[MAXBUF];
+    struct stat sbuf;
+    off_t size = 0;
+    int is_static = 1;
+
+    strcpy(uri, st->uri);
+    filename[0] = cgiargs[0] = '\0';
+    if (!strstr(uri, "..")) {
+        is_static = request_parse_uri(uri, filename, cgiargs);
+        if (stat(filename, &sbuf) == 0)
+            size = sbuf.st_size;
+    }
+    enqueue_stream(st, is_static, filename, cgiargs, size);
+}
+
+// a complete header block arrived on sid
+static uint32_t open_stream(struct h2_conn *c, uint32_t sid,
+                            uint8_t *block, size_t len) {
+    struct h2_stream tmp;
+
+    // decode even if we refuse the stream, to keep the table in sync
+    memset(&tmp, 0, sizeof(tmp));
+    if (hpack_decode(&c->hpack, block, len, header_cb, &tmp) < 0)
+        return H2_COMPRESSION_ERROR;
+    if (sid <= c->last_stream)
+        return H2_NO_ERROR; // trailers: we do not read request bodies
+    c->last_stream = sid;
+
+    pthread_mutex_lock(&c->lock);
+    if (c->goaway || c->nstreams >= H2_MAX_STREAMS) {
+        send_rst(c, sid, H2_REFUSED_STREAM);
+        pthread_mutex_unlock(&c->lock);
+        return H2_NO_ERROR;
+    }
+    if (tmp.method[0] == '\0' || tmp.uri[0] == '\0') {
+        send_rst(c, sid, H2_PROTOCOL_ERROR);
+        pthread_mutex_unlock(&c->lock);
+        return H2_NO_ERROR;
+    }
+    struct h2_stream *st = stream_new(c, sid);
+    if (!st) {
+        send_rst(c, sid, H2_REFUSED_STREAM);
+        pthread_mutex_unlock(&c->lock);
+        return H2_NO_ERROR;
+    }
+    strcpy(st->method, tmp.method);
+    strcpy(st->uri, tmp.uri);
+    pthread_mutex_unlock(&c->lock);
+
+    stream_submit(st);
+    return H2_NO_ERROR;
+}
+
+static void *h2_reader(void *arg) {
+    struct h2_conn *c = arg;
+    uint8_t hdr[9], payload[H2_DEFAULT_FRAME], pre[PREFACE_LEN];
+    uint8_t *hblock = NULL;
+    size_t hlen = 0;
+    uint32_t hsid = 0, err = H2_NO_ERROR;
+    int destroy;
+
+    // our SETTINGS has to be the first frame on the connection
+    uint8_t settings[6] = {0, H2_SETTINGS_MAX_CONCURRENT_STREAMS};
+    put32(settings + 2, H2_MAX_STREAMS);
+    pthread_mutex_lock(&c->lock);
+    send_frame(c, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+    pthread_mutex_unlock(&c->lock);
+
+    size_t need = PREFACE_LEN - c->preface_off;
+    if (read_full(c, pre, need) < 0 ||
+        memcmp(pre, preface + c->preface_off, need) != 0)
+        goto out;
+    if (c->upgrade) {
+        stream_submit(c->upgrade);
+        c->upgrade = NULL;
+    }
+
+    while (err == H2_NO_ERROR) {
+        if (read_full(c, hdr, sizeof(hdr)) < 0)
+            goto out;
+        uint32_t len = (hdr[0] << 16) | (hdr[1] << 8) | hdr[2];
+        int type = hdr[3], flags = hdr[4];
+        uint32_t sid = get32(hdr + 5) & 0x7fffffff;
+        if (len > H2_DEFAULT_FRAME) {
+            err = H2_FRAME_SIZE_ERROR;
+            break;
+        }
+        if (read_full(c, payload, len) < 0)
+            goto out;
+
+        // a header block may only be continued, nothing in between
+        if (hblock && type != H2_CONTINUATION) {
+            err = H2_PROTOCOL_ERROR;
+            break;
+        }
+
+        uint8_t *frag = payload;
+        size_t fraglen = len;
+        switch (type) {
+        case H2_DATA:
+            // we take no request bodies, hand the window straight back
+            if (len > 0) {
+                pthread_mutex_lock(&c->lock);
+                send_window_update(c, 0, len);
+                if (!(flags & H2_END_STREAM))
+                    send_window_update(c, sid, len);
+                pthread_mutex_unlock(&c->lock);
+            }
+            break;
+
+        case H2_HEADERS:
+            if (sid == 0 || sid % 2 == 0) {
+                err = H2_PROTOCOL_ERROR;
+                break;
+            }
+            if (flags & H2_PADDED) {
+                if (fraglen < 1 || frag[0] >= fraglen) {
+                    err = H2_PROTOCOL_ERROR;
+                    break;
+                }
+                fraglen -= 1 + frag[0];
+                frag++;
+            }
+            if (flags & H2_PRIO) {
+                if (fraglen < 5) {
+                    err = H2_PROTOCOL_ERROR;
+                    break;
+                }
+                frag += 5;
+                fraglen -= 5;
+            }
+            hsid = sid;
+            hlen = 0;
+            // fall through - the fragment is appended like a continuation
+
+        case H2_CONTINUATION:
+            if (sid != hsid || sid == 0) {
+                err = H2_PROTOCOL_ERROR;
+                break;
+            }
+            if (hlen + fraglen > H2_MAX_HEADER_BLOCK) {
+                err = H2_COMPRESSION_ERROR;
+                break;
+            }
+            hblock = realloc(hblock, hlen + fraglen + 1);
+            assert(hblock != NULL);
+            memcpy(hblock + hlen, frag, fraglen);
+            hlen += fraglen;
+            if (flags & H2_END_HEADERS) {
+                err = open_stream(c, hsid, hblock, hlen);
+                free(hblock);
+                hblock = NULL;
+                hsid = 0;
+            }
+            break;
+
+        case H2_RST_STREAM:
+            if (len != 4) {
+                err = H2_FRAME_SIZE_ERROR;
+                break;
+            }
+            pthread_mutex_lock(&c->lock);
+            struct h2_stream *rst = stream_find(c, sid);
+            if (rst && rst->sending)
+                stream_free(c, rst);
+            else if (rst)
+                rst->reset = 1; // the worker drops it when done
+            pthread_mutex_unlock(&c->lock);
+            break;
+
+        case H2_SETTINGS:
+            if (sid != 0) {
+                err = H2_PROTOCOL_ERROR;
+                break;
+            }
+            if (flags & H2_ACK)
+                break;
+            pthread_mutex_lock(&c->lock);
+            err = apply_settings(c, payload, len);
+            if (err == H2_NO_ERROR) {
+                send_frame(c, H2_SETTINGS, H2_ACK, 0, NULL, 0);
+                flush_all(c);
+            }
+            pthread_mutex_unlock(&c->lock);
+            break;
+
+        case H2_PING:
+            if (len != 8) {
+                err = H2_FRAME_SIZE_ERROR;
+                break;
+            }
+            if (!(flags & H2_ACK)) {
+                pthread_mutex_lock(&c->lock);
+                send_frame(c, H2_PING, H2_ACK, 0, payload, 8);
+                pthread_mutex_unlock(&c->lock);
+            }
+            break;
+
+        case H2_GOAWAY:
+            // finish what is in flight, the peer closes when it is done
+            c->goaway = 1;
+            break;
+
+        case H2_WINDOW_UPDATE:
+            if (len != 4) {
+                err = H2_FRAME_SIZE_ERROR;
+                break;
+            }
+            uint32_t inc = get32(payload) & 0x7fffffff;
+            if (inc == 0) {
+                err = H2_PROTOCOL_ERROR;
+                break;
+            }
+            pthread_mutex_lock(&c->lock);
+            if (sid == 0) {
+                c->send_window += inc;
+                if (c->send_window > H2_MAX_WINDOW)
+                    err = H2_FLOW_CONTROL_ERROR;
+                else
+                    flush_all(c);
+            } else {
+                struct h2_stream *st = stream_find(c, sid);
+                if (st) {
+                    st->send_window += inc;
+                    if (st->send_window > H2_MAX_WINDOW) {
+                        // a stream error: only this one is reset (section 6.9.1)
+                        send_rst(c, sid, H2_FLOW_CONTROL_ERROR);
+                        if (st->sending)
+                            stream_free(c, st);
+                        else
+                            st->reset = 1; // the worker drops it when done
+                    } else if (st->sending) {
+                        stream_flush(c, st);
+                    }
+                }
+            }
+            pthread_mutex_unlock(&c->lock);
+            break;
+
+        case H2_PUSH_PROMISE:
+            err = H2_PROTOCOL_ERROR; // clients never push
+            break;
+
+        default:
+            break; // PRIORITY and unknown frames are ignored
+        }
+    }
+
+    // connection error: say why before hanging up
+    if (err != H2_NO_ERROR) {
+        uint8_t p[8];
+        put32(p, c->last_stream);
+        put32(p + 4, err);
+        pthread_mutex_lock(&c->lock);
+        send_frame(c, H2_GOAWAY, 0, 0, p, sizeof(p));
+        pthread_mutex_unlock(&c->lock);
+    }
+
+out:
+    free(hblock);
+    pthread_mutex_lock(&c->lock);
+    c->closed = 1;
+    if (c->upgrade)
+        stream_free(c, c->upgrade);
+    // streams waiting on the window are ours; workers drop the others
+    struct h2_stream *st, *next;
+    for (st = c->streams; st; st = next) {
+        next = st->next;
+        if (st->sending)
+            stream_free(c, st);
+    }
+    destroy = --c->refs == 0;
+    pthread_mutex_unlock(&c->lock);
+    if (destroy)
+        conn_destroy(c);
+    return NULL;
+}
+
+static void conn_start(struct h2_conn *c) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, h2_reader, c) != 0) {
+        if (c->upgrade)
+            stream_free(c, c->upgrade);
+        conn_destroy(c);
+        return;
+    }
+    pthread_detach(tid);
+}
+
+void h2_accept(int fd, const char *pending, size_t npending) {
+    struct h2_conn *c = conn_new(fd, pending, npending);
+    if (!c)
+        return;
+    c->preface_off = PREFACE_LINE;
+    conn_start(c);
+}
+
+// HTTP2-Settings is base64url without padding (RFC 7540 section 3.2.1)
+static size_t b64url_decode(const char *in, uint8_t *out, size_t cap) {
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t n = 0;
+
+    for (; *in && *in != '='; in++) {
+        int v;
+        if (*in >= 'A' && *in <= 'Z')
+            v = *in - 'A';
+        else if (*in >= 'a' && *in <= 'z')
+            v = *in - 'a' + 26;
+        else if (*in >= '0' && *in <= '9')
+            v = *in - '0' + 52;
+        else if (*in == '-' || *in == '+')
+            v = 62;
+        else if (*in == '_' || *in == '/')
+            v = 63;
+        else
+            break;
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (n < cap)
+                out[n++] = acc >> bits;
+        }
+    }
+    return n;
+}
+
+void h2_upgrade(int fd, char *uri, char *settings,
+                const char *pending, size_t npending) {
+    char buf[MAXBUF];
+    uint8_t sp[MAXBUF];
+
+    struct h2_conn *c = conn_new(fd, pending, npending);
+    if (!c)
+        return;
+    sprintf(buf, ""
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Connection: Upgrade\r\n"
+      "Upgrade: h2c\r\n\r\n");
+    write_or_die(fd, buf, strlen(buf));
+
+    // the 101 acknowledges the client's settings, no SETTINGS ACK
+    size_t splen = b64url_decode(settings, sp, sizeof(sp));
+    pthread_mutex_lock(&c->lock);
+    apply_settings(c, sp, splen - splen % 6);
+    c->upgrade = stream_new(c, 1);
+    pthread_mutex_unlock(&c->lock);
+    if (c->upgrade) {
+        strcpy(c->upgrade->method, "GET");
+        snprintf(c->upgrade->uri, MAXBUF, "%s", uri);
+    }
+    c->last_stream = 1;
+    conn_start(c);
+}
@@ -0,0 +1,35 @@
+#ifndef __H2_H__
+#define __H2_H__
+
+#include <sys/types.h>
+
+//
+// Cleartext HTTP/2 (h2c, RFC 7540)
+//
+// A connection that starts with the HTTP/2 preface, or that upgrades from
+// HTTP/1.1 with "Upgrade: h2c", is handed to its own reader thread. The
+// reader decodes frames and puts every request stream on the server queue
+// as a separate job, so FIFO/SFF pick streams rather than connections.
+// Workers build the response and send as much of it as flow control
+// allows; the reader sends the rest as WINDOW_UPDATEs arrive.
+//
+
+struct h2_stream;
+
+// take over fd after "PRI * HTTP/2.0" was read as the request line;
+// pending holds whatever was read from fd after that line
+void h2_accept(int fd, const char *pending, size_t npending);
+
+// answer an "Upgrade: h2c" request and serve it as stream 1;
+// settings is the HTTP2-Settings header value, pending as above
+void h2_upgrade(int fd, char *uri, char *settings,
+                const char *pending, size_t npending);
+
+// build and send the response for one stream (worker thread)
+void h2_stream_handle(struct h2_stream *st);
+
+// provided by wserver.c: queue one stream on the static or dynamic pool
+void enqueue_stream(struct h2_stream *st, int is_static,
+                    char *filename, char *cgiargs, off_t size);
+
+#endif // __H2_H__
@@ -0,0 +1,74 @@
+#include <string.h>
+#include "hist.h"
+
+void hist_init(struct hist *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static int bucket(uint64_t v) {
+    if (v < 2 * HIST_SUB)
+        return v;
+    int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS; // >= 1
+    return 2 * HIST_SUB + (shift - 1) * HIST_SUB +
+           (int) ((v >> shift) - HIST_SUB);
+}
+
+// largest value that falls in bucket i
+static uint64_t bucket_high(int i) {
+    if (i < 2 * HIST_SUB)
+        return i;
+    int shift = (i - 2 * HIST_SUB) / HIST_SUB + 1;
+    uint64_t mant = HIST_SUB + (i - 2 * HIST_SUB) % HIST_SUB;
+    return ((mant + 1) << shift) - 1;
+}
+
+void hist_record(struct hist *h, uint64_t v) {
+    h->counts[bucket(v)]++;
+    h->n++;
+    h->sum += v;
+    if (v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+}
+
+void hist_record_corrected(struct hist *h, uint64_t v, uint64_t interval) {
+    hist_record(h, v);
+    if (interval == 0 || v < 2 * interval)
+        return;
+    for (uint64_t missed = v - interval; missed >= interval; missed -= interval)
+        hist_record(h, missed);
+}
+
+void hist_merge(struct hist *into, const struct hist *from) {
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        into->counts[i] += from->counts[i];
+    into->n += from->n;
+    into->sum += from->sum;
+    if (from->min < into->min)
+        into->min = from->min;
+    if (from->max > into->max)
+        into->max = from->max;
+}
+
+uint64_t hist_percentile(const struct hist *h, double p) {
+    if (h->n == 0)
+        return 0;
+    uint64_t rank = (uint64_t) (p / 100.0 * h->n + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t v = bucket_high(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+double hist_mean(const struct hist *h) {
+    return h->n ? h->sum / h->n : 0;
+}
@@ -0,0 +1,38 @@
+#ifndef __HIST_H__
+#define __HIST_H__
+
+#include <stdint.h>
+
+//
+// Log-linear latency histogram (in the style of HdrHistogram)
+//
+// Values below 2 * HIST_SUB are exact; above that every power of two is
+// split into HIST_SUB linear buckets, so a percentile is within about
+// 1.5% of the true value. Histograms of the same shape can be merged,
+// which is how per-thread histograms are combined.
+//
+
+#define HIST_SUB_BITS 6
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (2 * HIST_SUB + (64 - HIST_SUB_BITS - 1) * HIST_SUB)
+
+struct hist {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t n, min, max;
+    double sum;
+};
+
+void hist_init(struct hist *h);
+void hist_record(struct hist *h, uint64_t v);
+
+// record v, plus the samples a closed loop missed while v was
+// outstanding: v - interval, v - 2 * interval, ... down to interval
+void hist_record_corrected(struct hist *h, uint64_t v, uint64_t interval);
+
+void hist_merge(struct hist *into, const struct hist *from);
+
+// value at percentile p (0..100); 0 if empty
+uint64_t hist_percentile(const struct hist *h, double p);
+double hist_mean(const struct hist *h);
+
+#endif // __HIST_H__
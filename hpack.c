@@ -0,0 +1,403 @@
+#include <pthread.h>
+#include "io_helper.h"
+#include "hpack.h"
+
+#define MAXSTR (8192) // longest header name or value we decode
+
+//
+// Static table (RFC 7541 Appendix A), index 1 is the first entry
+//
+static const struct { const char *name, *value; } static_table[] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"},
+    {":path", "/"}, {":path", "/index.html"}, {":scheme", "http"},
+    {":scheme", "https"}, {":status", "200"}, {":status", "204"},
+    {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"}, {"accept-language", ""},
+    {"accept-ranges", ""}, {"accept", ""},
+    {"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""},
+    {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""},
+    {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""},
+    {"content-type", ""}, {"cookie", ""}, {"date", ""}, {"etag", ""},
+    {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""},
+    {"if-match", ""}, {"if-modified-since", ""}, {"if-none-match", ""},
+    {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""}, {"max-forwards", ""},
+    {"proxy-authenticate", ""}, {"proxy-authorization", ""},
+    {"range", ""}, {"referer", ""}, {"refresh", ""}, {"retry-after", ""},
+    {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""},
+    {"via", ""}, {"www-authenticate", ""},
+};
+#define STATIC_COUNT ((int) (sizeof(static_table) / sizeof(static_table[0])))
+
+//
+// Huffman code (RFC 7541 Appendix B): code and bit length per symbol,
+// symbol 256 is EOS
+//
+static const struct { uint32_t code; uint8_t bits; } huff_codes[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+// decoding tree: a child >= 0 is another node, < 0 is -(symbol + 1)
+static int16_t huff_tree[256][2];
+static pthread_once_t huff_once = PTHREAD_ONCE_INIT;
+
+static void huff_build(void) {
+    int nodes = 1;
+    for (int sym = 0; sym < 257; sym++) {
+        uint32_t code = huff_codes[sym].code;
+        int n = 0;
+        for (int i = huff_codes[sym].bits - 1; i > 0; i--) {
+            int bit = (code >> i) & 1;
+            if (huff_tree[n][bit] == 0)
+                huff_tree[n][bit] = nodes++;
+            n = huff_tree[n][bit];
+        }
+        huff_tree[n][code & 1] = -(sym + 1);
+    }
+}
+
+static int huff_decode(const uint8_t *in, size_t len,
+                       char *out, size_t cap, size_t *outlen) {
+    int n = 0, depth = 0, ones = 1;
+    size_t o = 0;
+
+    pthread_once(&huff_once, huff_build);
+    for (size_t i = 0; i < len; i++) {
+        for (int b = 7; b >= 0; b--) {
+            int bit = (in[i] >> b) & 1;
+            int next = huff_tree[n][bit];
+            depth++;
+            ones &= bit;
+            if (next < 0) {
+                if (next == -257 || o >= cap)
+                    return -1; // EOS inside a string is an error
+                out[o++] = (char) (-next - 1);
+                n = depth = 0;
+                ones = 1;
+            } else {
+                n = next;
+            }
+        }
+    }
+    // leftover bits must be a prefix of EOS: fewer than 8, all ones
+    if (depth > 7 || !ones)
+        return -1;
+    *outlen = o;
+    return 0;
+}
+
+//
+// Integer and string primitives (RFC 7541 section 5)
+//
+static int decode_int(const uint8_t **p, const uint8_t *end, int prefix,
+                      uint32_t *out) {
+    uint32_t mask = (1u << prefix) - 1;
+    uint64_t v;
+    int shift = 0;
+
+    if (*p >= end)
+        return -1;
+    v = *(*p)++ & mask;
+    if (v < mask) {
+        *out = v;
+        return 0;
+    }
+    while (*p < end) {
+        uint8_t b = *(*p)++;
+        v += (uint64_t) (b & 0x7f) << shift;
+        shift += 7;
+        if (v > 0x7fffffff)
+            return -1;
+        if (!(b & 0x80)) {
+            *out = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int decode_str(const uint8_t **p, const uint8_t *end,
+                      char *out, size_t cap, size_t *outlen) {
+    uint32_t len;
+    int huff;
+
+    if (*p >= end)
+        return -1;
+    huff = **p & 0x80;
+    if (decode_int(p, end, 7, &len) < 0 || len > (size_t) (end - *p))
+        return -1;
+    if (huff) {
+        if (huff_decode(*p, len, out, cap, outlen) < 0)
+            return -1;
+    } else {
+        if (len > cap)
+            return -1;
+        memcpy(out, *p, len);
+        *outlen = len;
+    }
+    *p += len;
+    return 0;
+}
+
+static size_t encode_int(uint8_t *out, size_t cap, uint8_t first,
+                         int prefix, uint32_t v) {
+    uint32_t mask = (1u << prefix) - 1;
+    size_t n = 0;
+
+    if (cap == 0)
+        return 0;
+    if (v < mask) {
+        out[n++] = first | v;
+        return n;
+    }
+    out[n++] = first | mask;
+    v -= mask;
+    while (v >= 0x80) {
+        if (n >= cap)
+            return 0;
+        out[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    if (n >= cap)
+        return 0;
+    out[n++] = v;
+    return n;
+}
+
+static size_t encode_str(uint8_t *out, size_t cap, const char *s) {
+    size_t len = strlen(s);
+    size_t n = encode_int(out, cap, 0x00, 7, len); // raw, no huffman
+    if (n == 0 || n + len > cap)
+        return 0;
+    memcpy(out + n, s, len);
+    return n + len;
+}
+
+//
+// Dynamic table (RFC 7541 section 4)
+//
+void hpack_table_init(struct hpack_table *t, size_t limit) {
+    t->cap = limit / 32 + 1; // every entry costs at least 32 bytes
+    t->ents = calloc(t->cap, sizeof *t->ents);
+    assert(t->ents != NULL);
+    t->head = t->count = 0;
+    t->size = 0;
+    t->max_size = t->limit = limit;
+}
+
+static void table_evict(struct hpack_table *t) {
+    struct hpack_entry *e = &t->ents[(t->head + t->count - 1) % t->cap];
+    t->size -= e->nlen + e->vlen + 32;
+    free(e->name);
+    free(e->value);
+    t->count--;
+}
+
+void hpack_table_free(struct hpack_table *t) {
+    while (t->count > 0)
+        table_evict(t);
+    free(t->ents);
+    t->ents = NULL;
+}
+
+static void table_add(struct hpack_table *t, const char *name, size_t nlen,
+                      const char *value, size_t vlen) {
+    size_t size = nlen + vlen + 32;
+
+    while (t->count > 0 && t->size + size > t->max_size)
+        table_evict(t);
+    if (size > t->max_size)
+        return; // too big for the table: it just ends up empty
+
+    struct hpack_entry e;
+    e.name = malloc(nlen + 1);
+    e.value = malloc(vlen + 1);
+    assert(e.name != NULL && e.value != NULL);
+    memcpy(e.name, name, nlen);
+    memcpy(e.value, value, vlen);
+    e.name[nlen] = e.value[vlen] = '\0';
+    e.nlen = nlen;
+    e.vlen = vlen;
+
+    t->head = (t->head - 1 + t->cap) % t->cap;
+    t->ents[t->head] = e;
+    t->count++;
+    t->size += size;
+}
+
+// look up a static or dynamic index
+static int table_get(struct hpack_table *t, uint32_t idx,
+                     const char **name, size_t *nlen,
+                     const char **value, size_t *vlen) {
+    if (idx == 0)
+        return -1;
+    if (idx <= STATIC_COUNT) {
+        *name = static_table[idx - 1].name;
+        *value = static_table[idx - 1].value;
+        *nlen = strlen(*name);
+        *vlen = strlen(*value);
+        return 0;
+    }
+    idx -= STATIC_COUNT + 1;
+    if (idx >= (uint32_t) t->count)
+        return -1;
+    struct hpack_entry *e = &t->ents[(t->head + idx) % t->cap];
+    *name = e->name;
+    *nlen = e->nlen;
+    *value = e->value;
+    *vlen = e->vlen;
+    return 0;
+}
+
+int hpack_decode(struct hpack_table *t, const uint8_t *buf, size_t len,
+                 hpack_header_cb cb, void *arg) {
+    const uint8_t *p = buf, *end = buf + len;
+    char namebuf[MAXSTR], valbuf[MAXSTR];
+
+    while (p < end) {
+        const char *name, *value;
+        size_t nlen, vlen;
+        uint32_t idx;
+        uint8_t b = *p;
+
+        if (b & 0x80) {
+            // indexed header field
+            if (decode_int(&p, end, 7, &idx) < 0 ||
+                table_get(t, idx, &name, &nlen, &value, &vlen) < 0)
+                return -1;
+            cb(arg, name, nlen, value, vlen);
+        } else if ((b & 0xe0) == 0x20) {
+            // dynamic table size update
+            if (decode_int(&p, end, 5, &idx) < 0 || idx > t->limit)
+                return -1;
+            t->max_size = idx;
+            while (t->count > 0 && t->size > t->max_size)
+                table_evict(t);
+        } else {
+            // literal: with incremental indexing (6-bit index),
+            // or without / never indexed (4-bit index)
+            int indexing = (b & 0xc0) == 0x40;
+            if (decode_int(&p, end, indexing ? 6 : 4, &idx) < 0)
+                return -1;
+            if (idx) {
+                const char *n, *v;
+                size_t vl;
+                if (table_get(t, idx, &n, &nlen, &v, &vl) < 0)
+                    return -1;
+                memcpy(namebuf, n, nlen); // entry may be evicted by table_add
+            } else if (decode_str(&p, end, namebuf, MAXSTR, &nlen) < 0) {
+                return -1;
+            }
+            if (decode_str(&p, end, valbuf, MAXSTR, &vlen) < 0)
+                return -1;
+            if (indexing)
+                table_add(t, namebuf, nlen, valbuf, vlen);
+            cb(arg, namebuf, nlen, valbuf, vlen);
+        }
+    }
+    return 0;
+}
+
+size_t hpack_encode_status(uint8_t *out, size_t cap, int status) {
+    char val[16];
+
+    for (int i = 0; i < STATIC_COUNT; i++) {
+        if (strcmp(static_table[i].name, ":status") == 0 &&
+            atoi(static_table[i].value) == status)
+            return encode_int(out, cap, 0x80, 7, i + 1);
+    }
+    sprintf(val, "%03d", status);
+    size_t n = encode_int(out, cap, 0x00, 4, 8); // name from index 8
+    size_t m = n ? encode_str(out + n, cap - n, val) : 0;
+    return m ? n + m : 0;
+}
+
+size_t hpack_encode_header(uint8_t *out, size_t cap,
+                           const char *name, const char *value) {
+    size_t n = 0, m;
+
+    // literal without indexing, reusing a static name when there is one
+    for (int i = 0; i < STATIC_COUNT && n == 0; i++) {
+        if (strcmp(static_table[i].name, name) == 0)
+            n = encode_int(out, cap, 0x00, 4, i + 1);
+    }
+    if (n == 0) {
+        if (cap < 1)
+            return 0;
+        out[n++] = 0x00;
+        m = encode_str(out + n, cap - n, name);
+        if (m == 0)
+            return 0;
+        n += m;
+    }
+    m = encode_str(out + n, cap - n, value);
+    return m ? n + m : 0;
+}
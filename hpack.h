@@ -0,0 +1,50 @@
+#ifndef __HPACK_H__
+#define __HPACK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// HPACK header compression for HTTP/2 (RFC 7541)
+//
+// The decoder keeps the full dynamic table since the peer decides what
+// goes in it. The encoder never adds entries: responses are sent as
+// static-table references and plain literals, so the peer's table for
+// our side of the connection stays empty.
+//
+
+#define HPACK_TABLE_SIZE 4096 // SETTINGS_HEADER_TABLE_SIZE we accept
+
+struct hpack_entry {
+    char *name, *value;
+    size_t nlen, vlen;
+};
+
+// decoder state: the dynamic table, newest entry first
+struct hpack_table {
+    struct hpack_entry *ents; // ring buffer
+    int head, count, cap;
+    size_t size;              // sum of entry sizes (len + 32 each)
+    size_t max_size;          // current limit set by size updates
+    size_t limit;             // upper bound we advertised
+};
+
+// called once per decoded header field
+typedef void (*hpack_header_cb)(void *arg,
+                                const char *name, size_t nlen,
+                                const char *value, size_t vlen);
+
+void hpack_table_init(struct hpack_table *t, size_t limit);
+void hpack_table_free(struct hpack_table *t);
+
+// decode one complete header block; returns 0, or -1 on a compression error
+int hpack_decode(struct hpack_table *t, const uint8_t *buf, size_t len,
+                 hpack_header_cb cb, void *arg);
+
+// encoders append to out (at most cap bytes) and return the bytes written,
+// or 0 if the field does not fit
+size_t hpack_encode_status(uint8_t *out, size_t cap, int status);
+size_t hpack_encode_header(uint8_t *out, size_t cap,
+                           const char *name, const char *value);
+
+#endif // __HPACK_H__
@@ -0,0 +1,186 @@
+#define _GNU_SOURCE // memmem()
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+#include "http_parse.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+//
+// Line end search
+//
+static const char *find_nl_scalar(const char *p, const char *end) {
+    for (; p < end; p++) {
+        if (*p == '\n')
+            return p;
+    }
+    return NULL;
+}
+
+#ifdef HAVE_X86
+__attribute__((target("sse2")))
+static const char *find_nl_sse2(const char *p, const char *end) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return find_nl_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *find_nl_avx2(const char *p, const char *end) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return find_nl_sse2(p, end);
+}
+#endif
+
+static const char *(*find_nl)(const char *, const char *) = find_nl_scalar;
+static pthread_once_t find_nl_once = PTHREAD_ONCE_INIT;
+
+static void find_nl_init(void) {
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        find_nl = find_nl_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        find_nl = find_nl_sse2;
+#endif
+}
+
+//
+// Slices
+//
+int http_slice_eq(struct http_slice s, const char *lit) {
+    return strlen(lit) == s.len && memcmp(s.p, lit, s.len) == 0;
+}
+
+int http_slice_ieq(struct http_slice s, const char *lit) {
+    return strlen(lit) == s.len && strncasecmp(s.p, lit, s.len) == 0;
+}
+
+int http_slice_contains(struct http_slice s, const char *needle) {
+    return memmem(s.p, s.len, needle, strlen(needle)) != NULL;
+}
+
+int http_slice_copy(struct http_slice s, char *out, size_t cap) {
+    if (s.len >= cap)
+        return 0;
+    memcpy(out, s.p, s.len);
+    out[s.len] = '\0';
+    return 1;
+}
+
+const struct http_slice *http_header(const struct http_request *r,
+                                     const char *name) {
+    for (int i = 0; i < r->nheaders; i++) {
+        if (http_slice_ieq(r->headers[i].name, name))
+            return &r->headers[i].value;
+    }
+    return NULL;
+}
+
+//
+// Parser
+//
+// the header array is filled as lines arrive, so it is left alone
+void http_parse_init(struct http_request *r) {
+    r->method.len = r->uri.len = r->version.len = 0;
+    r->nheaders = 0;
+    r->state = HTTP_STATE_LINE;
+    r->line_len = r->off = r->scan = 0;
+}
+
+// next space-separated token of [*p, end); empty if there is none
+static struct http_slice token(const char **p, const char *end) {
+    struct http_slice s;
+    while (*p < end && **p == ' ')
+        (*p)++;
+    s.p = *p;
+    const char *sp = memchr(*p, ' ', end - *p);
+    *p = sp ? sp : end;
+    s.len = *p - s.p;
+    return s;
+}
+
+// "METHOD URI VERSION"
+static int parse_request_line(struct http_request *r, const char *p,
+                              const char *end) {
+    r->method = token(&p, end);
+    r->uri = token(&p, end);
+    r->version = token(&p, end);
+    if (!r->method.len || !r->uri.len || !r->version.len)
+        return HTTP_PARSE_ERROR;
+    while (p < end && *p == ' ')
+        p++;
+    return p == end ? HTTP_PARSE_PARTIAL : HTTP_PARSE_ERROR;
+}
+
+// "Name: value", with optional whitespace around the value
+static int parse_header(struct http_request *r, const char *p,
+                        const char *end) {
+    const char *colon = memchr(p, ':', end - p);
+    if (!colon || colon == p)
+        return HTTP_PARSE_ERROR;
+    if (r->nheaders == HTTP_MAX_HEADERS)
+        return HTTP_PARSE_PARTIAL;
+
+    struct http_header *h = &r->headers[r->nheaders++];
+    h->name.p = p;
+    h->name.len = colon - p;
+    p = colon + 1;
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    h->value.p = p;
+    h->value.len = end - p;
+    return HTTP_PARSE_PARTIAL;
+}
+
+int http_parse(struct http_request *r, const char *buf, size_t len) {
+    pthread_once(&find_nl_once, find_nl_init);
+
+    while (r->state != HTTP_STATE_DONE) {
+        const char *line = buf + r->off;
+        const char *nl = find_nl(buf + r->scan, buf + len);
+        if (!nl) {
+            r->scan = len;
+            return HTTP_PARSE_PARTIAL;
+        }
+        const char *end = nl;
+        if (end > line && end[-1] == '\r')
+            end--;
+        r->off = r->scan = nl + 1 - buf;
+
+        int rc;
+        if (r->state == HTTP_STATE_LINE) {
+            if (end == line) // tolerate blank lines before the request
+                continue;
+            rc = parse_request_line(r, line, end);
+            r->line_len = r->off;
+            r->state = HTTP_STATE_HEADERS;
+        } else if (end == line) {
+            r->state = HTTP_STATE_DONE;
+            rc = HTTP_PARSE_PARTIAL;
+        } else if (*line == ' ' || *line == '\t') {
+            rc = HTTP_PARSE_PARTIAL; // obsolete line folding, ignored
+        } else {
+            rc = parse_header(r, line, end);
+        }
+        if (rc == HTTP_PARSE_ERROR)
+            return rc;
+    }
+    return HTTP_PARSE_DONE;
+}
@@ -0,0 +1,60 @@
+#ifndef __HTTP_PARSE_H__
+#define __HTTP_PARSE_H__
+
+#include <stddef.h>
+
+//
+// Incremental HTTP/1.x request parser
+//
+// Nothing is copied: the request line and headers come back as slices
+// into the caller's buffer. Call http_parse() again with the same buffer
+// after appending more input; it resumes where it stopped instead of
+// rescanning. Line ends are found with SSE2/AVX2 when the CPU has them.
+//
+
+#define HTTP_MAX_HEADERS 32 // headers past this are checked but not kept
+
+struct http_slice {
+    const char *p;
+    size_t len;
+};
+
+struct http_header {
+    struct http_slice name, value;
+};
+
+struct http_request {
+    struct http_slice method, uri, version;
+    struct http_header headers[HTTP_MAX_HEADERS];
+    int nheaders;
+    int state;        // HTTP_STATE_*
+    size_t line_len;  // bytes of the request line, with its line end
+    size_t off;       // bytes consumed, i.e. the body starts here once done
+    size_t scan;      // where the search for the next line end resumes
+};
+
+#define HTTP_STATE_LINE 0    // waiting for the request line
+#define HTTP_STATE_HEADERS 1 // request line parsed
+#define HTTP_STATE_DONE 2    // empty line seen
+
+#define HTTP_PARSE_ERROR -1
+#define HTTP_PARSE_PARTIAL 0 // need more input
+#define HTTP_PARSE_DONE 1
+
+void http_parse_init(struct http_request *r);
+
+// parse buf[0, len); returns HTTP_PARSE_*
+int http_parse(struct http_request *r, const char *buf, size_t len);
+
+// first header called name (any case), or NULL
+const struct http_slice *http_header(const struct http_request *r,
+                                     const char *name);
+
+int http_slice_eq(struct http_slice s, const char *lit);
+int http_slice_ieq(struct http_slice s, const char *lit); // ignoring case
+int http_slice_contains(struct http_slice s, const char *needle);
+
+// copy into a C string of at most cap bytes; 0 if it did not fit
+int http_slice_copy(struct http_slice s, char *out, size_t cap);
+
+#endif // __HTTP_PARSE_H__
@@ -80,4 +80,76 @@ int open_listen_fd(int port) {
     return listen_fd;
 }
 
+//
+// Unix domain socket variants, for clients running on the same host
+//
+int open_client_fd_unix(char *path) {
+    int client_fd;
+    struct sockaddr_un server_addr;
+
+    if (strlen(path) >= sizeof(server_addr.sun_path))
+        return -1;
+    if ((client_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    bzero((char *) &server_addr, sizeof(server_addr));
+    server_addr.sun_family = AF_UNIX;
+    strcpy(server_addr.sun_path, path);
+
+    if (connect(client_fd, (sockaddr_t *) &server_addr, sizeof(server_addr)) < 0) {
+        close(client_fd);
+        return -1;
+    }
+    return client_fd;
+}
+
+int open_listen_fd_unix(char *path, mode_t mode) {
+    int listen_fd;
+    struct sockaddr_un server_addr;
+    struct stat st;
+
+    if (strlen(path) >= sizeof(server_addr.sun_path)) {
+      fprintf(stderr, "socket path too long\n");
+      return -1;
+    }
+
+    // a stale socket file from an earlier run would make bind fail, but
+    // anything else at the path is left alone
+    if (lstat(path, &st) == 0) {
+      if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "%s exists and is not a socket\n", path);
+        return -1;
+      }
+      unlink(path);
+    }
 
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+      fprintf(stderr, "socket() failed\n");
+      return -1;
+    }
+
+    bzero((char *) &server_addr, sizeof(server_addr));
+    server_addr.sun_family = AF_UNIX;
+    strcpy(server_addr.sun_path, path);
+    if (bind(listen_fd, (sockaddr_t *) &server_addr, sizeof(server_addr)) < 0) {
+      fprintf(stderr, "bind() failed\n");
+      close(listen_fd);
+      return -1;
+    }
+
+    // connecting needs write permission on the socket file
+    if (chmod(path, mode) < 0) {
+      fprintf(stderr, "chmod() failed\n");
+      close(listen_fd);
+      unlink(path);
+      return -1;
+    }
+
+    if (listen(listen_fd, 1024) < 0) {
+      fprintf(stderr, "listen() failed\n");
+      close(listen_fd);
+      unlink(path);
+      return -1;
+    }
+    return listen_fd;
+}
@@ -19,6 +19,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -83,6 +84,8 @@ typedef struct sockaddr sockaddr_t;
 ssize_t readline(int fd, void *buf, size_t maxlen);
 int open_client_fd(char *hostname, int portno);
 int open_listen_fd(int portno);
+int open_client_fd_unix(char *path);
+int open_listen_fd_unix(char *path, mode_t mode);
 
 // wrappers for above
 #define readline_or_die(fd, buf, maxlen) \
@@ -91,5 +94,9 @@ int open_listen_fd(int portno);
     ({ int rc = open_client_fd(hostname, port); assert(rc >= 0); rc; })
 #define open_listen_fd_or_die(port) \
     ({ int rc = open_listen_fd(port); assert(rc >= 0); rc; })
+#define open_client_fd_unix_or_die(path) \
+    ({ int rc = open_client_fd_unix(path); assert(rc >= 0); rc; })
+#define open_listen_fd_unix_or_die(path, mode) \
+    ({ int rc = open_listen_fd_unix(path, mode); assert(rc >= 0); rc; })
 
 #endif // __IO_HELPER__
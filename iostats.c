@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include "iostats.h"
+
+#define IOSTATS_MAX_FILES (4 * BLOCKIO_MAX_FILES) // over all runs
+#define IOSTATS_BUF (IOSTATS_MAX_FILES * 256)
+
+/*
+File layout, all text:
+  iostats 2\n
+  statements <n>\n
+  <file> <opens> <reads> <writes> <bytes read> <bytes written> <ns> <hits>\n
+  ...
+A file in an older layout, without the first line, counts as empty
+*/
+static int load(int fd, long *statements, struct blockio_file_stats *rows)
+{
+    char buf[IOSTATS_BUF];
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+    int n = 0;
+
+    *statements = 0;
+    if (len <= 0)
+        return 0;
+    buf[len] = '\0';
+
+    char *save, *line = strtok_r(buf, "\n", &save);
+    if (!line || strcmp(line, "iostats 2") != 0)
+        return 0;
+    line = strtok_r(NULL, "\n", &save);
+    if (!line || sscanf(line, "statements %ld", statements) != 1)
+        return 0;
+    while ((line = strtok_r(NULL, "\n", &save)) && n < IOSTATS_MAX_FILES)
+    {
+        struct blockio_file_stats *r = &rows[n];
+        unsigned long long ns;
+        if (sscanf(line, "%135s %lu %lu %lu %lu %lu %llu %lu", r->file,
+                   &r->st.opens, &r->st.reads, &r->st.writes,
+                   &r->st.bytes_read, &r->st.bytes_written, &ns, &r->st.hits) == 8)
+        {
+            r->st.ns = ns;
+            n++;
+        }
+    }
+    return n;
+}
+
+static void store(int fd, long statements, struct blockio_file_stats *rows, int n)
+{
+    char buf[IOSTATS_BUF];
+    int len = snprintf(buf, sizeof(buf), "iostats 2\nstatements %ld\n", statements);
+
+    for (int i = 0; i < n && len < (int)sizeof(buf); i++)
+    {
+        struct blockio_stats *s = &rows[i].st;
+        len += snprintf(buf + len, sizeof(buf) - len, "%s %lu %lu %lu %lu %lu %llu %lu\n",
+                        rows[i].file, s->opens, s->reads, s->writes,
+                        s->bytes_read, s->bytes_written, (unsigned long long)s->ns,
+                        s->hits);
+    }
+    if (len >= (int)sizeof(buf))
+        return; // cannot happen with IOSTATS_MAX_FILES lines
+    if (pwrite(fd, buf, len, 0) == len)
+        ftruncate(fd, len);
+}
+
+void iostats_save(void)
+{
+    struct blockio_file_stats rows[IOSTATS_MAX_FILES];
+    long statements;
+
+    if (blockio_stats.opens == 0)
+        return;
+    int fd = open(IOSTATS_FILE, O_RDWR | O_CREAT, 0666);
+    if (fd < 0)
+        return;
+    flock(fd, LOCK_EX);
+    int n = load(fd, &statements, rows);
+    for (int i = 0; i < blockio_nfiles; i++)
+    {
+        int j = 0;
+        while (j < n && strcmp(rows[j].file, blockio_files[i].file) != 0)
+            j++;
+        if (j == n)
+        {
+            if (n == IOSTATS_MAX_FILES)
+                continue;
+            memset(&rows[n], 0, sizeof(rows[n]));
+            strcpy(rows[n++].file, blockio_files[i].file);
+        }
+        blockio_stats_add(&rows[j].st, &blockio_files[i].st);
+    }
+    store(fd, statements + 1, rows, n);
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+static void print_row(const char *name, const struct blockio_stats *s)
+{
+    printf("%-24s %10lu %10lu %10lu %10lu %12lu %13lu %10.3f\n", name, s->opens,
+           s->reads, s->writes, s->hits, s->bytes_read, s->bytes_written, s->ns / 1e6);
+}
+
+void iostats_print_stats(void)
+{
+    struct blockio_file_stats rows[IOSTATS_MAX_FILES];
+    struct blockio_stats total = {0};
+    long statements = 0;
+    int n = 0;
+
+    int fd = open(IOSTATS_FILE, O_RDONLY);
+    if (fd >= 0)
+    {
+        flock(fd, LOCK_SH);
+        n = load(fd, &statements, rows);
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+    for (int i = 0; i < n; i++)
+        blockio_stats_add(&total, &rows[i].st);
+
+    printf("<h2>Block I/O</h2>\n");
+    printf("<pre>\n");
+    printf("statements: %ld\n", statements);
+    if (statements > 0)
+        printf("per statement: %.1f opens, %.1f reads, %.1f writes, %.1f pool hits, %.3f ms\n",
+               (double)total.opens / statements, (double)total.reads / statements,
+               (double)total.writes / statements, (double)total.hits / statements,
+               total.ns / 1e6 / statements);
+    printf("%-24s %10s %10s %10s %10s %12s %13s %10s\n", "file", "opens", "reads",
+           "writes", "hits", "bytes read", "bytes written", "ms");
+    print_row("total", &total);
+    for (int i = 0; i < n; i++)
+        print_row(rows[i].file, &rows[i].st);
+    printf("</pre>\n");
+}
+
+void iostats_reset(void)
+{
+    unlink(IOSTATS_FILE);
+    printf("<p>Block I/O stats reset</p>\n");
+}
+
+void iostats_footer(const struct blockio_stats *before)
+{
+    struct blockio_stats d = blockio_stats;
+
+    d.opens -= before->opens;
+    d.reads -= before->reads;
+    d.writes -= before->writes;
+    d.bytes_read -= before->bytes_read;
+    d.bytes_written -= before->bytes_written;
+    d.ns -= before->ns;
+    d.hits -= before->hits;
+    printf("<p class=\"io\">I/O: %lu opens, %lu reads (%lu bytes), "
+           "%lu writes (%lu bytes), %lu pool hits, %.3f ms</p>\n",
+           d.opens, d.reads, d.bytes_read, d.writes, d.bytes_written, d.hits, d.ns / 1e6);
+}
@@ -0,0 +1,23 @@
+#ifndef IOSTATS_H
+#define IOSTATS_H
+
+#include "blockio.h"
+
+// blockio counters summed over every sql.cgi run, one line per file
+#define IOSTATS_FILE "iostats.db"
+
+// add this process's counters to IOSTATS_FILE; nothing is saved if the
+// statement did no block I/O
+void iostats_save(void);
+
+// STATS: the saved totals, overall and per file
+void iostats_print_stats(void);
+
+// STATS RESET
+void iostats_reset(void);
+
+// one-line summary of the I/O since before, after a statement's output
+// (sql.cgi prints it when SQL_IO_FOOTER is set)
+void iostats_footer(const struct blockio_stats *before);
+
+#endif // IOSTATS_H
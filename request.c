@@ -1,5 +1,12 @@
+#define _GNU_SOURCE // pipe2()
+#include <sys/uio.h>
 #include "io_helper.h"
 #include "request.h"
+#include "h2.h"
+#include "coalesce.h"
+#include "http_parse.h"
+#include "trace.h"
+#include "accesslog.h"
 
 //
 // Some of this code stolen from Bryant/O'Halloran
@@ -11,6 +18,8 @@
 void request_error(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg) {
     char buf[MAXBUF], body[MAXBUF];
     
+    access_log_status(atoi(errnum));
+    
     // Create the body of error message first (have to know its length for header)
     sprintf(body, ""
       "<!doctype html>\r\n"
@@ -37,46 +46,35 @@ void request_error(int fd, char *cause, char *errnum, char *shortmsg, char *long
     write_or_die(fd, body, strlen(body));
 }
 
-//
-// Reads and discards everything up to an empty text line
-//
-void request_read_headers(int fd) {
-    char buf[MAXBUF];
-    
-    readline_or_die(fd, buf, MAXBUF);
-    while (strcmp(buf, "\r\n")) {
-      readline_or_die(fd, buf, MAXBUF);
-    }
-    return;
-}
-
 //
 // Return 1 if static, 0 if dynamic content
 // Calculates filename (and cgiargs, for dynamic) from uri
 //
 int request_parse_uri(char *uri, char *filename, char *cgiargs) {
-    char *ptr;
+    size_t len = strlen(uri);
     
+    filename[0] = '.';
     if (!strstr(uri, "cgi")) { 
       // static
-      strcpy(cgiargs, "");
-      sprintf(filename, ".%s", uri);
-      if (uri[strlen(uri)-1] == '/') {
-          strcat(filename, "index.html");
+      cgiargs[0] = '\0';
+      memcpy(filename + 1, uri, len + 1);
+      if (len == 0 || uri[len-1] == '/') {
+          memcpy(filename + 1 + len, "index.html", sizeof("index.html"));
       }
       return 1;
   
     } else { 
 
       // dynamic
-      ptr = index(uri, '?');
+      char *ptr = memchr(uri, '?', len);
       if (ptr) {
-          strcpy(cgiargs, ptr+1);
+          memcpy(cgiargs, ptr + 1, len - (ptr - uri));
           *ptr = '\0';
+          len = ptr - uri;
       } else {
-          strcpy(cgiargs, "");
+          cgiargs[0] = '\0';
       }
-      sprintf(filename, ".%s", uri);
+      memcpy(filename + 1, uri, len + 1);
       return 0;
     }
 }
@@ -95,25 +93,218 @@ void request_get_filetype(char *filename, char *filetype) {
       strcpy(filetype, "text/plain");
 }
 
-void request_serve_dynamic(int fd, char *filename, char *cgiargs) {
+//
+// Length of the CGI header block in buf (through its blank line), or 0
+// if it has not ended yet. *has_length is set if it gives Content-Length.
+//
+static size_t cgi_header_len(char *buf, size_t len, int *has_length) {
+    size_t i = 0;
+    
+    *has_length = 0;
+    while (i < len) {
+      char *nl = memchr(buf + i, '\n', len - i);
+      if (!nl)
+          return 0;
+      size_t line = nl - (buf + i);
+      if (line == 0 || (line == 1 && buf[i] == '\r'))
+          return nl + 1 - buf;
+      if (line >= 15 && strncasecmp(buf + i, "Content-Length:", 15) == 0)
+          *has_length = 1;
+      i = nl + 1 - buf;
+    }
+    return 0;
+}
+
+// send n bytes as one chunk of a chunked body
+static void write_chunk(int fd, char *data, size_t n) {
+    char size[32];
+    struct iovec iov[3] = {
+      { size, sprintf(size, "%zx\r\n", n) },
+      { data, n },
+      { "\r\n", 2 },
+    };
+    size_t total = iov[0].iov_len + n + 2;
+    ssize_t rc;
+    
+    while (total > 0) {
+      rc = writev(fd, iov, 3);
+      if (rc < 0 && errno == EINTR)
+          continue;
+      assert(rc > 0);
+      total -= rc;
+      for (int i = 0; i < 3 && rc > 0; i++) {
+          size_t k = (size_t) rc < iov[i].iov_len ? (size_t) rc : iov[i].iov_len;
+          iov[i].iov_base = (char *) iov[i].iov_base + k;
+          iov[i].iov_len -= k;
+          rc -= k;
+      }
+    }
+}
+
+//
+// HTTP/1.1 response for a CGI whose output arrives in out (or on
+// pipe fd cgi_fd, if out is NULL). Without a Content-Length from the
+// CGI the body is sent chunked, one chunk per read, so the client sees
+// rows as soon as the CGI flushes them and can tell a cut-off response
+// from a complete one.
+//
+static void request_relay_cgi(int fd, char *filename, int cgi_fd,
+                              char *out, size_t outlen) {
+    char buf[MAXBUF], head[MAXBUF];
+    size_t len = 0, hlen = 0;
+    int has_length = 0;
+    ssize_t n;
+    
+    // collect the CGI's header block
+    if (out) {
+      hlen = cgi_header_len(out, outlen, &has_length);
+    } else {
+      while (hlen == 0 && len < sizeof(buf) &&
+             (n = read(cgi_fd, buf + len, sizeof(buf) - len)) > 0) {
+          len += n;
+          hlen = cgi_header_len(buf, len, &has_length);
+      }
+      out = buf;
+      outlen = len;
+    }
+    if (hlen == 0) {
+      request_error(fd, filename, "502", "Bad Gateway", "CGI program sent no header");
+      return;
+    }
+    
+    sprintf(head, ""
+      "HTTP/1.1 200 OK\r\n"
+      "Server: OSTEP WebServer\r\n"
+      "Connection: close\r\n"
+      "%s", has_length ? "" : "Transfer-Encoding: chunked\r\n");
+    write_or_die(fd, head, strlen(head));
+    write_or_die(fd, out, hlen);
+    
+    // body: what came with the header, then the rest of the pipe
+    if (outlen > hlen) {
+      if (has_length)
+          write_or_die(fd, out + hlen, outlen - hlen);
+      else
+          write_chunk(fd, out + hlen, outlen - hlen);
+    }
+    if (out == buf) {
+      while ((n = read(cgi_fd, buf, sizeof(buf))) > 0) {
+          if (has_length)
+              write_or_die(fd, buf, n);
+          else
+              write_chunk(fd, buf, n);
+      }
+    }
+    if (!has_length)
+      write_or_die(fd, "0\r\n\r\n", 5);
+}
+
+void request_serve_dynamic(int fd, char *filename, char *cgiargs, int http11) {
     char buf[MAXBUF], *argv[] = { NULL };
+    pid_t pid;
+    int pfd[2];
     
     // The server does only a little bit of the header.  
     // The CGI script has to finish writing out the header.
+    access_log_status(200);
     sprintf(buf, ""
       "HTTP/1.0 200 OK\r\n"
       "Server: OSTEP WebServer\r\n");
     
+    // identical requests running right now share one CGI run
+    if (coalesce_enabled && coalesce_idempotent(filename, cgiargs)) {
+      char *out;
+      size_t outlen;
+      if (coalesce_run_cgi(filename, cgiargs, &out, &outlen) < 0) {
+          request_error(fd, filename, "500", "Internal Server Error", "server could not run this CGI program");
+          return;
+      }
+      if (http11) {
+          request_relay_cgi(fd, filename, -1, out, outlen);
+      } else {
+          write_or_die(fd, buf, strlen(buf));
+          write_or_die(fd, out, outlen);
+      }
+      free(out);
+      return;
+    }
+    
+    // HTTP/1.1 clients get the output through a pipe, re-framed
+    if (http11) {
+      if (pipe2(pfd, O_CLOEXEC) < 0) {
+          request_error(fd, filename, "500", "Internal Server Error", "server could not run this CGI program");
+          return;
+      }
+      coalesce_write_begin();
+      if ((pid = fork_or_die()) == 0) {              // child
+          setenv_or_die("QUERY_STRING", cgiargs, 1);
+          dup2_or_die(pfd[1], STDOUT_FILENO);
+          extern char **environ;
+          execve_or_die(filename, argv, environ);
+      }
+      close_or_die(pfd[1]);
+      request_relay_cgi(fd, filename, pfd[0], NULL, 0);
+      close_or_die(pfd[0]);
+      waitpid(pid, NULL, 0);
+      coalesce_write_end();
+      return;
+    }
+    
     write_or_die(fd, buf, strlen(buf));
     
-    if (fork_or_die() == 0) {                        // child
+    coalesce_write_begin();
+    if ((pid = fork_or_die()) == 0) {                // child
       setenv_or_die("QUERY_STRING", cgiargs, 1);   // args to cgi go here
       dup2_or_die(fd, STDOUT_FILENO);              // make cgi writes go to socket (not screen)
       extern char **environ;                       // defined by libc 
       execve_or_die(filename, argv, environ);
     } else {
-      wait_or_die(NULL);
+      // wait for our own child: other workers may be running CGIs too
+      waitpid(pid, NULL, 0);
+      coalesce_write_end();
+    }
+}
+
+//
+// Runs a CGI program with its output going into a pipe instead of the
+// socket, and collects all of it into a malloc'd buffer
+// Returns 0 on success, -1 if the pipe could not be made
+//
+int request_run_cgi(char *filename, char *cgiargs, char **out, size_t *outlen) {
+    char *argv[] = { NULL }, *buf;
+    size_t len = 0, cap = MAXBUF;
+    ssize_t n;
+    int pfd[2];
+    pid_t pid;
+    
+    // close-on-exec, so CGIs started by other workers don't hold our pipe open
+    if (pipe2(pfd, O_CLOEXEC) < 0)
+      return -1;
+    
+    if ((pid = fork_or_die()) == 0) {                // child
+      setenv_or_die("QUERY_STRING", cgiargs, 1);
+      dup2_or_die(pfd[1], STDOUT_FILENO);
+      extern char **environ;
+      execve_or_die(filename, argv, environ);
+    }
+    close_or_die(pfd[1]);
+    
+    buf = malloc(cap);
+    assert(buf != NULL);
+    while ((n = read(pfd[0], buf + len, cap - len)) > 0) {
+      len += n;
+      if (len == cap) {
+          cap *= 2;
+          buf = realloc(buf, cap);
+          assert(buf != NULL);
+      }
     }
+    close_or_die(pfd[0]);
+    waitpid(pid, NULL, 0);
+    
+    *out = buf;
+    *outlen = len;
+    return 0;
 }
 
 void request_serve_static(int fd, char *filename, int filesize) {
@@ -121,14 +312,17 @@ void request_serve_static(int fd, char *filename, int filesize) {
     char *srcp, filetype[MAXBUF], buf[MAXBUF];
     
     request_get_filetype(filename, filetype);
+    uint64_t t = trace_begin();
     srcfd = open_or_die(filename, O_RDONLY, 0);
     
     // Rather than call read() to read the file into memory, 
     // which would require that we allocate a buffer, we memory-map the file
     srcp = mmap_or_die(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
     close_or_die(srcfd);
+    trace_end("mmap", t);
     
     // put together response
+    access_log_status(200);
     sprintf(buf, ""
       "HTTP/1.0 200 OK\r\n"
       "Server: OSTEP WebServer\r\n"
@@ -139,24 +333,83 @@ void request_serve_static(int fd, char *filename, int filesize) {
     write_or_die(fd, buf, strlen(buf));
     
     //  Writes out to the client socket the memory-mapped file 
+    t = trace_begin();
     write_or_die(fd, srcp, filesize);
     munmap_or_die(srcp, filesize);
+    trace_end("write", t);
+}
+
+//
+// Read until the end of the request headers. Returns the number of bytes
+// in buf, or 0 if the client went away or sent something unparsable (an
+// error response has then been sent where that makes sense). Reading
+// stops early after an HTTP/2 preface line, whose remaining bytes belong
+// to the h2 reader.
+//
+static size_t request_read(int fd, char *buf, size_t cap, struct http_request *req) {
+    size_t len = 0;
+    int rc = HTTP_PARSE_PARTIAL;
+
+    http_parse_init(req);
+    while (rc == HTTP_PARSE_PARTIAL) {
+        if (len == cap) {
+            request_error(fd, "request", "431", "Request Header Fields Too Large",
+                          "server could not read this request");
+            return 0;
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        len += n;
+        rc = http_parse(req, buf, len);
+        if (req->state != HTTP_STATE_LINE && http_slice_eq(req->method, "PRI"))
+            return len; // the rest is not HTTP/1 headers
+    }
+    if (rc == HTTP_PARSE_ERROR) {
+        request_error(fd, "request", "400", "Bad Request",
+                      "server could not parse this request");
+        return 0;
+    }
+    return len;
 }
 
 // handle a request
 void request_handle(int fd) {
     int is_static;
     struct stat sbuf;
-    char buf[MAXBUF], method[MAXBUF], uri[MAXBUF], version[MAXBUF];
-    char filename[MAXBUF], cgiargs[MAXBUF];
+    struct http_request req;
+    const struct http_slice *upgrade, *settings;
+    char buf[MAXBUF], uri[MAXBUF];
+    char filename[MAXBUF], cgiargs[MAXBUF], h2settings[MAXBUF];
+    size_t len;
     
-    readline_or_die(fd, buf, MAXBUF);
-    sscanf(buf, "%s %s %s", method, uri, version);
-    printf("method:%s uri:%s version:%s\n", method, uri, version);
+    uint64_t t = trace_begin();
+    len = request_read(fd, buf, sizeof(buf), &req);
+    trace_end("read_request", t);
+    if (len == 0)
+      return;
+    printf("method:%.*s uri:%.*s version:%.*s\n",
+           (int) req.method.len, req.method.p, (int) req.uri.len, req.uri.p,
+           (int) req.version.len, req.version.p);
     
+    // h2c with prior knowledge: the request line is the HTTP/2 preface
+    if (http_slice_eq(req.method, "PRI") && http_slice_eq(req.uri, "*") &&
+        http_slice_eq(req.version, "HTTP/2.0")) {
+      h2_accept(fd, buf + req.line_len, len - req.line_len);
+      return;
+    }
+    access_log_request(fd, req.method, req.uri, req.version);
+    
+    if (!http_slice_copy(req.uri, uri, sizeof(uri))) {
+      request_error(fd, "uri", "414", "URI Too Long", "server could not read this uri");
+      return;
+    }
+
     //For Security Purposes(2.3) by forbidding any ".." in the url
 
-    if (strstr(uri, "..")) {
+    if (http_slice_contains(req.uri, "..")) {
       request_error(fd, uri,
                     "403", "Forbidden",
                     "Parent-directory (..) access not allowed");
@@ -164,14 +417,29 @@ void request_handle(int fd) {
   }
 
 
-    if (strcasecmp(method, "GET")) {
+    if (!http_slice_ieq(req.method, "GET")) {
+      char method[MAXBUF];
+      http_slice_copy(req.method, method, sizeof(method));
       request_error(fd, method, "501", "Not Implemented", "server does not implement this method");
       return;
     }
-    request_read_headers(fd);
+    upgrade = http_header(&req, "Upgrade");
+    settings = http_header(&req, "HTTP2-Settings");
+    if (upgrade && http_slice_contains(*upgrade, "h2c") &&
+        http_slice_eq(req.version, "HTTP/1.1")) {
+      h2settings[0] = '\0';
+      if (settings)
+        http_slice_copy(*settings, h2settings, sizeof(h2settings));
+      access_log_status(101); // stream 1 is logged on its own
+      h2_upgrade(fd, uri, h2settings, buf + req.off, len - req.off);
+      return;
+    }
     
     is_static = request_parse_uri(uri, filename, cgiargs);
-    if (stat(filename, &sbuf) < 0) {
+    t = trace_begin();
+    int rc = stat(filename, &sbuf);
+    trace_end("stat", t);
+    if (rc < 0) {
       request_error(fd, filename, "404", "Not found", "server could not find this file");
       return;
     }
@@ -187,6 +455,9 @@ void request_handle(int fd) {
         request_error(fd, filename, "403", "Forbidden", "server could not run this CGI program");
         return;
       }
-      request_serve_dynamic(fd, filename, cgiargs);
+      t = trace_begin();
+      request_serve_dynamic(fd, filename, cgiargs,
+                            http_slice_eq(req.version, "HTTP/1.1"));
+      trace_end("cgi", t);
     }
 }
@@ -1,5 +1,11 @@
 #ifndef __REQUEST_H__
+#define __REQUEST_H__
+
+#include <stddef.h>
 
 void request_handle(int fd);
+int request_parse_uri(char *uri, char *filename, char *cgiargs);
+void request_get_filetype(char *filename, char *filetype);
+int request_run_cgi(char *filename, char *cgiargs, char **out, size_t *outlen);
 
 #endif // __REQUEST_H__
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "schema.h"
+
+int schema_parse(const char *text, struct schema *s, char *err, size_t errlen)
+{
+    char copy[512];
+    snprintf(copy, sizeof(copy), "%s", text);
+    memset(s, 0, sizeof(*s));
+    int offset = 1; // the used byte
+
+    for (char *save, *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        while (isspace((unsigned char)*tok))
+            tok++;
+        char *colon = strchr(tok, ':');
+        if (!colon)
+        {
+            snprintf(err, errlen, "bad CREATE syntax");
+            return 0;
+        }
+        *colon = '\0';
+        char *name = tok, *type = colon + 1;
+
+        if (*name == '\0' || strlen(name) >= sizeof(s->col[0].name))
+        {
+            snprintf(err, errlen, "invalid column name");
+            return 0;
+        }
+        for (char *p = name; *p; p++)
+        {
+            if (!isalnum((unsigned char)*p) && *p != '_')
+            {
+                snprintf(err, errlen, "invalid column name");
+                return 0;
+            }
+        }
+        if (schema_column(s, name) >= 0)
+        {
+            snprintf(err, errlen, "duplicate column '%s'", name);
+            return 0;
+        }
+        if (s->ncols == SCHEMA_MAX_COLS)
+        {
+            snprintf(err, errlen, "too many columns");
+            return 0;
+        }
+
+        struct column *c = &s->col[s->ncols];
+        strcpy(c->name, name);
+        if (strcmp(type, "smallint") == 0)
+        {
+            c->type = COL_SMALLINT;
+            c->size = sizeof(int16_t);
+        }
+        else if (strcmp(type, "integer") == 0)
+        {
+            c->type = COL_INTEGER;
+            c->size = sizeof(int32_t);
+        }
+        else if (strncmp(type, "char(", 5) == 0)
+        {
+            char *start = type + 5;
+            char *end = strchr(start, ')');
+            if (!end || end[1] != '\0')
+            {
+                snprintf(err, errlen, "bad type format in char(n)");
+                return 0;
+            }
+            for (char *d = start; d < end; d++)
+            {
+                if (!isdigit((unsigned char)*d))
+                {
+                    snprintf(err, errlen, "bad char(n) format");
+                    return 0;
+                }
+            }
+            c->type = COL_CHAR;
+            c->size = atoi(start);
+            if (end == start || c->size < 1 || c->size >= SCHEMA_ROW_BYTES)
+            {
+                snprintf(err, errlen, "bad char(n) format");
+                return 0;
+            }
+        }
+        else
+        {
+            snprintf(err, errlen, "unsupported type '%s'", type);
+            return 0;
+        }
+
+        // integers are aligned to their size, chars need nothing
+        if (c->type != COL_CHAR)
+            offset = (offset + c->size - 1) / c->size * c->size;
+        c->offset = offset;
+        offset += c->size;
+        s->ncols++;
+    }
+    if (s->ncols == 0)
+    {
+        snprintf(err, errlen, "no columns specified");
+        return 0;
+    }
+
+    s->row_size = (offset + 3) / 4 * 4;
+    if (s->row_size > SCHEMA_ROW_BYTES)
+    {
+        snprintf(err, errlen, "row of %d bytes does not fit a block (at most %d)",
+                 s->row_size, SCHEMA_ROW_BYTES);
+        return 0;
+    }
+    s->slots = SCHEMA_ROW_BYTES / s->row_size;
+    return 1;
+}
+
+int schema_column(const struct schema *s, const char *name)
+{
+    for (int i = 0; i < s->ncols; i++)
+    {
+        if (strcmp(s->col[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int row_set(const struct schema *s, char *row, int c, const char *val, char *err, size_t errlen)
+{
+    const struct column *col = &s->col[c];
+    char *p = row + col->offset;
+
+    if (col->type == COL_CHAR)
+    {
+        // longer values are cut to the declared size
+        size_t n = strlen(val);
+        memset(p, 0, col->size);
+        memcpy(p, val, n < (size_t)col->size ? n : (size_t)col->size);
+        return 1;
+    }
+
+    char *end;
+    errno = 0;
+    long v = strtol(val, &end, 10);
+    while (isspace((unsigned char)*end))
+        end++;
+    if (end == val || *end != '\0')
+    {
+        snprintf(err, errlen, "bad INSERT values");
+        return 0;
+    }
+    long lo = col->type == COL_SMALLINT ? INT16_MIN : INT32_MIN;
+    long hi = col->type == COL_SMALLINT ? INT16_MAX : INT32_MAX;
+    if (errno == ERANGE || v < lo || v > hi)
+    {
+        snprintf(err, errlen, "value %s out of range for column '%s'", val, col->name);
+        return 0;
+    }
+    if (col->type == COL_SMALLINT)
+        *(int16_t *)p = v;
+    else
+        *(int32_t *)p = v;
+    return 1;
+}
+
+int row_encode(const struct schema *s, const char *vals, char *row, char *err, size_t errlen)
+{
+    int provided = 1;
+    for (const char *p = vals; *p; p++)
+    {
+        if (*p == ',')
+            provided++;
+    }
+    if (provided != s->ncols)
+    {
+        snprintf(err, errlen, "expected %d values, got %d", s->ncols, provided);
+        return 0;
+    }
+
+    char copy[512];
+    if (strlen(vals) >= sizeof(copy))
+    {
+        snprintf(err, errlen, "values longer than %d bytes", (int)sizeof(copy) - 1);
+        return 0;
+    }
+    strcpy(copy, vals);
+    memset(row, 0, s->row_size);
+    char *val = copy;
+    for (int c = 0; c < s->ncols; c++)
+    {
+        char *comma = strchr(val, ',');
+        if (comma)
+            *comma = '\0';
+        if (!row_set(s, row, c, val, err, errlen))
+            return 0;
+        if (comma)
+            val = comma + 1;
+    }
+    row[0] = 1;
+    return 1;
+}
@@ -0,0 +1,75 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A table's columns as CREATE TABLE declared them, and the row layout
+// that follows from them. A row is a used byte (0 for an empty slot)
+// and then each column in order: smallint as an int16_t, integer as an
+// int32_t, both native (little endian) byte order, and char(n) as n
+// bytes padded with NULs. Each column starts at a multiple of its own
+// size and the row size is a multiple of 4, so rows packed from the
+// start of a block can be read in place through pointer casts.
+
+#define SCHEMA_MAX_COLS 16
+#define SCHEMA_ROW_BYTES 220 // rows go in a block's first bytes, before the table header
+
+enum col_type
+{
+    COL_SMALLINT,
+    COL_INTEGER,
+    COL_CHAR
+};
+
+struct column
+{
+    char name[64];
+    enum col_type type;
+    int size;   // bytes in the row
+    int offset; // from the start of the row
+};
+
+struct schema
+{
+    int ncols;
+    struct column col[SCHEMA_MAX_COLS];
+    int row_size;
+    int slots; // rows per block
+};
+
+// parse a column list as schema.db has it ("id:smallint,title:char(20)");
+// on a bad one 0 is returned with the reason in err
+int schema_parse(const char *text, struct schema *s, char *err, size_t errlen);
+
+// index of the named column, -1 if there is none
+int schema_column(const struct schema *s, const char *name);
+
+// store a value given as text in column c of row; 0 with the reason in
+// err if it is not a number or out of range for an integer column
+int row_set(const struct schema *s, char *row, int c, const char *val, char *err, size_t errlen);
+
+// a whole row from the inside of a VALUES tuple ("1,Avatar,162")
+int row_encode(const struct schema *s, const char *vals, char *row, char *err, size_t errlen);
+
+static inline int row_used(const char *row)
+{
+    return row[0] != 0;
+}
+
+// value of an integer column
+static inline int32_t row_int(const struct schema *s, const char *row, int c)
+{
+    const char *p = row + s->col[c].offset;
+    if (s->col[c].type == COL_SMALLINT)
+        return *(const int16_t *)p;
+    return *(const int32_t *)p;
+}
+
+// a char column holds up to size bytes, with no NUL after a full one
+static inline const char *row_chars(const struct schema *s, const char *row, int c)
+{
+    return row + s->col[c].offset;
+}
+
+#endif // SCHEMA_H
@@ -1,8 +1,10 @@
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #define MAXBUF (8192)
@@ -11,7 +13,22 @@
 // This program is intended to help you test your web server.
 // You can use it to test that you are correctly having multiple threads
 // handling http requests.
-// 
+//
+// spin.cgi?N waits N seconds. For finer control the query string can
+// also be a list of settings, each optional:
+//
+//   spin.cgi?cpu=2000&block=500&mem=1M&size=64K
+//
+//   cpu    microseconds of CPU work
+//   block  microseconds asleep, as if waiting on a disk or a backend
+//   mem    bytes to allocate and touch (K/M/G suffixes allowed)
+//   size   bytes of response body
+//   seed   seed for the random draws below (default: pid and time)
+//
+// Any value can be a random draw instead of a number:
+//   exp:MEAN              exponential with that mean
+//   pareto:SCALE:ALPHA    Pareto, heavy-tailed for small ALPHA
+//
 
 double get_seconds() {
     struct timeval t;
@@ -20,33 +37,127 @@ double get_seconds() {
     return (double) ((double)t.tv_sec + (double)t.tv_usec / 1e6);
 }
 
+static unsigned short rng[3];
+
+// uniform in (0, 1]
+static double uniform(void) {
+    return 1.0 - erand48(rng);
+}
+
+// "123", "64K", "exp:2000", "pareto:1000:1.5"
+static double parse_value(char *s) {
+    double mean, scale, alpha;
+    char *end;
+    
+    if (sscanf(s, "exp:%lf", &mean) == 1)
+      return -mean * log(uniform());
+    if (sscanf(s, "pareto:%lf:%lf", &scale, &alpha) == 2 && alpha > 0)
+      return scale / pow(uniform(), 1.0 / alpha);
+    double v = strtod(s, &end);
+    switch (*end) {
+    case 'k': case 'K': v *= 1024; break;
+    case 'm': case 'M': v *= 1024 * 1024; break;
+    case 'g': case 'G': v *= 1024 * 1024 * 1024; break;
+    }
+    return v < 0 ? 0 : v;
+}
+
+static double cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// burn CPU (not wall clock) time
+static void busy(double usec) {
+    volatile double x = 1.0;
+    double t1 = cpu_seconds();
+    while ((cpu_seconds() - t1) * 1e6 < usec) {
+      for (int i = 0; i < 1000; i++)
+          x = x * 1.0000001 + 1e-9;
+    }
+}
+
+// sleep until `seconds` of wall time have passed since t1
+static void block_until(double t1, double seconds) {
+    double left;
+    while ((left = seconds - (get_seconds() - t1)) > 0) {
+      struct timespec ts = { (time_t) left, (long) ((left - (time_t) left) * 1e9) };
+      nanosleep(&ts, NULL);
+    }
+}
 
 int main(int argc, char *argv[]) {
+    (void) argc; (void) argv;
     // Extract arguments
-    double spin_for = 0.0;
-    char *buf;
+    double spin_for = 0.0, cpu = 0, block = 0, mem = 0, size = 0;
+    char *buf, args[MAXBUF] = "";
+    int legacy = 1;
+    
     if ((buf = getenv("QUERY_STRING")) != NULL) {
+      snprintf(args, sizeof(args), "%s", buf);
+      legacy = strchr(args, '=') == NULL;
+    } else {
+      buf = "";
+    }
+    
+    if (legacy) {
       // just expecting a single number
       spin_for = (double) atoi(buf);
+    } else {
+      char *seed = strstr(args, "seed=");
+      long s = seed ? atol(seed + 5) : (long) getpid() ^ (long) time(NULL);
+      rng[0] = 0x330e;
+      rng[1] = s;
+      rng[2] = s >> 16;
+      for (char *kv = strtok(args, "&"); kv; kv = strtok(NULL, "&")) {
+          char *v = strchr(kv, '=');
+          if (!v)
+              continue;
+          *v++ = '\0';
+          if (!strcmp(kv, "cpu"))
+              cpu = parse_value(v);
+          else if (!strcmp(kv, "block"))
+              block = parse_value(v);
+          else if (!strcmp(kv, "mem"))
+              mem = parse_value(v);
+          else if (!strcmp(kv, "size"))
+              size = parse_value(v);
+      }
     }
-
+    
     double t1 = get_seconds();
-    while ((get_seconds() - t1) < spin_for)
-      sleep(1);
+    char *hold = NULL;
+    if (legacy) {
+      block_until(t1, spin_for);
+    } else {
+      if (mem > 0 && (hold = malloc((size_t) mem)) != NULL)
+          memset(hold, 1, (size_t) mem);    // make the pages real
+      busy(cpu);
+      block_until(get_seconds(), block / 1e6);
+    }
     double t2 = get_seconds();
     
     /* Make the response body */
     char content[MAXBUF];
-    sprintf(content, "<p>Welcome to the CGI program (%s)</p>\r\n", buf);
-    sprintf(content, "%s<p>My only purpose is to waste time on the server!</p>\r\n", content);
-    sprintf(content, "%s<p>I spun for %.2f seconds</p>\r\n", content, t2 - t1);
+    int n = snprintf(content, sizeof(content),
+                     "<p>Welcome to the CGI program (%s)</p>\r\n"
+                     "<p>My only purpose is to waste time on the server!</p>\r\n"
+                     "<p>I spun for %.2f seconds</p>\r\n", buf, t2 - t1);
+    if (!legacy)
+      n += snprintf(content + n, sizeof(content) - n,
+                    "<p>cpu %.0f us, blocked %.0f us, mem %.0f bytes</p>\r\n",
+                    cpu, block, mem);
+    long body = (long) size > n ? (long) size : n;
     
     /* Generate the HTTP response */
-    printf("Content-Length: %lu\r\n", strlen(content));
+    printf("Content-Length: %ld\r\n", body);
     printf("Content-Type: text/html\r\n\r\n");
     printf("%s", content);
+    for (long pad = body - n; pad > 0; pad--)   // filler up to size
+      putchar('.');
     fflush(stdout);
+    free(hold);
     
     exit(0);
 }
-
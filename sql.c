@@ -1,61 +1,62 @@
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <stdarg.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <limits.h>
 #include "io_helper.h"
 #include "blockio.h"
+#include "btree.h"
+#include "sqlcache.h"
+#include "sql.h"
+#include "iostats.h"
+#include "schema.h"
+#include "catalog.h"
 #include <ctype.h>
 
-#define SCHEMA_FILE "schema.db"
-#define MAXQS 8192
 #define MAXSQL 1024
 #define MAXTOK 256
 
-// this is bc 4 (id) + 30 (title as char(n)) + 8 (length) + 1 (padding)
-// roughly 256/43 ~ 5 entries per block
-#define RECORD_SIZE 43
+// defaults for sql_flush_rows / sql_flush_bytes, see sql.h;
+// SQL_FLUSH_ROWS / SQL_FLUSH_BYTES in the environment override them
+#define FLUSH_ROWS 64
+#define FLUSH_BYTES 16384
+
+// rows, laid out as schema.h describes, are packed from the start of
+// each block up to TABLE_HDR_OFF. In block 0 the bytes from there to 240,
+// where blockio's free block list starts, hold table-wide metadata
+#define TABLE_HDR_OFF SCHEMA_ROW_BYTES
+
+struct table_header
+{
+    uint32_t version;  // bumped by every INSERT, UPDATE and DELETE
+    uint32_t magic;    // TABLE_MAGIC
+    int32_t free_head; // first block with an empty slot, -1 if none
+    int32_t tail;      // last block of the chain
+};
+
+// tables from before binary rows have 0 or "FSM1" here, and their text
+// rows cannot be read any more
+#define TABLE_MAGIC 0x32574f52 // "ROW2"
+
+// blocks with an empty slot are linked through this field of each block:
+// 0 while the block is not on the list, otherwise the next one on it
+// plus 2 (1 for the end of the list)
+#define FREE_LINK_OFF (TABLE_HDR_OFF + sizeof(struct table_header))
 
 // functions that is used for sql commands
 void handle_create(char *qs);
+void handle_create_index(char *qs);
 void handle_insert(char *qs);
+void handle_copy(char *qs);
 void handle_select(char *qs);
 void handle_update(char *qs);
 void handle_delete(char *qs);
 void handle_dump(char *qs);
 
-/*
-Loads a table schema from schema.db
-This will return true if the file is found, else false
-*/
-
-int load_schema_from_file(const char *tbl, char *out, size_t outsize)
-{
-    FILE *fp = fopen(SCHEMA_FILE, "r");
-    if (!fp)
-        return 0;
-
-    char line[512];
-    while (fgets(line, sizeof(line), fp))
-    {
-        if (strncmp(line, tbl, strlen(tbl)) == 0 && line[strlen(tbl)] == '|')
-        {
-            char *schema_part = strchr(line, '|');
-            if (schema_part)
-            {
-                strncpy(out, schema_part + 1, outsize);
-                char *semi = strchr(out, ';');
-                if (semi)
-                    *semi = '\0'; // chop off semicolon
-                fclose(fp);
-                return 1;
-            }
-        }
-    }
-    fclose(fp);
-    return 0; // not found
-}
-
 // decodes a url encoded string
 void url_decode(char *dst, const char *src)
 {
@@ -82,34 +83,509 @@ void url_decode(char *dst, const char *src)
     *dst = '\0';
 }
 
-int main()
+// current version of a table, from its header block
+static uint32_t table_version(const char *datafile)
+{
+    char buf[BLOCK_SIZE];
+    struct table_header hdr;
+    read_block(datafile, 0, buf);
+    memcpy(&hdr, buf + TABLE_HDR_OFF, sizeof(hdr));
+    return hdr.version;
+}
+
+/*
+Locks a table against other writers while its rows, free list, indexes
+or header change, and drops block 0 from the pool so the header is read
+again under the lock. unlock_table writes everything back before
+letting go
+*/
+static int tables_locked;
+
+static int lock_table(const char *datafile)
+{
+    int fd = open_or_die(datafile, O_RDWR, 0);
+    flock(fd, LOCK_EX);
+    blockio_invalidate(datafile, 0);
+    tables_locked++;
+    return fd;
+}
+
+static void unlock_table(int fd)
 {
-    // grab the raw QUERY_STRING
-    char *raw_qs = getenv("QUERY_STRING");
+    tables_locked--;
+    blockio_flush();
+    flock(fd, LOCK_UN);
+    close_or_die(fd);
+}
 
-    // CGI header
-    printf("Content-Type: text/html\r\n\r\n");
+static void read_header(char *blk0, struct table_header *hdr)
+{
+    memcpy(hdr, blk0 + TABLE_HDR_OFF, sizeof(*hdr));
+}
 
-    if (!raw_qs)
+static void write_header(char *blk0, const struct table_header *hdr)
+{
+    memcpy(blk0 + TABLE_HDR_OFF, hdr, sizeof(*hdr));
+}
+
+/*
+Called after a statement changed a table, so SELECT results cached
+at older versions no longer match. The caller holds the table's lock,
+so two writers do not both end up on the same new version
+*/
+static void bump_version(const char *datafile)
+{
+    struct table_header hdr;
+    char *blk0 = pin_block(datafile, 0);
+    read_header(blk0, &hdr);
+    hdr.version++;
+    write_header(blk0, &hdr);
+    unpin_block(blk0, 1);
+}
+
+/*
+Finds a table: its schema from the catalog, copied into s, and its data
+file, which has to be there and hold binary rows. Prints the error and
+returns 0 otherwise
+*/
+static int open_table(const char *tbl, struct schema *s, char *datafile, size_t size)
+{
+    const struct table_desc *t = catalog_table(tbl);
+    struct stat st;
+
+    snprintf(datafile, size, "%s.data", tbl);
+    if (!t || stat(datafile, &st) < 0)
+    {
+        printf("<p>ERROR: table <b>%s</b> does not exist</p>\n", tbl);
+        return 0;
+    }
+    *s = t->s;
+
+    struct table_header hdr;
+    char *blk0 = pin_block(datafile, 0);
+    read_header(blk0, &hdr);
+    unpin_block(blk0, 0);
+    if (hdr.magic != TABLE_MAGIC)
     {
-        printf("<p>ERROR: no query string provided</p>\n");
-        return 1;
+        printf("<p>ERROR: table <b>%s</b> has rows in an old format; create it again</p>\n", tbl);
+        return 0;
     }
+    return 1;
+}
 
-    // decode it into buffer
-    char qs_buf[MAXQS];
-    url_decode(qs_buf, raw_qs);
-    char *qs = qs_buf;
+static int32_t free_link(const char *blk)
+{
+    int32_t link;
+    memcpy(&link, blk + FREE_LINK_OFF, sizeof(link));
+    return link;
+}
 
+static void set_free_link(char *blk, int32_t link)
+{
+    memcpy(blk + FREE_LINK_OFF, &link, sizeof(link));
+}
+
+// first empty slot in a block, -1 if it is full
+static int empty_slot(const struct schema *s, const char *blk)
+{
+    for (int slot = 0; slot < s->slots; slot++)
+    {
+        if (!row_used(blk + slot * s->row_size))
+            return slot;
+    }
+    return -1;
+}
+
+// put block b (pinned at blk) on the free list unless it is on it already
+static void push_free(struct table_header *hdr, int b, char *blk)
+{
+    if (free_link(blk) != 0)
+        return;
+    set_free_link(blk, hdr->free_head + 2);
+    hdr->free_head = b;
+}
+
+// 1 if no slot in the block holds a row
+static int block_empty(const struct schema *s, const char *blk)
+{
+    for (int slot = 0; slot < s->slots; slot++)
+    {
+        if (row_used(blk + slot * s->row_size))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+Rebuilds the free list with one walk down the chain, which finds the
+blocks with room and the last block. With drop_empty, blocks without
+a single row (block 0 aside) come out of the chain and go back to
+blockio, whose alloc_block hands them out again before growing the
+file. CREATE TABLE starts the list this way, and DELETE calls it
+whenever it empties a block
+*/
+static void build_free_list(const char *datafile, const struct schema *s,
+                            struct table_header *hdr, int drop_empty)
+{
+    int prev = -1;
+    hdr->free_head = -1;
+    for (int b = 0; b != -1;)
+    {
+        int next = get_next_block(datafile, b);
+        char *blk = pin_block(datafile, b);
+        if (drop_empty && b != 0 && block_empty(s, blk))
+        {
+            unpin_block(blk, 0);
+            set_next_block(datafile, prev, next);
+            free_block(datafile, b);
+        }
+        else
+        {
+            set_free_link(blk, 0);
+            if (empty_slot(s, blk) >= 0)
+                push_free(hdr, b, blk);
+            unpin_block(blk, 1);
+            prev = b;
+        }
+        b = next;
+    }
+    hdr->tail = prev;
+    hdr->magic = TABLE_MAGIC;
+}
+
+// every table with an integer id column has a B+tree on it, in <table>.idx
+static void index_file(const char *tbl, char *out, size_t outsize)
+{
+    snprintf(out, outsize, "%s.idx", tbl);
+}
+
+/*
+Loads the indexes on a table from the catalog: the id index, if the
+table has one, then one for every CREATE INDEX on the table
+Returns how many there are
+*/
+static int load_indexes(const char *tbl, struct index_def *out)
+{
+    const struct table_desc *t = catalog_table(tbl);
+    if (!t)
+        return 0;
+    memcpy(out, t->idx, t->nidx * sizeof(out[0]));
+    return t->nidx;
+}
+
+// add a row at (b, slot) to every index, or take it out of them, under
+// the lock the row itself changes under
+static void index_row(const struct schema *s, struct index_def *idx, int nidx,
+                      const char *row, int b, int slot)
+{
+    assert(tables_locked);
+    for (int i = 0; i < nidx; i++)
+        btree_insert(idx[i].file, row_int(s, row, idx[i].col), b, slot);
+}
+
+static void unindex_row(const struct schema *s, struct index_def *idx, int nidx,
+                        const char *row, int b, int slot)
+{
+    assert(tables_locked);
+    for (int i = 0; i < nidx; i++)
+        btree_delete(idx[i].file, row_int(s, row, idx[i].col), b, slot);
+}
+
+/*
+Merges n new entries into an index by building it again bottom up with
+the ones it has, in <file>.new, which then takes the old file's place,
+so a process still reading the old tree keeps a whole one. e must have
+room for the old entries after the new ones
+*/
+static void rebuild_index(const char *file, struct btree_entry **e, int n, int *cap)
+{
+    struct btree_cursor c;
+    btree_seek(&c, file, INT32_MIN);
+    while (btree_next(&c, &(*e)[n]))
+    {
+        if (++n == *cap)
+            *e = realloc(*e, (*cap *= 2) * sizeof(**e));
+    }
+    btree_sort(*e, n);
+
+    char tmp[144];
+    snprintf(tmp, sizeof(tmp), "%s.new", file);
+    unlink(tmp);
+    btree_build(tmp, *e, n);
+    blockio_forget(tmp);
+    blockio_forget(file);
+    rename(tmp, file);
+}
+
+/*
+A WHERE clause: the column, the operator and what to compare with, a
+number for an integer column and text for a char one
+*/
+struct where
+{
+    int col;
+    const char *op; // "=", "!=", "<" or ">"
+    int32_t num;
+    char str[64];
+};
+
+// prints the error and returns 0 if cond is not a WHERE clause on s
+static int parse_where(const struct schema *s, const char *cond, struct where *w)
+{
+    if (strstr(cond, "!="))
+        w->op = "!=";
+    else if (strstr(cond, "<"))
+        w->op = "<";
+    else if (strstr(cond, ">"))
+        w->op = ">";
+    else if (strstr(cond, "="))
+        w->op = "=";
+    else
+    {
+        printf("<p>ERROR: unknown operator</p>\n");
+        return 0;
+    }
+
+    char field[64] = "", value[64] = "";
+    if (strcmp(w->op, "!=") == 0)
+        sscanf(cond, "%63[^!]!=%63s", field, value);
+    else
+        sscanf(cond, "%63[^<>=]%*c%63s", field, value);
+    if ((w->col = schema_column(s, field)) < 0)
+    {
+        printf("<p>ERROR: unknown column '%s'</p>\n", field);
+        return 0;
+    }
+    w->num = atoi(value);
+    snprintf(w->str, sizeof(w->str), "%s", value);
+    return 1;
+}
+
+// 1 if the row satisfies the clause
+static int where_match(const struct schema *s, const struct where *w, const char *row)
+{
+    int cmp;
+    if (s->col[w->col].type == COL_CHAR)
+    {
+        size_t size = s->col[w->col].size;
+        cmp = strncmp(row_chars(s, row, w->col), w->str, size);
+        if (cmp == 0 && strlen(w->str) > size)
+            cmp = -1;
+    }
+    else
+    {
+        int32_t v = row_int(s, row, w->col);
+        cmp = (v > w->num) - (v < w->num);
+    }
+
+    if (!strcmp(w->op, "="))
+        return cmp == 0;
+    if (!strcmp(w->op, "!="))
+        return cmp != 0;
+    if (!strcmp(w->op, "<"))
+        return cmp < 0;
+    return cmp > 0;
+}
+
+/*
+The rows a statement visits: for =, < and > on an indexed column the
+ones the index points at, in column order; otherwise every row along
+the block chain. The block the last row is in stays pinned, and is
+written back if the caller sets dirty after changing the row.
+*/
+struct row_source
+{
+    const char *datafile;
+    const struct schema *s;
+    char *blk; // pinned block the last row is in
+    int b;     // its number, -1 when the chain walk is done
+    int slot;  // and the last row's slot in it
+    int dirty;
+    struct btree_entry *rids; // the index's rows, NULL for a chain walk
+    int nrids, next;
+};
+
+static void source_open(struct row_source *src, const char *datafile,
+                        const struct schema *s, struct index_def *idx, int nidx,
+                        const struct where *w)
+{
+    memset(src, 0, sizeof(*src));
+    src->datafile = datafile;
+    src->s = s;
+    src->slot = -1;
+
+    const char *idxfile = NULL;
+    for (int i = 0; w && i < nidx && strcmp(w->op, "!=") != 0; i++)
+    {
+        if (idx[i].col == w->col)
+        {
+            idxfile = idx[i].file;
+            break;
+        }
+    }
+    if (!idxfile)
+    {
+        blockio_advise_scan(datafile);
+        return;
+    }
+
+    // collect them up front, so DELETE can take entries out as it goes
+    const char *op = w->op;
+    int32_t target = w->num;
+    struct btree_cursor c;
+    struct btree_entry e;
+    int cap = 16;
+    src->rids = malloc(cap * sizeof(src->rids[0]));
+    btree_seek(&c, idxfile, !strcmp(op, "<") ? INT32_MIN : target);
+    while (btree_next(&c, &e))
+    {
+        if ((!strcmp(op, "=") && e.key != target) || (!strcmp(op, "<") && e.key >= target))
+            break;
+        if (!strcmp(op, ">") && e.key == target)
+            continue;
+        if (src->nrids == cap)
+            src->rids = realloc(src->rids, (cap *= 2) * sizeof(src->rids[0]));
+        src->rids[src->nrids++] = e;
+    }
+}
+
+static void source_unpin(struct row_source *src)
+{
+    if (src->blk)
+        unpin_block(src->blk, src->dirty);
+    src->blk = NULL;
+    src->dirty = 0;
+}
+
+// the next row, NULL after the last
+static char *source_next(struct row_source *src)
+{
+    if (src->rids)
+    {
+        while (src->next < src->nrids)
+        {
+            struct btree_entry *e = &src->rids[src->next++];
+            if (!src->blk || src->b != e->block)
+            {
+                source_unpin(src);
+                src->blk = pin_block(src->datafile, e->block);
+                src->b = e->block;
+            }
+            src->slot = e->slot;
+            char *row = src->blk + e->slot * src->s->row_size;
+            if (row_used(row))
+                return row;
+        }
+        return NULL;
+    }
+
+    while (src->b != -1)
+    {
+        if (!src->blk)
+            src->blk = pin_block(src->datafile, src->b);
+        while (src->slot + 1 < src->s->slots)
+        {
+            char *row = src->blk + ++src->slot * src->s->row_size;
+            if (row_used(row))
+                return row;
+        }
+        source_unpin(src);
+        src->b = get_next_block(src->datafile, src->b);
+        src->slot = -1;
+    }
+    return NULL;
+}
+
+static void source_close(struct row_source *src)
+{
+    source_unpin(src);
+    free(src->rids);
+}
+
+/*
+SELECT output goes to stdout and, while it stays under the cache entry
+limit, into memory as well so the whole result can be cached
+*/
+static FILE *capture;
+static char *capture_buf;
+static size_t capture_size;
+
+static void capture_start(void)
+{
+    capture = open_memstream(&capture_buf, &capture_size);
+}
+
+// returns the captured output (malloc'd), or NULL if it grew too big
+static char *capture_finish(size_t *len)
+{
+    if (!capture)
+        return NULL;
+    fclose(capture);
+    capture = NULL;
+    *len = capture_size;
+    return capture_buf;
+}
+
+long sql_flush_rows = FLUSH_ROWS, sql_flush_bytes = FLUSH_BYTES;
+static long unflushed_rows, unflushed_bytes;
+
+static void select_printf(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vprintf(fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        unflushed_bytes += n;
+
+    if (capture)
+    {
+        va_start(ap, fmt);
+        vfprintf(capture, fmt, ap);
+        va_end(ap);
+        if (ftell(capture) > SQLCACHE_MAX_ENTRY)
+        {
+            fclose(capture);
+            free(capture_buf);
+            capture = NULL;
+        }
+    }
+}
+
+// end of one result row: flush if a limit was reached
+static void select_row_done(void)
+{
+    unflushed_rows++;
+    if ((sql_flush_rows > 0 && unflushed_rows >= sql_flush_rows) ||
+        (sql_flush_bytes > 0 && unflushed_bytes >= sql_flush_bytes))
+    {
+        fflush(stdout);
+        unflushed_rows = unflushed_bytes = 0;
+    }
+}
+
+/*
+Runs one decoded statement
+*/
+void sql_execute(char *qs)
+{
     // decoded commands, should turn case insensitive using strncasecmp
     if (strncasecmp(qs, "CREATE TABLE ", 13) == 0)
     {
         handle_create(qs);
     }
+    else if (strncasecmp(qs, "CREATE INDEX ", 13) == 0)
+    {
+        handle_create_index(qs);
+    }
     else if (strncasecmp(qs, "INSERT INTO ", 12) == 0)
     {
         handle_insert(qs);
     }
+    else if (strncasecmp(qs, "COPY ", 5) == 0)
+    {
+        handle_copy(qs);
+    }
     else if (strncasecmp(qs, "SELECT ", 7) == 0)
     {
         handle_select(qs);
@@ -126,12 +602,25 @@ int main()
     {
         handle_dump(qs);
     }
+    else if (strncasecmp(qs, "CACHE STATS", 11) == 0)
+    {
+        sqlcache_print_stats();
+    }
+    else if (strncasecmp(qs, "STATS RESET", 11) == 0)
+    {
+        iostats_reset();
+    }
+    else if (strncasecmp(qs, "STATS", 5) == 0)
+    {
+        iostats_print_stats();
+    }
     else
     {
         printf("<p>ERROR: unknown command</p>\n");
     }
 
-    return 0;
+    // the statement's changes reach the table files before it returns
+    blockio_flush();
 }
 
 // CREATE TABLE
@@ -188,227 +677,481 @@ void handle_create(char *qs)
         }
     }
 
-    char cols_copy[512];
-    strncpy(cols_copy, cols, sizeof(cols_copy));
-    cols_copy[511] = '\0';
+    // the columns decide the row layout, which has to fit a block
+    struct schema schema;
+    char err[128];
+    if (!schema_parse(cols, &schema, err, sizeof(err)))
+    {
+        printf("<p>ERROR: %s</p>\n", err);
+        return;
+    }
 
-    char *col = strtok(cols_copy, ",");
-    while (col)
+    // under schema.db's lock from the check to the catalog, so two
+    // CREATEs of one table cannot both get through
+    catalog_lock();
+    if (catalog_table(tbl))
     {
-        char column_def[128];
-        strncpy(column_def, col, sizeof(column_def));
-        column_def[127] = '\0';
+        printf("<p>ERROR: table <b>%s</b> already exists</p>\n", tbl);
+        catalog_unlock();
+        return;
+    }
 
-        char *ptr = column_def;
-        while (*ptr && isspace((unsigned char)*ptr))
-            ptr++;
+    // the files are made first, and written out, so whoever finds the
+    // table in schema.db finds them too; leftovers from a dropped table
+    // go first
+    char datafile[80], idxfile[80];
+    snprintf(datafile, sizeof(datafile), "%s.data", tbl);
+    index_file(tbl, idxfile, sizeof(idxfile));
+    blockio_forget(datafile);
+    blockio_forget(idxfile);
+    unlink(datafile);
+    unlink(idxfile);
 
-        char *colon = strchr(ptr, ':');
-        if (!colon)
-        {
-            printf("<p>ERROR: bad CREATE syntax</p>\n");
-            return;
-        }
+    // fix: use block 0 for head, block 1 for first data
+    int head = alloc_block(datafile);  // block 0
+    int first = alloc_block(datafile); // block 1
+    set_next_block(datafile, head, first);
+    set_next_block(datafile, first, -1);
 
-        *colon = '\0';
-        char *name = ptr;
-        char *type = colon + 1;
+    // both blocks start out on the free list
+    struct table_header hdr = {0};
+    build_free_list(datafile, &schema, &hdr, 0);
+    char *blk0 = pin_block(datafile, head);
+    write_header(blk0, &hdr);
+    unpin_block(blk0, 1);
 
-        for (char *p = name; *p; p++)
-        {
-            if (!isalnum((unsigned char)*p) && *p != '_')
-            {
-                printf("<p>ERROR: invalid column name</p>\n");
-                return;
-            }
-        }
+    // and an empty id index if there is an integer id
+    int id = schema_column(&schema, "id");
+    if (id >= 0 && schema.col[id].type != COL_CHAR)
+        btree_create(idxfile);
+    blockio_flush();
 
-        if (strcmp(type, "smallint") == 0 || strcmp(type, "integer") == 0)
-        {
-            // ok
-        }
-        else if (strncmp(type, "char(", 5) == 0)
-        {
-            char *start = type + 5;
-            char *end = strchr(start, ')');
-            if (!end)
-            {
-                printf("<p>ERROR: bad type format in char(n)</p>\n");
-                return;
-            }
-            for (char *d = start; d < end; d++)
-            {
-                if (!isdigit((unsigned char)*d))
-                {
-                    printf("<p>ERROR: bad char(n) format</p>\n");
-                    return;
-                }
-            }
-        }
-        else
+    FILE *out = fopen(SCHEMA_FILE, "a");
+    if (!out)
+    {
+        printf("<p>ERROR: could not open schema file</p>\n");
+        catalog_unlock();
+        return;
+    }
+    fprintf(out, "%s|%s;\n", tbl, cols);
+    fclose(out);
+    catalog_reload();
+    catalog_unlock();
+
+    printf("<p>Created table <b>%s</b></p>\n", tbl);
+}
+
+// CREATE INDEX
+/*
+Builds a sorted index on one integer column: every row of the table
+goes into a new B+tree in <table>.<name>.idx, which INSERT, UPDATE and
+DELETE keep up to date from then on, and schema.db gets a line for it
+next to the table's
+*/
+void handle_create_index(char *qs)
+{
+    char name[64], tbl[64], column[64];
+
+    if (sscanf(qs, "CREATE INDEX %63[^ ] ON %63[^ (](%63[^)])", name, tbl, column) != 3)
+    {
+        printf("<p>ERROR: bad CREATE INDEX syntax</p>\n");
+        return;
+    }
+    for (char *p = name; *p; p++)
+    {
+        if (!isalnum((unsigned char)*p) && *p != '_')
         {
-            printf("<p>ERROR: unsupported type '%s'</p>\n", type);
+            printf("<p>ERROR: invalid index name</p>\n");
             return;
         }
+    }
 
-        col = strtok(NULL, ",");
+    struct schema schema;
+    char datafile[80];
+    if (!open_table(tbl, &schema, datafile, sizeof(datafile)))
+        return;
+
+    // the column has to be there, and hold integers
+    int col = schema_column(&schema, column);
+    if (col < 0)
+    {
+        printf("<p>ERROR: unknown column '%s'</p>\n", column);
+        return;
+    }
+    if (schema.col[col].type == COL_CHAR)
+    {
+        printf("<p>ERROR: column '%s' is not an integer column</p>\n", column);
+        return;
     }
 
-    FILE *fp = fopen(SCHEMA_FILE, "r");
-    if (fp)
+    // the index is built and published under the table's lock, so no
+    // row changes in between that it would miss, and writers, which
+    // look the indexes up under the lock, see it once they have it
+    int fd = lock_table(datafile);
+    struct index_def idx[MAX_INDEXES];
+    int nidx = load_indexes(tbl, idx);
+    for (int i = 0; i < nidx; i++)
     {
-        char line[512];
-        while (fgets(line, sizeof(line), fp))
+        if (strcmp(idx[i].name, name) == 0)
         {
-            if (strncmp(line, tbl, strlen(tbl)) == 0 && line[strlen(tbl)] == '|')
-            {
-                printf("<p>ERROR: table <b>%s</b> already exists</p>\n", tbl);
-                fclose(fp);
-                return;
-            }
+            printf("<p>ERROR: index <b>%s</b> already exists</p>\n", name);
+            unlock_table(fd);
+            return;
         }
-        fclose(fp);
+    }
+    if (nidx == MAX_INDEXES)
+    {
+        printf("<p>ERROR: too many indexes on <b>%s</b></p>\n", tbl);
+        unlock_table(fd);
+        return;
     }
 
+    // one walk over the table collects the entries, which are then
+    // sorted and built into the tree bottom up
+    char idxfile[136];
+    snprintf(idxfile, sizeof(idxfile), "%s.%s.idx", tbl, name);
+    int rows = 0, cap = 1024;
+    struct btree_entry *e = malloc(cap * sizeof(*e));
+    struct row_source src;
+    source_open(&src, datafile, &schema, NULL, 0, NULL);
+    char *row;
+    while ((row = source_next(&src)))
+    {
+        if (rows == cap)
+            e = realloc(e, (cap *= 2) * sizeof(*e));
+        e[rows++] = (struct btree_entry){row_int(&schema, row, col), src.b, src.slot};
+    }
+    source_close(&src);
+    btree_sort(e, rows);
+    blockio_forget(idxfile);
+    unlink(idxfile);
+    btree_build(idxfile, e, rows);
+    free(e);
+
+    catalog_lock();
     FILE *out = fopen(SCHEMA_FILE, "a");
     if (!out)
     {
         printf("<p>ERROR: could not open schema file</p>\n");
+        catalog_unlock();
+        unlock_table(fd);
         return;
     }
-    fprintf(out, "%s|%s;\n", tbl, cols);
+    fprintf(out, "idx:%s|%s|%s;\n", name, tbl, column);
     fclose(out);
+    catalog_reload();
+    catalog_unlock();
 
-    printf("<p>Created table <b>%s</b></p>\n", tbl);
-
-    char datafile[80];
-    snprintf(datafile, sizeof(datafile), "%s.data", tbl);
-
-    // fix: use block 0 for head, block 1 for first data
-    int head = alloc_block(datafile);  // block 0
-    int first = alloc_block(datafile); // block 1
-    set_next_block(datafile, head, first);
-    set_next_block(datafile, first, -1);
+    // cached SELECTs on the column would come out in another order now
+    bump_version(datafile);
+    unlock_table(fd);
+    printf("<p>Created index <b>%s</b> on <b>%s</b>(%s), %d rows</p>\n", name, tbl, column, rows);
 }
 
 // Insert
 /*
 Insert sql command
 first confirm table and schema exist, check value count matches schema,
-then formats and inserts the record into a free slot in a data block,
-if block is full, make a new block
+then encodes the rows (see schema.h) and puts them into free slots of
+data blocks, packing what does not fit into new blocks
 */
 
-// Insert into table
-void handle_insert(char *qs)
+/*
+Stores n rows under one table lock: first in the free slots of blocks
+on the free list, then packed into new blocks, built in memory and
+added to the end of the chain together
+*/
+static void store_rows(const char *tbl, const struct schema *s, const char *datafile,
+                       const char *rows, int n)
 {
-    char tbl[64], vals[512];
-
-    if (sscanf(qs, "INSERT INTO %63[^ ] VALUES(%511[^)])", tbl, vals) != 2)
+    // the indexes are looked up under the lock, so none is added meanwhile
+    int fd = lock_table(datafile);
+    struct index_def idx[MAX_INDEXES];
+    int nidx = load_indexes(tbl, idx);
+    int size = s->row_size;
+    char *blk0 = pin_block(datafile, 0);
+    struct table_header hdr;
+    read_header(blk0, &hdr);
+
+    int i = 0, slot;
+    while (i < n && hdr.free_head != -1)
     {
-        printf("<p>ERROR: bad INSERT syntax</p>\n");
-        return;
+        int b = hdr.free_head;
+        char *blk = pin_block(datafile, b);
+        while (i < n && (slot = empty_slot(s, blk)) >= 0)
+        {
+            memcpy(blk + slot * size, rows + i * size, size);
+            index_row(s, idx, nidx, rows + i++ * size, b, slot);
+        }
+        if (empty_slot(s, blk) < 0) // full now, so it comes off the list
+        {
+            hdr.free_head = free_link(blk) - 2;
+            set_free_link(blk, 0);
+        }
+        unpin_block(blk, 1);
     }
 
-    char schema[512];
-    if (!load_schema_from_file(tbl, schema, sizeof(schema)))
+    if (i < n)
     {
-        printf("<p>ERROR: table <b>%s</b> does not exist</p>\n", tbl);
-        return;
+        int nnew = (n - i + s->slots - 1) / s->slots;
+        int *blocks = malloc(nnew * sizeof(int));
+        alloc_blocks(datafile, nnew, blocks);
+        for (int j = 0; j < nnew; j++)
+        {
+            _Alignas(8) char buf[BLOCK_SIZE] = {0};
+            int32_t next = j + 1 < nnew ? blocks[j + 1] : -1;
+            for (slot = 0; slot < s->slots && i < n; slot++, i++)
+            {
+                memcpy(buf + slot * size, rows + i * size, size);
+                index_row(s, idx, nidx, rows + i * size, blocks[j], slot);
+            }
+            if (slot < s->slots) // the last one may have room left
+                push_free(&hdr, blocks[j], buf);
+            memcpy(buf + BLOCK_SIZE - sizeof(next), &next, sizeof(next));
+            write_block(datafile, blocks[j], buf);
+        }
+        set_next_block(datafile, hdr.tail, blocks[0]);
+        hdr.tail = blocks[nnew - 1];
+        free(blocks);
     }
 
-    char datafile[80];
-    snprintf(datafile, sizeof(datafile), "%s.data", tbl);
-    struct stat st;
-    if (stat(datafile, &st) < 0)
-    {
-        printf("<p>ERROR: table <b>%s</b> does not exist</p>\n", tbl);
-        return;
-    }
+    hdr.version++;
+    write_header(blk0, &hdr);
+    unpin_block(blk0, 1);
+    unlock_table(fd);
+}
 
-    // Count expected fields
-    int expected_fields = 1;
-    for (char *p = schema; *p; p++)
+// Insert into table: INSERT INTO t VALUES(...) or VALUES(...),(...),...
+void handle_insert(char *qs)
+{
+    char tbl[64];
+    int n = 0;
+
+    // split the tuples out first, so bad syntax anywhere inserts nothing
+    sscanf(qs, "INSERT INTO %63[^ ] VALUES%n", tbl, &n);
+    char *p = qs + n;
+    int ntuples = 0, cap = 16, bad = (n == 0);
+    char **tuples = malloc(cap * sizeof(char *));
+    while (!bad)
     {
-        if (*p == ',')
-            expected_fields++;
+        while (isspace((unsigned char)*p))
+            p++;
+        char *end = *p == '(' ? strchr(p, ')') : NULL;
+        if (!end || end == p + 1)
+        {
+            bad = 1;
+            break;
+        }
+        if (ntuples == cap)
+            tuples = realloc(tuples, (cap *= 2) * sizeof(char *));
+        tuples[ntuples++] = p + 1;
+        *end = '\0';
+        for (p = end + 1; isspace((unsigned char)*p); p++)
+            ;
+        if (*p != ',')
+            break;
+        p++;
     }
-
-    int provided_fields = 1;
-    for (char *p = vals; *p; p++)
+    if (bad || *p != '\0')
     {
-        if (*p == ',')
-            provided_fields++;
+        printf("<p>ERROR: bad INSERT syntax</p>\n");
+        free(tuples);
+        return;
     }
 
-    if (provided_fields != expected_fields)
+    struct schema schema;
+    char datafile[80];
+    if (!open_table(tbl, &schema, datafile, sizeof(datafile)))
     {
-        printf("<p>ERROR: expected %d values, got %d</p>\n", expected_fields, provided_fields);
+        free(tuples);
         return;
     }
 
-    int id, length;
-    char title[128];
-    if (sscanf(vals, "%d,%127[^,],%d", &id, title, &length) != 3)
+    // every tuple is checked; the good ones go in together
+    char *rows = malloc(ntuples * schema.row_size), err[128];
+    int *ok = malloc(ntuples * sizeof(int)), nrows = 0;
+    for (int i = 0; i < ntuples; i++)
     {
-        printf("<p>ERROR: bad INSERT values</p>\n");
-        return;
+        ok[i] = row_encode(&schema, tuples[i], rows + nrows * schema.row_size, err, sizeof(err));
+        if (!ok[i] && ntuples > 1)
+            printf("<p>ERROR: row %d: %s</p>\n", i + 1, err);
+        else if (!ok[i])
+            printf("<p>ERROR: %s</p>\n", err);
+        nrows += ok[i];
     }
+    if (nrows > 0)
+        store_rows(tbl, &schema, datafile, rows, nrows);
+    for (int i = 0; i < ntuples; i++)
+    {
+        if (ok[i])
+            printf("<p>Inserted into <b>%s</b></p>\n", tbl);
+    }
+    free(rows);
+    free(ok);
+    free(tuples);
+}
 
-    // Format record
-    char record[RECORD_SIZE] = {0};
-
-    char idstr[5];
-    snprintf(idstr, sizeof(idstr), "%04d", id);
-    memcpy(record, idstr, 4);
+// COPY
+/*
+Bulk load from a file on the server, one row per line written like the
+inside of a VALUES tuple (1,Avatar,162). Lines are read through a
+large stdio buffer and encoded as INSERT would, then packed into whole
+new blocks, COPY_CHUNK of them at a time, which are already linked to
+the next and go out with one write each; the chain only gets linked in
+at the old tail at the end. Index entries are collected on the way and
+each index is built again bottom up with them. Bad lines are reported
+and skipped
+*/
 
-    char titlestr[30];
-    memset(titlestr, ' ', sizeof(titlestr));
-    strncpy(titlestr, title, sizeof(titlestr));
-    memcpy(record + 4, titlestr, 30);
+#define COPY_CHUNK 4096 // blocks per write, 1 MiB
 
-    char lengthstr[9];
-    snprintf(lengthstr, sizeof(lengthstr), "%08d", length);
-    memcpy(record + 34, lengthstr, 8);
+long sql_copy(const char *tbl, const char *path)
+{
+    struct schema schema;
+    char datafile[80];
+    if (!open_table(tbl, &schema, datafile, sizeof(datafile)))
+        return -1;
+    int size = schema.row_size;
 
-    // Follow chaining starting from block 0
-    int b = 0;
-    while (1)
+    FILE *in = fopen(path, "r");
+    if (!in)
     {
-        char buf[BLOCK_SIZE];
-        read_block(datafile, b, buf);
+        printf("<p>ERROR: cannot open <b>%s</b></p>\n", path);
+        return -1;
+    }
+    setvbuf(in, NULL, _IOFBF, 1 << 20);
+
+    int fd = lock_table(datafile);
+    struct index_def idx[MAX_INDEXES];
+    int nidx = load_indexes(tbl, idx), cap = 1024;
+    struct btree_entry *entries[MAX_INDEXES];
+    for (int i = 0; i < nidx; i++)
+        entries[i] = malloc(cap * sizeof(struct btree_entry));
+
+    char *blk0 = pin_block(datafile, 0);
+    struct table_header hdr;
+    read_header(blk0, &hdr);
+
+    // blocks go on at the end of the file: chunk holds nb of them, the
+    // first being block first
+    char *chunk = malloc((size_t)COPY_CHUNK * BLOCK_SIZE);
+    int first = blockio_size(datafile), nb = 0, slot = schema.slots;
+    long rows = 0, lineno = 0;
+    const int start = first;
+    char line[512], err[128];
+    _Alignas(8) char row[SCHEMA_ROW_BYTES];
+    while (fgets(line, sizeof(line), in))
+    {
+        lineno++;
+        if (!strchr(line, '\n') && !feof(in))
+        {
+            // the rest of it is skipped, not read as the next line
+            int c;
+            while ((c = getc(in)) != EOF && c != '\n')
+                ;
+            printf("<p>ERROR: line %ld: longer than %d bytes</p>\n", lineno, (int)sizeof(line) - 2);
+            continue;
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0')
+            continue;
+        if (!row_encode(&schema, line, row, err, sizeof(err)))
+        {
+            printf("<p>ERROR: line %ld: %s</p>\n", lineno, err);
+            continue;
+        }
 
-        // Try to find empty spot
-        for (int off = 0; off + RECORD_SIZE <= BLOCK_SIZE - 4; off += RECORD_SIZE)
+        if (slot == schema.slots) // a new block, linked to the one after
         {
-            if (buf[off] == '\0')
+            if (nb == COPY_CHUNK)
             {
-                memcpy(buf + off, record, RECORD_SIZE);
-                write_block(datafile, b, buf);
-                printf("<p>Inserted into <b>%s</b></p>\n", tbl);
-                return;
+                write_blocks(datafile, first, nb, chunk);
+                first += nb;
+                nb = 0;
             }
+            char *blk = chunk + (size_t)nb * BLOCK_SIZE;
+            int32_t next = first + nb + 1;
+            memset(blk, 0, BLOCK_SIZE);
+            memcpy(blk + BLOCK_SIZE - sizeof(next), &next, sizeof(next));
+            nb++;
+            slot = 0;
+        }
+        memcpy(chunk + (size_t)(nb - 1) * BLOCK_SIZE + slot * size, row, size);
+        if (rows + 1 == cap)
+        {
+            cap *= 2;
+            for (int i = 0; i < nidx; i++)
+                entries[i] = realloc(entries[i], cap * sizeof(struct btree_entry));
         }
+        for (int i = 0; i < nidx; i++)
+            entries[i][rows] = (struct btree_entry){row_int(&schema, row, idx[i].col), first + nb - 1, slot};
+        slot++;
+        rows++;
+    }
+    fclose(in);
 
-        // No space in this block, check next
-        int next = get_next_block(datafile, b);
-        if (next == -1)
+    if (rows > 0)
+    {
+        // the last block ends the chain, and takes INSERTs if it has room
+        char *last = chunk + (size_t)(nb - 1) * BLOCK_SIZE;
+        int32_t end = -1;
+        memcpy(last + BLOCK_SIZE - sizeof(end), &end, sizeof(end));
+        if (slot < schema.slots)
+            push_free(&hdr, first + nb - 1, last);
+        write_blocks(datafile, first, nb, chunk);
+        set_next_block(datafile, hdr.tail, start);
+        hdr.tail = first + nb - 1;
+
+        for (int i = 0; i < nidx; i++)
         {
-            // No next block, need to allocate
-            int newb = alloc_block(datafile);
-            set_next_block(datafile, b, newb);
+            int icap = cap;
+            rebuild_index(idx[i].file, &entries[i], rows, &icap);
+        }
+        hdr.version++;
+        write_header(blk0, &hdr);
+    }
+    unpin_block(blk0, rows > 0);
+    unlock_table(fd);
+    free(chunk);
+    for (int i = 0; i < nidx; i++)
+        free(entries[i]);
+
+    printf("<p>Copied %ld rows into <b>%s</b></p>\n", rows, tbl);
+    return rows;
+}
 
-            char newbuf[BLOCK_SIZE] = {0};
-            memcpy(newbuf, record, RECORD_SIZE);
-            write_block(datafile, newb, newbuf);
-            set_next_block(datafile, newb, -1);
+/*
+COPY <table> FROM '<path>'
+The statement comes from any HTTP client, so the file has to be under
+the data directory (the current one): no absolute paths or .., and no
+symlink out of it. sqlload, run by hand, calls sql_copy with any path
+*/
+void handle_copy(char *qs)
+{
+    char tbl[64], path[512];
 
-            printf("<p>Inserted into <b>%s</b></p>\n", tbl);
-            return;
-        }
+    if (sscanf(qs, "COPY %63[^ ] FROM '%511[^']'", tbl, path) != 2)
+    {
+        printf("<p>ERROR: bad COPY syntax</p>\n");
+        return;
+    }
+    if (path[0] == '/' || strcmp(path, "..") == 0 || strncmp(path, "../", 3) == 0 ||
+        strstr(path, "/../") || (strlen(path) >= 3 && strcmp(path + strlen(path) - 3, "/..") == 0))
+    {
+        printf("<p>ERROR: COPY reads files under the data directory only</p>\n");
+        return;
+    }
 
-        b = next; // Follow to next block
+    // the same answer for a file that is not there and one that resolves
+    // outside, so nothing is learned about files elsewhere
+    char dir[PATH_MAX], real[PATH_MAX];
+    size_t len = getcwd(dir, sizeof(dir)) ? strlen(dir) : 0;
+    if (!len || !realpath(path, real) || strncmp(real, dir, len) != 0 || real[len] != '/')
+    {
+        printf("<p>ERROR: cannot open <b>%s</b></p>\n", path);
+        return;
     }
+    sql_copy(tbl, real);
 }
 
 // SELECT
@@ -422,7 +1165,6 @@ void handle_select(char *qs)
 {
     // buffers
     char cols[128], tbl[64], cond[128];
-    char header_cols[128], data_cols[128];
 
     // query strings
     if (sscanf(qs, "SELECT %127[^ ] FROM %63[^ ] WHERE %127[^\r\n]", cols, tbl, cond) != 3)
@@ -431,16 +1173,6 @@ void handle_select(char *qs)
         return;
     }
 
-    // If SELECT * , default to all columns
-    if (strcmp(cols, "*") == 0)
-    {
-        strcpy(cols, "id,title,length");
-    }
-
-    // backup the column list for header and data output
-    strncpy(header_cols, cols, sizeof(header_cols));
-    strncpy(data_cols, cols, sizeof(data_cols));
-
     // validate table name (only allow alphabets and '_')
     for (char *p = tbl; *p; p++)
     {
@@ -451,182 +1183,95 @@ void handle_select(char *qs)
         }
     }
 
-    // load schema for table
-    char schema[512];
-    if (!load_schema_from_file(tbl, schema, sizeof(schema)))
-    {
-        printf("<p>ERROR: table <b>%s</b> does not exist</p>\n", tbl);
-        return;
-    }
-
-    // check datafile
+    struct schema schema;
     char datafile[80];
-    snprintf(datafile, sizeof(datafile), "%s.data", tbl);
-    struct stat st;
-    if (stat(datafile, &st) < 0)
-    {
-        printf("<p>ERROR: table <b>%s</b> does not exist</p>\n", tbl);
+    if (!open_table(tbl, &schema, datafile, sizeof(datafile)))
         return;
-    }
 
-    // parse and store valid field names from schema into array
-    char schema_copy[512];
-    strncpy(schema_copy, schema, sizeof(schema_copy));
-    char *valid_fields[16];
-    int fcount = 0;
-    char *tok = strtok(schema_copy, ",");
-    while (tok && fcount < 16)
+    // the requested columns, by index into the schema; * is all of them
+    int out[SCHEMA_MAX_COLS], nout = 0;
+    if (strcmp(cols, "*") == 0)
     {
-        char *colon = strchr(tok, ':');
-        if (colon)
-            *colon = '\0';
-        valid_fields[fcount++] = tok;
-        tok = strtok(NULL, ",");
+        for (nout = 0; nout < schema.ncols; nout++)
+            out[nout] = nout;
     }
-
-    // validate that requested columns exist in schema
-    char sel_copy[128];
-    strncpy(sel_copy, cols, sizeof(sel_copy));
-    char *col = strtok(sel_copy, ",");
-    while (col)
+    else
     {
-        while (*col == ' ')
-            col++;
-        int found = 0;
-        for (int i = 0; i < fcount; i++)
+        for (char *col = strtok(cols, ","); col; col = strtok(NULL, ","))
         {
-            if (strcmp(col, valid_fields[i]) == 0)
+            while (*col == ' ')
+                col++;
+            int c = schema_column(&schema, col);
+            if (c < 0)
             {
-                found = 1;
-                break;
+                printf("<p>ERROR: unknown column '%s'</p>\n", col);
+                return;
             }
+            if (nout < SCHEMA_MAX_COLS)
+                out[nout++] = c;
         }
-        if (!found)
-        {
-            printf("<p>ERROR: unknown column '%s'</p>\n", col);
-            return;
-        }
-        col = strtok(NULL, ",");
     }
 
-    // html output for table
-    printf("<table><tr>");
-    col = strtok(header_cols, ",");
-    while (col)
-    {
-        while (*col == ' ')
-            col++;
-        printf("<th>%s</th>", col);
-        col = strtok(NULL, ",");
-    }
-    printf("</tr>\n");
+    struct where w;
+    if (!parse_where(&schema, cond, &w))
+        return;
 
-    // detect and parse WHERE operator and operands
-    char *op = NULL;
-    if (strstr(cond, "!="))
-        op = "!=";
-    else if (strstr(cond, "<"))
-        op = "<";
-    else if (strstr(cond, ">"))
-        op = ">";
-    else if (strstr(cond, "="))
-        op = "=";
-    else
+    // serve the rendered result from the cache if the table did not change
+    char key[MAXQS];
+    sqlcache_normalize(qs, key, sizeof(key));
+    uint32_t version = table_version(datafile);
+    size_t cached_len;
+    char *cached = sqlcache_get(key, version, &cached_len);
+    if (cached)
     {
-        printf("<p>ERROR: unknown operator</p>\n");
+        fwrite(cached, 1, cached_len, stdout);
+        free(cached);
         return;
     }
+    if (sqlcache_enabled)
+        capture_start();
 
-    // parse WHERE condition(field and value)
-    char field[64], value[64];
-    if (strcmp(op, "!=") == 0)
-        sscanf(cond, "%63[^!]!=%63s", field, value);
-    else
-        sscanf(cond, "%63[^<>=]%*c%63s", field, value);
-    int where_target = atoi(value); // assume numeric comparison
-
-    // iterate through all blocks(start from block 0)
-    int b = 0;
-    while (b != -1)
+    // html output for table
+    select_printf("<table><tr>");
+    for (int i = 0; i < nout; i++)
+        select_printf("<th>%s</th>", schema.col[out[i]].name);
+    select_printf("</tr>\n");
+
+    // visit the rows the WHERE clause can match, reading each in place
+    struct index_def idx[MAX_INDEXES];
+    int nidx = load_indexes(tbl, idx);
+    struct row_source src;
+    source_open(&src, datafile, &schema, idx, nidx, &w);
+    char *row;
+    while ((row = source_next(&src)))
     {
-        char buf[BLOCK_SIZE];
-        read_block(datafile, b, buf);
+        if (!where_match(&schema, &w, row))
+            continue;
 
-        for (int offset = 0; offset + RECORD_SIZE <= BLOCK_SIZE - 4; offset += RECORD_SIZE)
+        // print matching row
+        select_printf("<tr>");
+        for (int i = 0; i < nout; i++)
         {
-            char idstr[5] = {0};
-            strncpy(idstr, buf + offset, 4);
-            if (idstr[0] == '\0')
-                continue;
-
-            char titlestr[31] = {0};
-            char lengthstr[9] = {0};
-            strncpy(titlestr, buf + offset + 4, 30);
-            strncpy(lengthstr, buf + offset + 34, 8);
-
-            int id = atoi(idstr);
-            int length = atoi(lengthstr);
-
-            int match = 0;
-            if (strcmp(field, "id") == 0)
-            {
-                if (!strcmp(op, "="))
-                    match = (id == where_target);
-                else if (!strcmp(op, "<"))
-                    match = (id < where_target);
-                else if (!strcmp(op, ">"))
-                    match = (id > where_target);
-                else if (!strcmp(op, "!="))
-                    match = (id != where_target);
-            }
-            else if (strcmp(field, "length") == 0)
-            {
-                if (!strcmp(op, "="))
-                    match = (length == where_target);
-                else if (!strcmp(op, "<"))
-                    match = (length < where_target);
-                else if (!strcmp(op, ">"))
-                    match = (length > where_target);
-                else if (!strcmp(op, "!="))
-                    match = (length != where_target);
-            }
-
-            if (!match)
-                continue;
-
-            // trim spaces from title
-            for (int i = strlen(titlestr) - 1; i >= 0; i--)
-            {
-                if (titlestr[i] == ' ')
-                    titlestr[i] = '\0';
-                else
-                    break;
-            }
-
-            // print matching row
-            printf("<tr>");
-            char data_cols_copy[128];
-            strncpy(data_cols_copy, data_cols, sizeof(data_cols_copy));
-            char *col = strtok(data_cols_copy, ",");
-            while (col)
-            {
-                while (*col == ' ')
-                    col++;
-                if (!strcmp(col, "id"))
-                    printf("<td>%d</td>", id);
-                else if (!strcmp(col, "title"))
-                    printf("<td>%s</td>", titlestr);
-                else if (!strcmp(col, "length"))
-                    printf("<td>%d</td>", length);
-                col = strtok(NULL, ",");
-            }
-            printf("</tr>\n");
+            int c = out[i];
+            if (schema.col[c].type == COL_CHAR)
+                select_printf("<td>%.*s</td>", schema.col[c].size, row_chars(&schema, row, c));
+            else
+                select_printf("<td>%d</td>", row_int(&schema, row, c));
         }
+        select_printf("</tr>\n");
+        select_row_done();
+    }
+    source_close(&src);
+    select_printf("</table>\n");
 
-        // move to next block in the chain
-        b = get_next_block(datafile, b);
+    // remember the result for this table version
+    size_t result_len;
+    char *result = capture_finish(&result_len);
+    if (result)
+    {
+        sqlcache_put(key, version, result, result_len);
+        free(result);
     }
-    printf("</table>\n");
 }
 
 // UPDATE
@@ -654,160 +1299,67 @@ void handle_update(char *qs)
         return;
     }
 
-    // load the table schema to validate if fields exists
-    char schema[512];
-    if (!load_schema_from_file(tbl, schema, sizeof(schema)))
-    {
-        printf("<p>ERROR: table <b>%s</b> does not exist</p>\n", tbl);
+    struct schema schema;
+    char datafile[80];
+    if (!open_table(tbl, &schema, datafile, sizeof(datafile)))
         return;
-    }
-
-    // copy schema for parsing valid fields
-    char schema_copy[512];
-    strncpy(schema_copy, schema, sizeof(schema_copy));
-    char *valid_fields[16];
-    int fcount = 0;
-    char *tok = strtok(schema_copy, ",");
-    while (tok && fcount < 16)
-    {
-        char *colon = strchr(tok, ':');
-        if (colon)
-            *colon = '\0';
-        valid_fields[fcount++] = tok;
-        tok = strtok(NULL, ",");
-    }
 
     // Validate that the field exists in schema
-
-    int valid = 0;
-    for (int i = 0; i < fcount; i++)
-    {
-        if (strcmp(field, valid_fields[i]) == 0)
-        {
-            valid = 1;
-            break;
-        }
-    }
-    if (!valid)
+    int set = schema_column(&schema, field);
+    if (set < 0)
     {
         printf("<p>ERROR: unknown column '%s'</p>\n", field);
         return;
     }
 
-    // makes sure the tables data file exists
-    char datafile[80];
-    snprintf(datafile, sizeof(datafile), "%s.data", tbl);
-    struct stat st;
-    if (stat(datafile, &st) < 0)
-    {
-        printf("<p>ERROR: table <b>%s</b> does not exist</p>\n", tbl);
+    struct where w;
+    if (!parse_where(&schema, cond, &w))
         return;
-    }
-
-    // WHERE condition to extract field and target value
 
-    char *op = NULL;
-    if (strstr(cond, "!="))
-        op = "!=";
-    else if (strstr(cond, "<"))
-        op = "<";
-    else if (strstr(cond, ">"))
-        op = ">";
-    else if (strstr(cond, "="))
-        op = "=";
-    else
+    // the new value is encoded once, and copied into each row
+    _Alignas(8) char newrow[SCHEMA_ROW_BYTES];
+    char err[128];
+    const struct column *sc = &schema.col[set];
+    if (!row_set(&schema, newrow, set, newval, err, sizeof(err)))
     {
-        printf("<p>ERROR: unknown operator</p>\n");
+        printf("<p>ERROR: %s</p>\n", err);
         return;
     }
 
-    char where_field[64], where_value[64];
-    if (strcmp(op, "!=") == 0)
-        sscanf(cond, "%63[^!]!=%63s", where_field, where_value);
-    else
-        sscanf(cond, "%63[^<>=]%*c%63s", where_field, where_value);
-
-    int where_target = atoi(where_value);
+    // the rows are visited and changed in place under the lock, so
+    // another writer's changes are not overwritten, and no index is
+    // added meanwhile
+    int fd = lock_table(datafile);
 
-    // iterate through all blocks(start from block 0)
-    int b = 0;
-    while (b != -1)
+    // the indexes on the column being set change along with its rows
+    struct index_def idx[MAX_INDEXES], touched[MAX_INDEXES];
+    int nidx = load_indexes(tbl, idx), ntouched = 0;
+    for (int i = 0; i < nidx; i++)
     {
-        char buf[BLOCK_SIZE];
-        read_block(datafile, b, buf);
-        int dirty = 0;
-
-        for (int offset = 0; offset + RECORD_SIZE <= BLOCK_SIZE - 4; offset += RECORD_SIZE)
-        {
-            char idstr[5] = {0};
-            strncpy(idstr, buf + offset, 4);
-            if (idstr[0] == '\0')
-                continue;
-
-            char titlestr[31] = {0};
-            char lengthstr[9] = {0};
-            strncpy(titlestr, buf + offset + 4, 30);
-            strncpy(lengthstr, buf + offset + 34, 8);
-
-            int id = atoi(idstr);
-            int length = atoi(lengthstr);
-
-            int match = 0;
-            if (strcmp(where_field, "id") == 0)
-            {
-                if (!strcmp(op, "="))
-                    match = (id == where_target);
-                else if (!strcmp(op, "<"))
-                    match = (id < where_target);
-                else if (!strcmp(op, ">"))
-                    match = (id > where_target);
-                else if (!strcmp(op, "!="))
-                    match = (id != where_target);
-            }
-            else if (strcmp(where_field, "length") == 0)
-            {
-                if (!strcmp(op, "="))
-                    match = (length == where_target);
-                else if (!strcmp(op, "<"))
-                    match = (length < where_target);
-                else if (!strcmp(op, ">"))
-                    match = (length > where_target);
-                else if (!strcmp(op, "!="))
-                    match = (length != where_target);
-            }
-
-            if (!match)
-                continue;
-
-            if (strcmp(field, "title") == 0)
-            {
-                char padded[31];
-                memset(padded, ' ', 30);
-                padded[30] = '\0';
-                strncpy(padded, newval, strlen(newval));
-                memcpy(buf + offset + 4, padded, 30);
-                dirty = 1;
-            }
-            else if (strcmp(field, "length") == 0)
-            {
-                char len_update[9];
-                snprintf(len_update, sizeof(len_update), "%08d", atoi(newval));
-                memcpy(buf + offset + 34, len_update, 8);
-                dirty = 1;
-            }
-            else
-            {
-                printf("<p>ERROR: unknown column %s</p>\n", field);
-                return;
-            }
-        }
+        if (idx[i].col == set)
+            touched[ntouched++] = idx[i];
+    }
 
-        if (dirty)
-            write_block(datafile, b, buf);
+    // visit the rows the WHERE clause can match, changing them in place
+    struct row_source src;
+    int changed = 0;
+    source_open(&src, datafile, &schema, idx, nidx, &w);
+    char *row;
+    while ((row = source_next(&src)))
+    {
+        if (!where_match(&schema, &w, row))
+            continue;
 
-        b = get_next_block(datafile, b); // move to next block
+        unindex_row(&schema, touched, ntouched, row, src.b, src.slot);
+        memcpy(row + sc->offset, newrow + sc->offset, sc->size);
+        index_row(&schema, touched, ntouched, row, src.b, src.slot);
+        src.dirty = changed = 1;
     }
+    source_close(&src);
 
+    if (changed)
+        bump_version(datafile);
+    unlock_table(fd);
     printf("<p>Update done on <b>%s</b></p>\n", tbl);
 }
 
@@ -827,108 +1379,68 @@ void handle_delete(char *qs)
         return;
     }
 
-    // check table exist in schema
-    char schema[512];
-    if (!load_schema_from_file(tbl, schema, sizeof(schema)))
-    {
-        printf("<p>ERROR: table <b>%s</b> does not exist</p>\n", tbl);
-        return;
-    }
-
-    // check for data file
+    struct schema schema;
     char datafile[80];
-    snprintf(datafile, sizeof(datafile), "%s.data", tbl);
-    struct stat st;
-    if (stat(datafile, &st) < 0)
-    {
-        printf("<p>ERROR: table <b>%s</b> does not exist</p>\n", tbl);
+    if (!open_table(tbl, &schema, datafile, sizeof(datafile)))
         return;
-    }
 
-    // WHERE condition
-    char *op = NULL;
-    if (strstr(cond, "!="))
-        op = "!=";
-    else if (strstr(cond, "<"))
-        op = "<";
-    else if (strstr(cond, ">"))
-        op = ">";
-    else if (strstr(cond, "="))
-        op = "=";
-    else
-    {
-        printf("<p>ERROR: unknown operator</p>\n");
+    struct where w;
+    if (!parse_where(&schema, cond, &w))
         return;
-    }
 
-    // Extract field and value from WHERE conditon
-
-    char where_field[64], where_value[64];
-    if (strcmp(op, "!=") == 0)
-        sscanf(cond, "%63[^!]!=%63s", where_field, where_value);
-    else
-        sscanf(cond, "%63[^<>=]%*c%63s", where_field, where_value);
-
-    int where_target = atoi(where_value); // convert string to integer for comparison
-
-    // iterate through all data blocks in the table file (start from block 0)
-    int b = 0;
-    while (b != -1)
+    // the rows, their index entries, the free list and the version all
+    // change under the lock
+    int fd = lock_table(datafile);
+    struct index_def idx[MAX_INDEXES];
+    int nidx = load_indexes(tbl, idx);
+
+    // blocks that got an empty slot, for the free list, and whether one
+    // lost its last row
+    int *freed = NULL, nfreed = 0, freed_cap = 0, emptied = 0;
+
+    // visit the rows the WHERE clause can match, clearing them in place
+    struct row_source src;
+    int changed = 0;
+    source_open(&src, datafile, &schema, idx, nidx, &w);
+    char *row;
+    while ((row = source_next(&src)))
     {
-        char buf[BLOCK_SIZE];
-        int dirty = 0;
-        read_block(datafile, b, buf);
-
-        for (int off = 0; off + RECORD_SIZE <= BLOCK_SIZE - 4; off += RECORD_SIZE)
+        if (where_match(&schema, &w, row))
         {
-            char idstr[5] = {0};
-            strncpy(idstr, buf + off, 4);
-            if (idstr[0] == '\0')
-                continue;
-
-            char lengthstr[9] = {0};
-            strncpy(lengthstr, buf + off + 34, 8);
-
-            int id = atoi(idstr);
-            int length = atoi(lengthstr);
-
-            int match = 0;
-            if (strcmp(where_field, "id") == 0)
-            {
-                if (!strcmp(op, "="))
-                    match = (id == where_target);
-                else if (!strcmp(op, "<"))
-                    match = (id < where_target);
-                else if (!strcmp(op, ">"))
-                    match = (id > where_target);
-                else if (!strcmp(op, "!="))
-                    match = (id != where_target);
-            }
-            else if (strcmp(where_field, "length") == 0)
-            {
-                if (!strcmp(op, "="))
-                    match = (length == where_target);
-                else if (!strcmp(op, "<"))
-                    match = (length < where_target);
-                else if (!strcmp(op, ">"))
-                    match = (length > where_target);
-                else if (!strcmp(op, "!="))
-                    match = (length != where_target);
-            }
-
-            if (match)
+            unindex_row(&schema, idx, nidx, row, src.b, src.slot);
+            memset(row, 0, schema.row_size);
+            src.dirty = changed = 1;
+            if (free_link(src.blk) == 0 && (nfreed == 0 || freed[nfreed - 1] != src.b))
             {
-                memset(buf + off, 0, RECORD_SIZE);
-                dirty = 1;
+                if (nfreed == freed_cap)
+                    freed = realloc(freed, (freed_cap = 2 * freed_cap + 16) * sizeof(int));
+                freed[nfreed++] = src.b;
             }
+            if (src.b != 0 && block_empty(&schema, src.blk))
+                emptied = 1;
         }
-
-        if (dirty)
-            write_block(datafile, b, buf);
-
-        b = get_next_block(datafile, b); // follow the chain
     }
+    source_close(&src);
 
+    if (changed)
+    {
+        char *blk0 = pin_block(datafile, 0);
+        struct table_header hdr;
+        read_header(blk0, &hdr);
+        if (emptied)
+            build_free_list(datafile, &schema, &hdr, 1);
+        for (int i = 0; i < nfreed && !emptied; i++)
+        {
+            char *blk = pin_block(datafile, freed[i]);
+            push_free(&hdr, freed[i], blk);
+            unpin_block(blk, 1);
+        }
+        hdr.version++;
+        write_header(blk0, &hdr);
+        unpin_block(blk0, 1);
+    }
+    unlock_table(fd);
+    free(freed);
     printf("<p>Deleted matching rows in <b>%s</b></p>\n", tbl);
 }
 
@@ -948,72 +1460,70 @@ void handle_dump(char *qs)
         return;
     }
 
-    // load schema
-    char schema[512];
-    if (!load_schema_from_file(tbl, schema, sizeof(schema)))
-    {
-        printf("<p>ERROR: table <b>%s</b> does not exist</p>\n", tbl);
+    // load schema, and check the data exists
+    struct schema schema;
+    char datafile[80];
+    if (!open_table(tbl, &schema, datafile, sizeof(datafile)))
         return;
-    }
 
     // header infos
     printf("<h2>System Dump for Table: <b>%s</b></h2>\n", tbl);
     printf("<pre>\n");
-    printf("Schema: %s\n", schema);
-
-    // check if data exists
-    char datafile[80];
-    snprintf(datafile, sizeof(datafile), "%s.data", tbl);
-
-    struct stat st;
-    if (stat(datafile, &st) < 0)
+    printf("Schema: ");
+    for (int c = 0; c < schema.ncols; c++)
     {
-        printf("ERROR: could not stat data file\n</pre>");
-        return;
+        printf("%s%s:", c ? "," : "", schema.col[c].name);
+        if (schema.col[c].type == COL_CHAR)
+            printf("char(%d)", schema.col[c].size);
+        else
+            printf("%s", schema.col[c].type == COL_SMALLINT ? "smallint" : "integer");
     }
+    printf("\n");
+    printf("Row size: %d bytes, %d rows per block\n", schema.row_size, schema.slots);
+
+    struct table_header hdr;
+    char *blk0 = pin_block(datafile, 0);
+    read_header(blk0, &hdr);
+    unpin_block(blk0, 0);
+    printf("Version: %u\n", hdr.version);
+    printf("Free list head: %d, last block: %d\n", hdr.free_head, hdr.tail);
+    printf("Free blocks: %d\n", blockio_free_count(datafile));
 
     // walk the block chain through starting at block 0 
+    blockio_advise_scan(datafile);
     int b = 0;
     while (b != -1)
     {
-        char buf[BLOCK_SIZE];
-        read_block(datafile, b, buf);
+        char *buf = pin_block(datafile, b);
         printf("Block #%d:\n", b);
 
         // record the record in the block
-        for (int off = 0; off + RECORD_SIZE <= BLOCK_SIZE - 4; off += RECORD_SIZE)
+        for (int slot = 0; slot < schema.slots; slot++)
         {
+            const char *row = buf + slot * schema.row_size;
+
             // empty slot check
-            if (buf[off] == '\0')
+            if (!row_used(row))
             {
                 printf("  [empty slot]\n");
                 continue;
             }
 
-            // buffers for field strings
-            char idstr[5] = {0};
-            char titlestr[31] = {0};
-            char lengthstr[9] = {0};
-
-            // copy from buffer
-            strncpy(idstr, buf + off, 4);
-            strncpy(titlestr, buf + off + 4, 30);
-            strncpy(lengthstr, buf + off + 34, 8);
-
-            // trimming
-            for (int i = strlen(titlestr) - 1; i >= 0; i--)
+            // print content
+            printf(" ");
+            for (int c = 0; c < schema.ncols; c++)
             {
-                if (titlestr[i] == ' ')
-                    titlestr[i] = '\0';
+                printf("%s %s: ", c ? "," : "", schema.col[c].name);
+                if (schema.col[c].type == COL_CHAR)
+                    printf("%.*s", schema.col[c].size, row_chars(&schema, row, c));
                 else
-                    break;
+                    printf("%d", row_int(&schema, row, c));
             }
-            // print content
-            printf("  ID: %s, Title: %s, Length: %s\n", idstr, titlestr, lengthstr);
+            printf("\n");
         }
 
         // move to the next block
-
+        unpin_block(buf, 0);
         int next = get_next_block(datafile, b);
         printf("Next block: %d\n\n", next);
         b = next;
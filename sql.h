@@ -0,0 +1,26 @@
+#ifndef SQL_H
+#define SQL_H
+
+// the storage engine behind sql.cgi; sql_main.c is the CGI front end and
+// sqlbench.c drives it directly
+
+#define MAXQS 8192
+
+// SELECT output is pushed to the server every sql_flush_rows rows or
+// sql_flush_bytes bytes, whichever comes first (0 turns a limit off)
+extern long sql_flush_rows, sql_flush_bytes;
+
+// decodes a url encoded string
+void url_decode(char *dst, const char *src);
+
+// COPY tbl FROM 'path' without going through a statement, for the
+// sqlload tool; messages are HTML on stdout as for any statement.
+// path can be anywhere, unlike in the COPY statement, which only reads
+// files under the data directory.
+// Returns the rows loaded, -1 if the table or file is not there
+long sql_copy(const char *tbl, const char *path);
+
+// run one decoded statement, writing its HTML result to stdout
+void sql_execute(char *qs);
+
+#endif // SQL_H
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "sqlcache.h"
+#include "sql.h"
+#include "iostats.h"
+#include "blockio.h"
+
+/*
+sql.cgi: decodes QUERY_STRING and runs it as one statement
+*/
+int main()
+{
+    // grab the raw QUERY_STRING
+    char *raw_qs = getenv("QUERY_STRING");
+
+    // flush limits, and a buffer big enough that stdio does not flush
+    // on its own before they are reached
+    char *env;
+    if ((env = getenv("SQL_FLUSH_ROWS")) != NULL)
+        sql_flush_rows = atol(env);
+    if ((env = getenv("SQL_FLUSH_BYTES")) != NULL)
+        sql_flush_bytes = atol(env);
+    size_t outsize = (sql_flush_bytes > 0 ? sql_flush_bytes : SQLCACHE_MAX_ENTRY) + MAXQS;
+    setvbuf(stdout, NULL, _IOFBF, outsize);
+
+    // SQL_MMAP maps the table files instead of going through the pool
+    if (getenv("SQL_MMAP"))
+        blockio_mmap = 1;
+
+    // CGI header
+    printf("Content-Type: text/html\r\n\r\n");
+
+    if (!raw_qs)
+    {
+        printf("<p>ERROR: no query string provided</p>\n");
+        return 1;
+    }
+
+    // decode it into buffer
+    char qs_buf[MAXQS];
+    url_decode(qs_buf, raw_qs);
+    sql_execute(qs_buf);
+
+    // what the statement cost in block I/O, shown on request and kept for STATS
+    if (getenv("SQL_IO_FOOTER"))
+        iostats_footer(&(struct blockio_stats){0});
+    iostats_save();
+
+    return 0;
+}
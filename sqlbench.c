@@ -0,0 +1,338 @@
+//
+// sqlbench: times the SQL engine directly, without the server or a CGI
+// fork in between.
+//
+//      sqlbench [-n rows] [-q queries] [-s sel,...] [-r seed] [-b batch] [-w] [-m] [-i] [-k] [-C]
+//
+// A movies-shaped table of -n rows (default 2000) is loaded into a fresh
+// temporary directory with INSERTs of -b rows each (default 1, and the
+// insert ops are statements, not rows), then each kind of statement runs
+// -q times (default 200) with random keys:
+//
+//   select_point        SELECT * ... WHERE id=K
+//   select_id@S         SELECT * ... WHERE id<K, K picked so a fraction
+//                       S of the rows match (one per -s selectivity)
+//   select_length@S     SELECT * ... WHERE length<L, likewise
+//   update_point        UPDATE ... SET length=V WHERE id=K
+//   update_id@S         UPDATE ... SET length=V WHERE id<K
+//   delete_point        DELETE ... WHERE id=K, each K once
+//   delete_id@S         DELETE ... WHERE id>K, once per selectivity,
+//                       largest last, on what the point deletes left
+//
+// Statement output is discarded. The SELECT cache is off unless -C is
+// given, so repeated SELECTs really scan. Like sql.cgi, which is a new
+// process per statement, every statement starts with an empty buffer
+// pool unless -w keeps it warm between them. -m maps the table files
+// instead (blockio_mmap), which -w then keeps mapped. -i puts an index
+// on length after the load. -k keeps the directory.
+//
+// Results go to stdout as one JSON object with, per statement kind,
+// ops/sec, latency percentiles, and per statement the block reads and
+// writes, file opens and time spent inside blockio.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "blockio.h"
+#include "sqlcache.h"
+#include "sql.h"
+#include "hist.h"
+
+#define MAX_SEL 8
+#define MAX_OPS (4 + 4 * MAX_SEL)
+#define MAX_ID 1000000 // any int32 works; this keeps a run reasonable
+#define MAX_BATCH 300 // rows per INSERT that still fit in MAXQS
+
+struct op_stats
+{
+    char name[32];
+    struct hist latency;
+    unsigned long ops;
+    struct blockio_stats io;
+    uint64_t ns;
+};
+
+static struct op_stats ops[MAX_OPS];
+static int nops;
+static FILE *report;
+static int warm;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct op_stats *op_new(const char *name)
+{
+    struct op_stats *st = &ops[nops++];
+    memset(st, 0, sizeof(*st));
+    snprintf(st->name, sizeof(st->name), "%s", name);
+    hist_init(&st->latency);
+    return st;
+}
+
+// format one statement, run it and charge its time and block I/O to st
+static void run(struct op_stats *st, const char *fmt, ...)
+{
+    char qs[MAXQS];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(qs, sizeof(qs), fmt, ap);
+    va_end(ap);
+
+    if (!warm)
+        blockio_close();
+    struct blockio_stats before = blockio_stats;
+    uint64_t start = now_ns();
+    sql_execute(qs);
+    fflush(stdout);
+    uint64_t ns = now_ns() - start;
+
+    hist_record(&st->latency, ns);
+    st->ns += ns;
+    st->ops++;
+    st->io.opens += blockio_stats.opens - before.opens;
+    st->io.reads += blockio_stats.reads - before.reads;
+    st->io.writes += blockio_stats.writes - before.writes;
+    st->io.ns += blockio_stats.ns - before.ns;
+    st->io.hits += blockio_stats.hits - before.hits;
+}
+
+static void print_op(struct op_stats *st, int last)
+{
+    struct hist *h = &st->latency;
+    double n = st->ops ? st->ops : 1;
+    fprintf(report, "  \"%s\": {\"ops\": %lu, \"ops_per_s\": %.1f, "
+            "\"latency_us\": {\"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, "
+            "\"p99\": %.1f, \"max\": %.1f}, "
+            "\"reads_per_op\": %.1f, \"writes_per_op\": %.1f, "
+            "\"opens_per_op\": %.1f, \"hits_per_op\": %.1f, \"io_us_per_op\": %.1f}%s\n",
+            st->name, st->ops, st->ns ? st->ops / (st->ns / 1e9) : 0,
+            hist_mean(h) / 1e3, hist_percentile(h, 50) / 1e3,
+            hist_percentile(h, 90) / 1e3, hist_percentile(h, 99) / 1e3,
+            h->max / 1e3, st->io.reads / n, st->io.writes / n,
+            st->io.opens / n, st->io.hits / n, st->io.ns / 1e3 / n, last ? "" : ",");
+}
+
+static int parse_sels(char *arg, double *sels)
+{
+    int n = 0;
+    for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ","))
+    {
+        if (n == MAX_SEL)
+            return -1;
+        sels[n] = atof(tok);
+        if (sels[n] <= 0 || sels[n] > 1)
+            return -1;
+        n++;
+    }
+    return n;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// remove path, and everything under it if it is a directory
+static void remove_tree(const char *path)
+{
+    DIR *d = opendir(path);
+    struct dirent *de;
+    while (d && (de = readdir(d)))
+    {
+        if (strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+        {
+            char sub[1024];
+            snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+            remove_tree(sub);
+        }
+    }
+    if (d)
+        closedir(d);
+    if (remove(path) < 0)
+        perror(path);
+}
+
+int main(int argc, char *argv[])
+{
+    int rows = 2000, queries = 200, batch = 1, keep = 0, length_index = 0, c;
+    unsigned int seed = 1, first_seed;
+    double sels[MAX_SEL] = {0.01, 0.1, 0.5};
+    int nsels = 3;
+    char sel_arg[256] = "";
+
+    sqlcache_enabled = 0;
+    while ((c = getopt(argc, argv, "n:q:s:r:b:wmikC")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            rows = atoi(optarg);
+            break;
+        case 'q':
+            queries = atoi(optarg);
+            break;
+        case 's':
+            snprintf(sel_arg, sizeof(sel_arg), "%s", optarg);
+            nsels = parse_sels(sel_arg, sels);
+            break;
+        case 'r':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            break;
+        case 'w':
+            warm = 1;
+            break;
+        case 'm':
+            blockio_mmap = 1;
+            break;
+        case 'i':
+            length_index = 1;
+            break;
+        case 'k':
+            keep = 1;
+            break;
+        case 'C':
+            sqlcache_enabled = 1;
+            break;
+        default:
+            nsels = -1;
+        }
+    }
+    if (optind != argc || rows < 1 || rows > MAX_ID || queries < 1 || nsels < 1 ||
+        batch < 1 || batch > MAX_BATCH)
+    {
+        fprintf(stderr, "usage: sqlbench [-n rows<=%d] [-q queries] [-s sel,...] "
+                        "[-r seed] [-b batch<=%d] [-w] [-m] [-i] [-k] [-C]\n",
+                MAX_ID, MAX_BATCH);
+        exit(1);
+    }
+    qsort(sels, nsels, sizeof(sels[0]), cmp_double);
+    first_seed = seed;
+
+    // a fresh directory, so schema.db and the table start out empty
+    char dir[] = "/tmp/sqlbench.XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) < 0)
+    {
+        perror("sqlbench: temporary directory");
+        exit(1);
+    }
+
+    // statement output is not what is being measured
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    if (!report || !freopen("/dev/null", "w", stdout))
+    {
+        perror("sqlbench: stdout");
+        exit(1);
+    }
+
+    struct op_stats *st = op_new("create");
+    run(st, "CREATE TABLE bench(id:integer,title:char(20),length:integer)");
+    nops = 0; // not worth reporting
+
+    uint64_t load_start = now_ns();
+    st = op_new("insert");
+    for (int id = 1; id <= rows; id += batch)
+    {
+        char values[MAXQS - 64];
+        int len = 0;
+        for (int i = id; i < id + batch && i <= rows; i++)
+            len += snprintf(values + len, sizeof(values) - len, "%s(%d,Movie %d,%d)",
+                            i > id ? "," : "", i, i, 1 + rand_r(&seed) % 999);
+        run(st, "INSERT INTO bench VALUES%s", values);
+    }
+    double load_s = (now_ns() - load_start) / 1e9;
+    if (length_index)
+    {
+        run(op_new("create_index"), "CREATE INDEX bylength ON bench(length)");
+        nops--; // a single statement, not worth reporting
+    }
+
+    st = op_new("select_point");
+    for (int i = 0; i < queries; i++)
+        run(st, "SELECT * FROM bench WHERE id=%d", 1 + rand_r(&seed) % rows);
+
+    char name[32];
+    for (int k = 0; k < nsels; k++)
+    {
+        snprintf(name, sizeof(name), "select_id@%g", sels[k]);
+        st = op_new(name);
+        for (int i = 0; i < queries; i++)
+            run(st, "SELECT * FROM bench WHERE id<%d", 1 + (int)(sels[k] * rows));
+    }
+    for (int k = 0; k < nsels; k++)
+    {
+        snprintf(name, sizeof(name), "select_length@%g", sels[k]);
+        st = op_new(name);
+        for (int i = 0; i < queries; i++)
+            run(st, "SELECT * FROM bench WHERE length<%d", 1 + (int)(sels[k] * 999));
+    }
+
+    st = op_new("update_point");
+    for (int i = 0; i < queries; i++)
+        run(st, "UPDATE bench SET length=%d WHERE id=%d",
+            1 + rand_r(&seed) % 999, 1 + rand_r(&seed) % rows);
+    for (int k = 0; k < nsels; k++)
+    {
+        snprintf(name, sizeof(name), "update_id@%g", sels[k]);
+        st = op_new(name);
+        for (int i = 0; i < queries; i++)
+            run(st, "UPDATE bench SET length=%d WHERE id<%d",
+                1 + rand_r(&seed) % 999, 1 + (int)(sels[k] * rows));
+    }
+
+    // point deletes hit distinct ids: shuffle them and take the first -q
+    int *ids = malloc(rows * sizeof(int));
+    if (!ids)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < rows; i++)
+        ids[i] = i + 1;
+    for (int i = rows - 1; i > 0; i--)
+    {
+        int j = rand_r(&seed) % (i + 1), t = ids[i];
+        ids[i] = ids[j];
+        ids[j] = t;
+    }
+    st = op_new("delete_point");
+    for (int i = 0; i < queries && i < rows; i++)
+        run(st, "DELETE FROM bench WHERE id=%d", ids[i]);
+    free(ids);
+    for (int k = 0; k < nsels; k++)
+    {
+        snprintf(name, sizeof(name), "delete_id@%g", sels[k]);
+        run(op_new(name), "DELETE FROM bench WHERE id>%d", rows - (int)(sels[k] * rows));
+    }
+
+    struct stat sb;
+    long blocks = stat("bench.data", &sb) == 0 ? sb.st_size / BLOCK_SIZE : 0;
+    fprintf(report, "{\"rows\": %d, \"queries\": %d, \"seed\": %u, \"batch\": %d, \"blocks\": %ld, "
+            "\"load_s\": %.3f, \"sql_cache\": %s, \"pool\": \"%s\", \"mmap\": %s, \"length_index\": %s,\n \"ops\": {\n",
+            rows, queries, first_seed, batch, blocks, load_s, sqlcache_enabled ? "true" : "false",
+            warm ? "warm" : "cold", blockio_mmap ? "true" : "false",
+            length_index ? "true" : "false");
+    for (int i = 0; i < nops; i++)
+        print_op(&ops[i], i == nops - 1);
+    fprintf(report, " }}\n");
+    fflush(report);
+
+    if (keep)
+        fprintf(stderr, "sqlbench: tables kept in %s\n", dir);
+    else
+        remove_tree(dir);
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "sqlcache.h"
+
+#define STATS_FILE SQLCACHE_DIR "/stats"
+
+enum
+{
+    STAT_HITS,
+    STAT_MISSES,
+    STAT_STORES,
+    STAT_EVICTIONS,
+    NSTATS
+};
+
+int sqlcache_enabled = 1;
+
+static const char *keywords[] = {"SELECT", "FROM", "WHERE"};
+
+void sqlcache_normalize(const char *qs, char *out, size_t outsize)
+{
+    size_t n = 0;
+
+    while (*qs && n + 1 < outsize)
+    {
+        // one token at a time, separated by a single space
+        while (isspace((unsigned char)*qs))
+            qs++;
+        if (!*qs)
+            break;
+        if (n > 0)
+            out[n++] = ' ';
+
+        const char *start = qs;
+        while (*qs && !isspace((unsigned char)*qs))
+            qs++;
+        size_t len = qs - start;
+        if (n + len >= outsize)
+            len = outsize - n - 1;
+
+        int kw = 0;
+        for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++)
+        {
+            if (len == strlen(keywords[i]) && strncasecmp(start, keywords[i], len) == 0)
+                kw = 1;
+        }
+        for (size_t i = 0; i < len; i++)
+            out[n++] = kw ? toupper((unsigned char)start[i]) : start[i];
+    }
+    out[n] = '\0';
+}
+
+// FNV-1a, names the entry file
+static void entry_path(const char *key, char *path, size_t n)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (const char *p = key; *p; p++)
+    {
+        h ^= (unsigned char)*p;
+        h *= 1099511628211ULL;
+    }
+    snprintf(path, n, "%s/%016llx.ent", SQLCACHE_DIR, (unsigned long long)h);
+}
+
+// add to one counter in the shared stats file, under an exclusive lock
+static void count(int which, long delta)
+{
+    long stats[NSTATS] = {0};
+
+    mkdir(SQLCACHE_DIR, 0777);
+    int fd = open(STATS_FILE, O_RDWR | O_CREAT, 0666);
+    if (fd < 0)
+        return;
+    flock(fd, LOCK_EX);
+
+    char buf[256] = {0};
+    if (read(fd, buf, sizeof(buf) - 1) > 0)
+        sscanf(buf, "%ld %ld %ld %ld", &stats[0], &stats[1], &stats[2], &stats[3]);
+    stats[which] += delta;
+
+    int len = snprintf(buf, sizeof(buf), "%ld %ld %ld %ld\n",
+                       stats[0], stats[1], stats[2], stats[3]);
+    if (pwrite(fd, buf, len, 0) == len)
+        ftruncate(fd, len);
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+/*
+Entry file layout:
+  v<version> <data length>\n
+  <normalized query>\n
+  <data>
+*/
+char *sqlcache_get(const char *key, uint32_t version, size_t *len)
+{
+    char path[300];
+    if (!sqlcache_enabled)
+        return NULL;
+    entry_path(key, path, sizeof(path));
+
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        count(STAT_MISSES, 1);
+        return NULL;
+    }
+
+    unsigned long v;
+    size_t dlen;
+    char stored_key[1024];
+    char *data = NULL;
+    if (fscanf(fp, "v%lu %zu\n", &v, &dlen) == 2 && v == version &&
+        fgets(stored_key, sizeof(stored_key), fp))
+    {
+        stored_key[strcspn(stored_key, "\n")] = '\0';
+        // a hash collision or an older version is just a miss
+        if (strcmp(stored_key, key) == 0 && dlen <= SQLCACHE_MAX_ENTRY)
+        {
+            data = malloc(dlen + 1);
+            if (data && fread(data, 1, dlen, fp) != dlen)
+            {
+                free(data);
+                data = NULL;
+            }
+        }
+    }
+    fclose(fp);
+
+    if (!data)
+    {
+        count(STAT_MISSES, 1);
+        return NULL;
+    }
+    count(STAT_HITS, 1);
+    *len = dlen;
+    return data;
+}
+
+// keep at most SQLCACHE_MAX_ENTRIES files, dropping the least recently written
+static void evict(void)
+{
+    DIR *dir = opendir(SQLCACHE_DIR);
+    if (!dir)
+        return;
+
+    int entries = 0;
+    char oldest[300] = "";
+    time_t oldest_mtime = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)))
+    {
+        size_t n = strlen(de->d_name);
+        if (n < 4 || strcmp(de->d_name + n - 4, ".ent") != 0)
+            continue;
+        char path[300];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", SQLCACHE_DIR, de->d_name);
+        if (stat(path, &st) < 0)
+            continue;
+        entries++;
+        if (!oldest[0] || st.st_mtime < oldest_mtime)
+        {
+            strcpy(oldest, path);
+            oldest_mtime = st.st_mtime;
+        }
+    }
+    closedir(dir);
+
+    if (entries > SQLCACHE_MAX_ENTRIES && unlink(oldest) == 0)
+        count(STAT_EVICTIONS, 1);
+}
+
+void sqlcache_put(const char *key, uint32_t version, const char *data, size_t len)
+{
+    if (!sqlcache_enabled || len > SQLCACHE_MAX_ENTRY || strlen(key) >= 1024)
+        return;
+    mkdir(SQLCACHE_DIR, 0777);
+
+    // write a temp file and rename it, so readers never see half an entry
+    char path[300], tmp[320];
+    entry_path(key, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+    FILE *fp = fopen(tmp, "w");
+    if (!fp)
+        return;
+    fprintf(fp, "v%lu %zu\n%s\n", (unsigned long)version, len, key);
+    fwrite(data, 1, len, fp);
+    if (fclose(fp) != 0 || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        return;
+    }
+    count(STAT_STORES, 1);
+    evict();
+}
+
+void sqlcache_print_stats(void)
+{
+    long stats[NSTATS] = {0};
+    FILE *fp = fopen(STATS_FILE, "r");
+    if (fp)
+    {
+        if (fscanf(fp, "%ld %ld %ld %ld", &stats[0], &stats[1], &stats[2], &stats[3]) != NSTATS)
+            memset(stats, 0, sizeof(stats));
+        fclose(fp);
+    }
+    printf("<h2>SELECT cache</h2>\n");
+    printf("<pre>\n");
+    printf("hits: %ld\nmisses: %ld\nstores: %ld\nevictions: %ld\n",
+           stats[STAT_HITS], stats[STAT_MISSES], stats[STAT_STORES], stats[STAT_EVICTIONS]);
+    printf("</pre>\n");
+}
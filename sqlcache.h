@@ -0,0 +1,27 @@
+#ifndef SQLCACHE_H
+#define SQLCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// rendered SELECT results, one file per query under SQLCACHE_DIR
+#define SQLCACHE_DIR "sqlcache"
+#define SQLCACHE_MAX_ENTRY (64 * 1024) // larger results are not cached
+#define SQLCACHE_MAX_ENTRIES 256       // oldest entries go beyond this
+
+// 0 makes every lookup miss without touching the cache (sqlbench)
+extern int sqlcache_enabled;
+
+// query text with whitespace collapsed and keywords uppercased
+void sqlcache_normalize(const char *qs, char *out, size_t outsize);
+
+// returns the cached output (malloc'd) if it was rendered at this
+// table version, NULL otherwise; counts the hit or miss
+char *sqlcache_get(const char *key, uint32_t version, size_t *len);
+
+void sqlcache_put(const char *key, uint32_t version, const char *data, size_t len);
+
+// CACHE STATS
+void sqlcache_print_stats(void);
+
+#endif // SQLCACHE_H
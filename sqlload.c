@@ -0,0 +1,62 @@
+//
+// sqlload: bulk loads a file into a table, like COPY but without the
+// server, the CGI or a query string in between.
+//
+//      sqlload [-m] table file
+//
+// Run it in the directory with schema.db and the table files. The file
+// can be anywhere (the COPY statement only reads files under that
+// directory). It has one row per line, written like the inside of a VALUES tuple:
+//
+//      42,Some Title,120
+//
+// The statement's messages go to stdout as HTML, as from sql.cgi; how
+// long the load took, and at what rate, goes to stderr. -m maps the
+// table files instead of reading them through the buffer pool.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "blockio.h"
+#include "sql.h"
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    while ((c = getopt(argc, argv, "m")) != -1)
+    {
+        if (c == 'm')
+            blockio_mmap = 1;
+        else
+            argc = 0;
+    }
+    if (argc - optind != 2)
+    {
+        fprintf(stderr, "usage: sqlload [-m] table file\n");
+        exit(1);
+    }
+
+    struct stat st;
+    double bytes = stat(argv[optind + 1], &st) == 0 ? st.st_size : 0;
+    double start = now_s();
+    long rows = sql_copy(argv[optind], argv[optind + 1]);
+    blockio_flush();
+    double s = now_s() - start;
+    if (rows < 0)
+        exit(1);
+
+    fprintf(stderr, "sqlload: %ld rows in %.3f s, %.0f rows/s, %.1f MB/s in, "
+                    "%lu writes (%.1f MB)\n",
+            rows, s, rows / s, bytes / 1e6 / s, blockio_stats.writes,
+            blockio_stats.bytes_written / 1e6);
+    return 0;
+}
@@ -272,5 +272,227 @@ done
 kill $P14; wait $P14 2>/dev/null
 echo "Test 14 passed"
 
+### Test 15: Unix domain socket listener
+echo
+echo "Test 15: unix domain socket"
+cleanup
+SOCK=/tmp/wserver_test.sock
+./wserver -p $PORT -u $SOCK -m 0600 > $LOG 2>&1 &
+P15=$!; wait_for_bind
+for i in {1..50}; do [ -S $SOCK ] && break; sleep .1; done
+[ "$(stat -c %a $SOCK)" = "600" ]                        # permissions applied
+./wclient unix:$SOCK 0 /index.html | grep -q "<h1>It works!</h1>"
+./wclient localhost $PORT /index.html | grep -q "200 OK" # tcp still served
+kill $P15; wait $P15 2>/dev/null
+[ ! -e $SOCK ]                                          # removed on shutdown
+echo keep > /tmp/wserver_test.file                      # not a socket: left alone
+! ./wserver -p 0 -u /tmp/wserver_test.file > $LOG 2>&1
+grep -q "not a socket" $LOG && [ "$(cat /tmp/wserver_test.file)" = keep ]
+rm -f /tmp/wserver_test.file
+./wserver -d www -p $PORT -u rel.sock > $LOG 2>&1 &      # relative to where it starts
+P15=$!; wait_for_bind
+[ -S rel.sock ] && [ ! -e www/rel.sock ]
+kill $P15; wait $P15 2>/dev/null
+[ ! -e rel.sock ]
+./wserver -p 0 2>&1 | grep -q usage && echo "-p0 without -u OK"
+echo "Test 15 passed"
+
+### Test 16: HTTP/2 cleartext (h2c)
+echo
+echo "Test 16: h2c prior knowledge and upgrade"
+if curl -V 2>/dev/null | grep -q HTTP2; then
+  cleanup
+  ./wserver -p $PORT -t 2 -b 8 -s SFF > $LOG 2>&1 &
+  P16=$!; wait_for_bind
+  URL=http://localhost:$PORT
+  [ "$(curl -s --http2-prior-knowledge -o /dev/null -w '%{http_version}' $URL/index.html)" = "2" ]
+  [ "$(curl -s --http2 -o /dev/null -w '%{http_version}' $URL/index.html)" = "2" ]   # upgrade
+  curl -s --http2 $URL/index.html | grep -q "<h1>It works!</h1>"
+  curl -s --http2-prior-knowledge $URL/spin.cgi?0 | grep -q "I spun for"
+  [ "$(curl -s --http2-prior-knowledge $URL/big.txt | wc -c)" = "2097152" ]         # flow control
+  [ "$(curl -s --http2-prior-knowledge -o /dev/null -w '%{http_code}' $URL/nope.html)" = "404" ]
+  # a stream window pushed past 2^31-1 gets RST_STREAM FLOW_CONTROL_ERROR;
+  # big.txt keeps stream 1 open, waiting for window, meanwhile
+  exec 3<>/dev/tcp/localhost/$PORT
+  printf 'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n\0\0\0\4\0\0\0\0\0' >&3
+  printf '\0\0\014\1\5\0\0\0\1\202\206\104\010/big.txt' >&3
+  printf '\0\0\4\10\0\0\0\0\1\177\377\377\377' >&3; sleep .2
+  printf '\0\0\4\10\0\0\0\0\1\177\377\377\377' >&3
+  frames=$(timeout 1 cat <&3 | od -An -v -tx1 | tr -d ' \n' || true)  # cut off after 1s
+  [[ $frames == *00000403000000000100000003* ]]
+  exec 3<&-
+  kill $P16; wait $P16 2>/dev/null
+  echo "Test 16 passed"
+else
+  echo "Test 16 skipped (curl built without HTTP2)"
+fi
+
+### Test 17: Coalescing identical dynamic requests
+echo
+echo "Test 17: request coalescing"
+cleanup
+./wserver -p $PORT -t 4 -b 8 -c > $LOG 2>&1 &
+P17=$!; wait_for_bind
+declare -a T17_PIDS=()
+for i in {1..4}; do
+  timeout 3s ./wclient localhost $PORT /spin.cgi?1 > /tmp/coalesce.$i &  # same request 4x
+  T17_PIDS+=( $! )
+done
+for pid in "${T17_PIDS[@]}"; do
+  wait $pid
+done
+kill $P17; wait $P17 2>/dev/null
+for i in {1..4}; do grep -q "I spun for 1.00 seconds" /tmp/coalesce.$i; done  # all got output
+grep "coalesce:" $LOG
+grep -q "coalesce: 1 runs, 3 coalesced, max fanout 4" $LOG                   # from one run
+./wserver -p $PORT -t 4 -b 8 -c > $LOG 2>&1 &
+P17=$!; wait_for_bind
+timeout 3s ./wclient localhost $PORT /spin.cgi?1 > /tmp/coalesce.1 &
+T17=$!; sleep .3
+./wclient localhost $PORT "/sql.cgi?CACHE%20STATS" > /dev/null   # a write meanwhile
+timeout 3s ./wclient localhost $PORT /spin.cgi?1 > /tmp/coalesce.2    # does not join
+wait $T17
+kill $P17; wait $P17 2>/dev/null
+grep -q "coalesce: 2 runs, 0 coalesced" $LOG                         # a run of its own
+echo "Test 17 passed"
+
+### Test 18: Separate static and dynamic pools
+echo
+echo "Test 18: static/dynamic pools"
+cleanup
+./wserver -p $PORT -t 1 -b 4 -T 1 -B 4 -x > $LOG 2>&1 &
+P18=$!; wait_for_bind
+grep -q "pools: static 1 threads FIFO, dynamic 1 threads FIFO, borrowing" $LOG
+timeout 5s ./wclient localhost $PORT /spin.cgi?2 > /dev/null &   # dynamic worker busy
+C18=$!
+timeout 5s ./wclient localhost $PORT /spin.cgi?1 > /dev/null &   # and one queued behind it
+sleep .3
+start=$(date +%s%N)
+./wclient localhost $PORT /index.html | grep -q "<h1>It works!</h1>"
+elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+echo "static request during cgi burst took ${elapsed}ms"
+[ $elapsed -lt 1000 ]                                            # not stuck behind the cgis
+wait $C18
+kill $P18; wait $P18 2>/dev/null
+echo "Test 18 passed"
+
+### Test 19: SFF ranks CGIs by learned run time
+echo
+echo "Test 19: SFF cost model"
+cleanup
+rm -f /tmp/order.19
+./wserver -p $PORT -t 1 -b 8 -s SFF > $LOG 2>&1 &
+P19=$!; wait_for_bind
+./wclient localhost $PORT /spin.cgi?2 > /dev/null                # learn both routes
+./wclient localhost $PORT /spin.cgi?0 > /dev/null
+./wclient localhost $PORT /spin.cgi?1 > /dev/null &              # keep the worker busy
+C19=$!; sleep .3
+( ./wclient localhost $PORT /spin.cgi?2 > /dev/null; echo slow >> /tmp/order.19 ) &
+S19=$!; sleep .2
+( ./wclient localhost $PORT /spin.cgi?0 > /dev/null; echo fast >> /tmp/order.19 ) &
+F19=$!
+wait $C19 $S19 $F19
+kill $P19; wait $P19 2>/dev/null
+grep "cost:" $LOG
+[ "$(head -1 /tmp/order.19)" = "fast" ]                          # queued later, ran first
+rm -f /tmp/order.19
+echo "Test 19 passed"
+
+### Test 20: Request parsing
+echo
+echo "Test 20: split and malformed requests"
+cleanup
+./wserver -p $PORT > $LOG 2>&1 &
+P20=$!; wait_for_bind
+exec 3<>/dev/tcp/localhost/$PORT                                  # headers in two pieces
+printf 'GET /index.html HTTP/1.0\r\nHo' >&3; sleep .2
+printf 'st: localhost\r\n\r\n' >&3
+grep -q "<h1>It works!</h1>" <&3; exec 3<&-
+exec 3<>/dev/tcp/localhost/$PORT                                  # bare LF line ends
+printf 'GET /index.html HTTP/1.0\n\n' >&3
+head -1 <&3 | grep -q "200 OK"; exec 3<&-
+exec 3<>/dev/tcp/localhost/$PORT
+printf 'GET /index.html HTTP/1.0\r\nno colon here\r\n\r\n' >&3
+head -1 <&3 | grep -q "400 Bad Request"; exec 3<&-
+kill $P20; wait $P20 2>/dev/null
+echo "Test 20 passed"
+
+### Test 21: wclient as a load generator
+echo
+echo "Test 21: wclient load generator"
+cleanup
+./wserver -p $PORT -t 4 -b 16 > $LOG 2>&1 &
+P21=$!; wait_for_bind
+./wclient -c 4 -n 200 -k localhost $PORT /index.html > /tmp/bench.json     # closed loop
+grep -q '"mode": "closed"' /tmp/bench.json
+grep -q '"requests": 200, "errors": 0' /tmp/bench.json
+grep -q '"p999":' /tmp/bench.json
+printf '/index.html 3\n/spin.cgi?0 1\n' > /tmp/bench.uris
+./wclient -c 2 -d 1 -w 0.2 -r 50 -f /tmp/bench.uris localhost $PORT > /tmp/bench.json  # open loop
+grep -q '"mode": "open"' /tmp/bench.json
+grep -q '"static": {"requests": [1-9]' /tmp/bench.json
+grep -q '"dynamic": {"requests": [1-9]' /tmp/bench.json
+kill $P21; wait $P21 2>/dev/null
+rm -f /tmp/bench.json /tmp/bench.uris
+echo "Test 21 passed"
+
+### Test 22: Request tracing
+echo
+echo "Test 22: Chrome trace export"
+cleanup
+./wserver -p $PORT -t 2 -b 8 -s SFF -R 1 > $LOG 2>&1 &
+P22=$!; wait_for_bind
+./wclient localhost $PORT /index.html > /dev/null
+./wclient localhost $PORT /spin.cgi?0 > /dev/null
+kill -USR1 $P22
+for i in {1..50}; do grep -q "trace written" $LOG && break; sleep .1; done
+TRACE=$(sed -n 's/.*trace written to //p' $LOG | head -1)
+grep -q '"traceEvents"' $TRACE
+for stage in peek enqueue queued read_request stat mmap write cgi request; do
+  grep -q "\"name\": \"$stage\"" $TRACE                           # every stage recorded
+done
+kill $P22; wait $P22 2>/dev/null
+rm -f wserver-trace-*.json
+echo "Test 22 passed"
+
+### Test 23: spin.cgi workload settings
+echo
+echo "Test 23: spin.cgi workload parameters"
+cleanup
+./wserver -p $PORT -t 2 -b 8 > $LOG 2>&1 &
+P23=$!; wait_for_bind
+start=$(date +%s%N)
+OUT=$(./wclient localhost $PORT '/spin.cgi?cpu=50000&block=250000&mem=1M&size=4K')
+elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+echo "cpu 50ms + block 250ms took ${elapsed}ms"
+[ $elapsed -ge 300 ] && [ $elapsed -lt 1000 ]                      # sub-second timing
+echo "$OUT" | grep -q "Content-Length: 4096"                         # body size honored
+echo "$OUT" | grep -q "cpu 50000 us, blocked 250000 us, mem 1048576 bytes"
+./wclient localhost $PORT '/spin.cgi?block=exp:1000&seed=7' | grep -q "blocked [0-9]* us"
+kill $P23; wait $P23 2>/dev/null
+echo "Test 23 passed"
+
+### Test 24: Access log and replay
+echo
+echo "Test 24: access log replay"
+cleanup
+rm -f /tmp/access.24
+./wserver -p $PORT -t 2 -b 8 -l /tmp/access.24 > $LOG 2>&1 &
+P24=$!; wait_for_bind
+./wclient localhost $PORT /index.html > /dev/null
+./wclient localhost $PORT '/spin.cgi?block=200000' > /dev/null
+./wclient localhost $PORT /missing.html > /dev/null
+[ $(wc -l < /tmp/access.24) -eq 3 ]
+grep -q '"uri": "/spin.cgi?block=200000", "proto": "HTTP/1.1", "status": 200' /tmp/access.24
+grep -q '"uri": "/missing.html", .*"status": 404' /tmp/access.24
+./wclient -l /tmp/access.24 -x 4 localhost $PORT > /tmp/replay.json
+grep -q '"mode": "replay"' /tmp/replay.json
+grep -q '"requests": 3, "errors": 0' /tmp/replay.json
+grep -q '"status_mismatch": 0' /tmp/replay.json
+grep -q '"recorded_us": {"count": 3' /tmp/replay.json
+kill $P24; wait $P24 2>/dev/null
+rm -f /tmp/access.24 /tmp/replay.json
+echo "Test 24 passed"
+
 echo
 echo "ALL Tests PASSED"
@@ -30,7 +30,8 @@ check() {
 }
 
 echo " Cleaning state" 
-rm -f *.schema *.data # Remove all old data/schema files to reset
+rm -f *.schema *.data *.idx # Remove all old data/schema/index files to reset
+rm -rf sqlcache
 
 echo
 echo " CREATE TABLE tests to ensure basic functions work"
@@ -48,6 +49,15 @@ check "<th>id</th><th>title</th><th>length</th>" "SELECT id,title,length FROM mo
 check "<td>Avatar</td>" "SELECT id,title FROM movies WHERE id=1"
 check "<td>195</td>" "SELECT id,length FROM movies WHERE id=2"
 
+echo
+echo " SELECT cache tests (repeats are served from sqlcache/, writes invalidate)"
+check "<td>Avatar</td>" "SELECT id,title FROM movies WHERE id=1"
+check "<td>Avatar</td>" "SELECT  id,title  FROM movies  WHERE id=1"  # same normalized query
+check "hits: [1-9]" "CACHE STATS"
+check "<td>Titanic</td>" "SELECT id,title FROM movies WHERE id<5"
+check "Inserted into <b>movies</b>" "INSERT INTO movies VALUES(3,Alien,117)"
+check "<td>Alien</td>" "SELECT id,title FROM movies WHERE id<5"        # new version, not the cached one
+
 echo
 echo " Some block overflow test to make sure blocks work correctly "
 
@@ -68,6 +78,18 @@ check "Inserted into <b>movies</b>" "INSERT INTO movies VALUES(16,Movie20,110)"
 check "<td>Movie10</td>" "SELECT title FROM movies WHERE id=10"
 check "<td>Movie16</td>" "SELECT title FROM movies WHERE id=16"
 
+echo
+echo " Chunked SELECT responses (HTTP/1.1 gets chunks, HTTP/1.0 the raw stream)"
+hdrs=$(curl -s -D - -o /dev/null "${BASE}$(urlencode "SELECT id,title FROM movies WHERE id>0")")
+echo "$hdrs" | grep -qi "^Transfer-Encoding: chunked" \
+  && echo "PASS: SELECT response is chunked" \
+  || { echo "FAIL: SELECT response is not chunked"; echo "$hdrs"; exit 1; }
+check "<td>Movie20</td>" "SELECT id,title FROM movies WHERE id>0"
+resp=$(curl -s --http1.0 "${BASE}$(urlencode "SELECT id,title FROM movies WHERE id>0")")
+echo "$resp" | grep -q "</table>" \
+  && echo "PASS: HTTP/1.0 SELECT" \
+  || { echo "FAIL: HTTP/1.0 SELECT"; echo "  got: $resp"; exit 1; }
+
 echo
 echo " UPDATE tests to ensure basic functions work"
 check "Update done on <b>movies</b>" "UPDATE movies SET title=Titanic3D WHERE id=2"
@@ -103,6 +125,10 @@ echo
 check "ERROR: bad CREATE syntax" "CREATE TABLE movies(id smallint,title char(20))"
 check "ERROR: invalid table name" "CREATE TABLE mo@vies(id:smallint,title:char(20))"
 check "ERROR: no columns specified" "CREATE TABLE blank()"
+long=t23456789012345678901234567890123456789012345678901234567890123 # 63, the longest name
+check "Created table <b>$long</b>" "CREATE TABLE $long(id:integer,length:integer)"
+check "Inserted into <b>$long</b>" "INSERT INTO $long VALUES(1,5)"
+check "<td>5</td>" "SELECT length FROM $long WHERE id=1"
 
 # invalid INSERT tests
 check "ERROR: table <b>nosuch</b> does not exist" "INSERT INTO nosuch VALUES(1,X)"
@@ -143,11 +169,255 @@ else
   echo "PASS: DELETE removed movie with id=2"
 fi
 
+echo
+echo " id index (movies.idx answers id=, id< and id>)"
+[ -f movies.idx ] && echo "PASS: CREATE TABLE made movies.idx" \
+  || { echo "FAIL: no movies.idx"; exit 1; }
+for id in 40 12 33 27 18 45 21 36 15 30 24 42; do
+  check "Inserted into <b>movies</b>" "INSERT INTO movies VALUES($id,Film $id,$id)"
+done
+check "<td>33</td><td>Film 33</td>" "SELECT * FROM movies WHERE id=33"
+resp=$(curl -s "${BASE}$(urlencode "SELECT id FROM movies WHERE id>20")")
+ids=$(echo "$resp" | grep -o "<tr><td>[0-9]*" | grep -o "[0-9]*$" | tr '\n' ' ')
+[ "$ids" = "21 24 27 30 33 36 40 42 45 " ] && echo "PASS: id>20 in id order" \
+  || { echo "FAIL: id>20 gave $ids"; exit 1; }
+check "<td>12</td>" "SELECT id FROM movies WHERE id<15"
+check "Update done" "UPDATE movies SET length=99 WHERE id=27"
+check "<td>99</td>" "SELECT length FROM movies WHERE id=27"
+check "Deleted matching rows" "DELETE FROM movies WHERE id>35"
+resp=$(curl -s "${BASE}$(urlencode "SELECT id FROM movies WHERE id!=0")")
+echo "$resp" | grep -q "<td>3[6-9]\|<td>4[0-9]" \
+  && { echo "FAIL: DELETE id>35 left rows"; exit 1; } || echo "PASS: DELETE id>35 through the index"
+check "Inserted into <b>movies</b>" "INSERT INTO movies VALUES(40,Again,1)"
+check "<td>Again</td>" "SELECT * FROM movies WHERE id=40"
+
+echo
+echo " CREATE INDEX (secondary index on length)"
+check "Created index <b>bylength</b> on <b>movies</b>(length)" "CREATE INDEX bylength ON movies(length)"
+[ -f movies.bylength.idx ] && grep -q "^idx:bylength|movies|length;" schema.db \
+  && echo "PASS: index file and schema.db entry" \
+  || { echo "FAIL: CREATE INDEX left no index file or schema entry"; exit 1; }
+check "ERROR: index <b>bylength</b> already exists" "CREATE INDEX bylength ON movies(length)"
+check "ERROR: column 'title' is not an integer column" "CREATE INDEX bytitle ON movies(title)"
+check "ERROR: unknown column 'year'" "CREATE INDEX byyear ON movies(year)"
+check "ERROR: table <b>nosuch</b> does not exist" "CREATE INDEX x ON nosuch(length)"
+check "ERROR: bad CREATE INDEX syntax" "CREATE INDEX x movies(length)"
+# the longest index name, on the longest table name, while rows go in
+for j in 0 1 2 3; do
+  ( for id in $(seq $((2 + 10 * j)) $((11 + 10 * j))); do
+      QUERY_STRING="$(urlencode "INSERT INTO $long VALUES($id,$((id + 1000)))")" ./sql.cgi
+    done ) > /dev/null &
+done
+check "Created index <b>i${long#t}</b> on <b>$long</b>(length)" "CREATE INDEX i${long#t} ON $long(length)"
+wait
+resp=$(curl -s "${BASE}$(urlencode "SELECT id FROM $long WHERE length>1000")")
+[ "$(echo "$resp" | grep -c "<td>")" = 40 ] && echo "PASS: rows inserted during CREATE INDEX are indexed" \
+  || { echo "FAIL: CREATE INDEX during INSERTs"; echo "  got: $resp"; exit 1; }
+check "<td>Film 30</td>" "SELECT * FROM movies WHERE length=30"
+check "Inserted into <b>movies</b>" "INSERT INTO movies VALUES(50,Film 50,500)"
+check "<td>Film 50</td>" "SELECT * FROM movies WHERE length>400"
+check "Update done" "UPDATE movies SET length=7 WHERE id=50"
+resp=$(curl -s "${BASE}$(urlencode "SELECT id FROM movies WHERE length>400")")
+echo "$resp" | grep -q "<td>50</td>" && { echo "FAIL: UPDATE left the old length indexed"; exit 1; } \
+  || echo "PASS: UPDATE moved the row in the index"
+check "<td>50</td>" "SELECT id FROM movies WHERE length<8"
+check "Deleted matching rows" "DELETE FROM movies WHERE length<8"
+resp=$(curl -s "${BASE}$(urlencode "SELECT id FROM movies WHERE id=50")")
+echo "$resp" | grep -q "<td>50</td>" && { echo "FAIL: DELETE on length missed id 50"; exit 1; } \
+  || echo "PASS: DELETE through the length index"
+for id in 51 52 53 54 55 56 57 58; do
+  check "Inserted into <b>movies</b>" "INSERT INTO movies VALUES($id,Film $id,$id)"
+done
+# UPDATEs at once, each moving its row in both indexes' trees
+for id in 51 52 53 54 55 56 57 58; do
+  QUERY_STRING="$(urlencode "UPDATE movies SET length=$((id + 600)) WHERE id=$id")" ./sql.cgi > /dev/null &
+done
+wait
+resp=$(curl -s "${BASE}$(urlencode "SELECT id FROM movies WHERE length>599")")
+[ "$(echo "$resp" | grep -c "<td>5[1-8]</td>")" = 8 ] && echo "PASS: concurrent UPDATEs indexed every new length" \
+  || { echo "FAIL: concurrent UPDATEs of an indexed column"; echo "  got: $resp"; exit 1; }
+resp=$(curl -s "${BASE}$(urlencode "SELECT id FROM movies WHERE length<59")")
+echo "$resp" | grep -q "<td>5[1-8]</td>" && { echo "FAIL: concurrent UPDATEs left old lengths indexed"; exit 1; } \
+  || echo "PASS: concurrent UPDATEs took the old lengths out"
+check "Deleted matching rows" "DELETE FROM movies WHERE length>599"
+
+echo
+echo " free lists (INSERT reuses emptied slots, and blocks DELETE emptied)"
+check "Free list head: [0-9]*, last block: [0-9]*" "DUMP FROM movies"
+for id in 61 62 63 64 65 66 67 68 69 70; do
+  check "Inserted into <b>movies</b>" "INSERT INTO movies VALUES($id,Filler,1)"
+done
+check "Deleted matching rows" "DELETE FROM movies WHERE id>60"
+check "Free blocks: [1-9]" "DUMP FROM movies"   # emptied blocks left the chain
+size=$(stat -c %s movies.data)
+for id in 71 72 73 74 75 76 77 78 79 80; do
+  check "Inserted into <b>movies</b>" "INSERT INTO movies VALUES($id,Reuse,1)"
+done
+[ "$(stat -c %s movies.data)" = "$size" ] && echo "PASS: INSERT filled the emptied slots and blocks" \
+  || { echo "FAIL: movies.data grew from $size to $(stat -c %s movies.data)"; exit 1; }
+check "<td>Reuse</td>" "SELECT * FROM movies WHERE id=76"
+check "Deleted matching rows" "DELETE FROM movies WHERE id>70"
+for id in $(seq 81 100); do
+  check "Inserted into <b>movies</b>" "INSERT INTO movies VALUES($id,Filler,1)"
+done
+# writers at once: each DELETE takes a row out and an INSERT puts one in its slot
+for j in 0 1 2 3 4; do
+  ( for id in $(seq $((81 + 4 * j)) $((84 + 4 * j))); do
+      QUERY_STRING="$(urlencode "DELETE FROM movies WHERE id=$id")" ./sql.cgi
+      QUERY_STRING="$(urlencode "INSERT INTO movies VALUES($((id + 20)),Moved,1)")" ./sql.cgi
+    done ) > /dev/null &
+done
+wait
+resp=$(curl -s "${BASE}$(urlencode "SELECT id FROM movies WHERE id>80")")
+[ "$(echo "$resp" | grep -c "<td>")" = 20 ] && [ "$(echo "$resp" | grep -c "<td>1[0-2][0-9]</td>")" = 20 ] \
+  && echo "PASS: concurrent DELETEs and INSERTs kept every row" \
+  || { echo "FAIL: concurrent DELETEs and INSERTs"; echo "  got: $resp"; exit 1; }
+check "Deleted matching rows" "DELETE FROM movies WHERE id>80"
+
+echo
+echo " multi-row INSERT"
+resp=$(curl -s "${BASE}$(urlencode "INSERT INTO movies VALUES(81,Batch 81,81),(82,Batch 82,82),(83,Batch 83,83),(84,Batch 84,84),(85,Batch 85,85),(86,Batch 86,86),(87,Batch 87,87)")")
+[ "$(echo "$resp" | grep -c "Inserted into <b>movies</b>")" = 7 ] && echo "PASS: one ack per row" \
+  || { echo "FAIL: multi-row INSERT"; echo "$resp"; exit 1; }
+check "<td>Batch 86</td>" "SELECT * FROM movies WHERE id=86"
+check "<td>Batch 84</td>" "SELECT * FROM movies WHERE length=84"   # indexed as well
+check "ERROR: row 2: expected 3 values, got 2" "INSERT INTO movies VALUES(88,Batch 88,88),(89,Batch 89)"
+check "<td>Batch 88</td>" "SELECT * FROM movies WHERE id=88"   # the good row went in
+check "ERROR: bad INSERT syntax" "INSERT INTO movies VALUES(90,Batch 90,90),"
+resp=$(curl -s "${BASE}$(urlencode "SELECT * FROM movies WHERE id=90")")
+echo "$resp" | grep -q "<td>Batch 90</td>" && { echo "FAIL: bad syntax still inserted"; exit 1; } \
+  || echo "PASS: bad syntax inserts nothing"
+check "Deleted matching rows" "DELETE FROM movies WHERE id>80"
+
+echo
+echo " COPY and sqlload (bulk loads from a file)"
+csv="$PWD/copy_test.csv"
+for id in $(seq 101 130); do echo "$id,Copied $id,$id"; done > "$csv"
+echo "bad line" >> "$csv"
+check "ERROR: line 31: expected 3 values, got 1" "COPY movies FROM 'copy_test.csv'"
+check "Copied 30 rows into <b>movies</b>" "COPY movies FROM 'copy_test.csv'"
+echo "999,$(printf 'x%.0s' $(seq 600)),1,2" > copy_long.csv   # its tail alone would be a row
+check "ERROR: line 1: longer than 510 bytes" "COPY movies FROM 'copy_long.csv'"
+check "Copied 0 rows into <b>movies</b>" "COPY movies FROM 'copy_long.csv'"
+rm -f copy_long.csv
+check "<td>Copied 117</td>" "SELECT * FROM movies WHERE id=117"
+check "<td>Copied 125</td>" "SELECT * FROM movies WHERE length=125"   # the length index was rebuilt
+check "ERROR: cannot open" "COPY movies FROM 'nonexistent.csv'"
+check "ERROR: bad COPY syntax" "COPY movies FROM copy_test.csv"
+# statements only read files under the data directory
+check "ERROR: COPY reads files under the data directory only" "COPY movies FROM '$csv'"
+# the server already turns away a URL with .. in it, so these go to sql.cgi directly
+for p in ../etc/passwd www/../../x; do
+  QUERY_STRING="$(urlencode "COPY movies FROM '$p'")" ./sql.cgi \
+    | grep -q "ERROR: COPY reads files under the data directory only" \
+    && echo "PASS: COPY refuses $p" || { echo "FAIL: COPY read $p"; exit 1; }
+done
+ln -sf /etc/passwd copy_link.csv
+check "ERROR: cannot open <b>copy_link.csv</b>" "COPY movies FROM 'copy_link.csv'"
+rm -f copy_link.csv
+./sqlload movies "$csv" 2>/dev/null | grep -q "Copied 30 rows" \
+  && echo "PASS: sqlload" || { echo "FAIL: sqlload"; exit 1; }
+resp=$(curl -s "${BASE}$(urlencode "SELECT id FROM movies WHERE length=120")")
+[ "$(echo "$resp" | grep -c "<td>120</td>")" = 3 ] && echo "PASS: all three loads indexed" \
+  || { echo "FAIL: length index after three loads"; echo "$resp"; exit 1; }
+rm -f "$csv"
+check "Deleted matching rows" "DELETE FROM movies WHERE id>100"
+
+echo
+echo " binary rows (any schema, ids past 9999, range checks)"
+check "Row size: 28 bytes, 7 rows per block" "DUMP FROM movies"
+check "Inserted into <b>movies</b>" "INSERT INTO movies VALUES(12345,Big Id,54321)"
+check "<td>12345</td><td>Big Id</td><td>54321</td>" "SELECT * FROM movies WHERE id=12345"
+check "ERROR: value 40000 out of range for column 'id'" "INSERT INTO movies VALUES(40000,Too Big,1)"
+check "Deleted matching rows" "DELETE FROM movies WHERE id=12345"
+check "Created table <b>emp</b>" "CREATE TABLE emp(name:char(8),age:smallint,dept:char(3),salary:integer)"
+check "Inserted into <b>emp</b>" "INSERT INTO emp VALUES(alice,30,eng,120000),(bob,41,ops,90000),(carol,29,eng,135000)"
+check "<tr><td>alice</td><td>30</td><td>eng</td><td>120000</td></tr>" "SELECT * FROM emp WHERE dept=eng"
+check "<td>carol</td>" "SELECT name FROM emp WHERE salary>125000"
+check "Update done" "UPDATE emp SET age=31 WHERE name=alice"
+check "<td>31</td>" "SELECT age FROM emp WHERE name=alice"
+check "ERROR: bad INSERT values" "UPDATE emp SET age=old WHERE name=alice"
+check "ERROR: unknown column 'id'" "SELECT * FROM emp WHERE id=1"
+[ ! -f emp.idx ] && echo "PASS: no id index without an id column" \
+  || { echo "FAIL: emp.idx was created"; exit 1; }
+check "ERROR: row of 232 bytes does not fit a block" "CREATE TABLE wide(a:char(200),b:char(30))"
+check "ERROR: duplicate column 'a'" "CREATE TABLE twice(a:integer,a:integer)"
+
+echo
+echo " schema catalog (catalog.bin)"
+[ -f catalog.bin ] && echo "PASS: catalog.bin written" \
+  || { echo "FAIL: no catalog.bin"; exit 1; }
+check "Schema: name:char(8),age:smallint,dept:char(3),salary:integer" "DUMP FROM emp"
+cp catalog.bin catalog.old
+check "Created table <b>later</b>" "CREATE TABLE later(id:integer,v:char(4))"
+mv catalog.old catalog.bin # one built from an older schema.db
+check "Inserted into <b>later</b>" "INSERT INTO later VALUES(1,new)"
+check "<td>new</td>" "SELECT v FROM later WHERE id=1"
+printf 'garbage' > catalog.bin
+check "<td>carol</td>" "SELECT name FROM emp WHERE salary>125000"
+check "ERROR: table <b>nosuch</b> does not exist" "SELECT * FROM nosuch WHERE id=1"
+for i in 1 2 3 4 5 6; do
+  ( QUERY_STRING="$(urlencode "CREATE TABLE race(id:integer,v:integer)")" ./sql.cgi
+    QUERY_STRING="$(urlencode "INSERT INTO race VALUES($i,$i)")" ./sql.cgi ) > out.race.$i &
+done
+wait
+[ "$(cat out.race.* | grep -c "Created table")" = 1 ] && echo "PASS: one of six CREATEs of a table" \
+  || { echo "FAIL: concurrent CREATE TABLE"; cat out.race.*; exit 1; }
+rm -f out.race.*
+for i in 1 2 3 4 5 6; do check "<td>$i</td>" "SELECT v FROM race WHERE id=$i"; done
+
 echo
 echo " Checking System Dump"
 resp=$(curl -s "${BASE}$(urlencode "DUMP FROM movies")")
 echo "$resp"
 
+echo
+echo " Block I/O counters"
+check "statements: [1-9]" "STATS"
+check "movies.data *[1-9]" "STATS"
+footer=$(QUERY_STRING="$(urlencode "SELECT id FROM movies WHERE id=1")" SQL_IO_FOOTER=1 ./sql.cgi)
+echo "$footer" | grep -q '<p class="io">I/O: [1-9][0-9]* opens, [1-9][0-9]* reads.* [1-9][0-9]* pool hits' \
+  && echo "PASS: SQL_IO_FOOTER" \
+  || { echo "FAIL: SQL_IO_FOOTER"; echo "$footer"; exit 1; }
+check "Block I/O stats reset" "STATS RESET"
+check "statements: 0" "STATS"
+
+echo
+echo " SQL_MMAP (table files mapped instead of read through the pool)"
+mmap_sql() { QUERY_STRING="$(urlencode "$1")" SQL_MMAP=1 ./sql.cgi; }
+mmap_sql "INSERT INTO movies VALUES(77,Mapped,77)" | grep -q "Inserted" \
+  && echo "PASS: SQL_MMAP INSERT" \
+  || { echo "FAIL: SQL_MMAP INSERT"; exit 1; }
+check "<td>Mapped</td>" "SELECT * FROM movies WHERE id=77"
+check "Update done" "UPDATE movies SET length=78 WHERE id=77"
+mmap_sql "SELECT * FROM movies WHERE length=78" | grep -q "<td>Mapped</td>" \
+  && echo "PASS: SQL_MMAP SELECT sees a pooled UPDATE" \
+  || { echo "FAIL: SQL_MMAP SELECT"; exit 1; }
+check "Deleted matching rows" "DELETE FROM movies WHERE id=77"
+
+echo
+echo " sqlbench (the engine without the server)"
+out=$(./sqlbench -n 200 -q 10 -s 0.1,0.5)
+for op in insert select_point select_id@0.1 select_length@0.5 update_point delete_point delete_id@0.5; do
+  echo "$out" | grep -q "\"$op\": {\"ops\": [1-9]" \
+    && echo "PASS: sqlbench $op" \
+    || { echo "FAIL: sqlbench $op"; echo "$out"; exit 1; }
+done
+echo "$out" | grep -q '"select_point": .*"reads_per_op": [1-9]' \
+  && echo "PASS: sqlbench counts block reads" \
+  || { echo "FAIL: sqlbench block reads"; echo "$out"; exit 1; }
+out=$(./sqlbench -n 200 -q 10 -s 0.5 -w)
+echo "$out" | grep -q '"select_point": .*"reads_per_op": 0.0, .*"hits_per_op": [1-9]' \
+  && echo "PASS: sqlbench -w reads from the buffer pool" \
+  || { echo "FAIL: sqlbench -w"; echo "$out"; exit 1; }
+out=$(./sqlbench -n 200 -q 10 -s 0.1 -i)
+echo "$out" | grep -q '"length_index": true' && echo "$out" | grep -q '"select_length@0.1": {"ops": 10' \
+  && echo "PASS: sqlbench -i" \
+  || { echo "FAIL: sqlbench -i"; echo "$out"; exit 1; }
+out=$(./sqlbench -n 200 -q 10 -s 0.5 -m)
+echo "$out" | grep -q '"mmap": true' && echo "$out" | grep -q '"select_point": {"ops": 10,.*"reads_per_op": 0.0' \
+  && echo "PASS: sqlbench -m reads through the mapping" \
+  || { echo "FAIL: sqlbench -m"; echo "$out"; exit 1; }
 
 echo
 echo " ALL TESTS PASSED!!!!!!!!! "
@@ -0,0 +1,147 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace.h"
+
+#define TRACE_EVENTS 16384 // per thread; the oldest are overwritten
+
+int trace_sample = 0;
+
+struct trace_event {
+    const char *stage;     // static string
+    uint64_t id;
+    uint64_t start, end;
+    int async;
+};
+
+struct trace_buf {
+    pthread_mutex_t lock;  // only contended while dumping
+    int tid;
+    char name[32];
+    struct trace_event ev[TRACE_EVENTS];
+    unsigned long count;   // events ever recorded
+    struct trace_buf *next;
+};
+
+static pthread_mutex_t bufs_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_buf *bufs;
+static int nbufs;
+static unsigned long requests; // for sampling
+
+static __thread struct trace_buf *my_buf;
+static __thread uint64_t current;
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct trace_buf *buf_get(void) {
+    if (my_buf)
+        return my_buf;
+    struct trace_buf *b = calloc(1, sizeof(*b));
+    if (!b)
+        return NULL;
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_mutex_lock(&bufs_lock);
+    b->tid = ++nbufs;
+    snprintf(b->name, sizeof(b->name), "thread %d", b->tid);
+    b->next = bufs;
+    bufs = b;
+    pthread_mutex_unlock(&bufs_lock);
+    return my_buf = b;
+}
+
+static void record(const char *stage, uint64_t id, uint64_t start,
+                   uint64_t end, int async) {
+    struct trace_buf *b = buf_get();
+    if (!b)
+        return;
+    pthread_mutex_lock(&b->lock);
+    b->ev[b->count++ % TRACE_EVENTS] = (struct trace_event){
+        stage, id, start, end, async};
+    pthread_mutex_unlock(&b->lock);
+}
+
+uint64_t trace_request(void) {
+    if (trace_sample <= 0)
+        return 0;
+    unsigned long n = __atomic_add_fetch(&requests, 1, __ATOMIC_RELAXED);
+    return (n - 1) % trace_sample == 0 ? n : 0;
+}
+
+void trace_set_current(uint64_t id) {
+    current = id;
+}
+
+void trace_thread_name(const char *name) {
+    struct trace_buf *b;
+    if (trace_sample <= 0 || !(b = buf_get()))
+        return;
+    snprintf(b->name, sizeof(b->name), "%s %d", name, b->tid);
+}
+
+uint64_t trace_begin(void) {
+    return current ? trace_now() : 0;
+}
+
+void trace_end(const char *stage, uint64_t t) {
+    if (t)
+        record(stage, current, t, trace_now(), 0);
+}
+
+void trace_span(const char *stage, uint64_t id, uint64_t start, uint64_t end) {
+    if (id)
+        record(stage, id, start, end, 0);
+}
+
+void trace_async(const char *stage, uint64_t id, uint64_t start, uint64_t end) {
+    if (id)
+        record(stage, id, start, end, 1);
+}
+
+int trace_dump(const char *path) {
+    FILE *fp = fopen(path, "w");
+    int pid = getpid(), first = 1;
+    if (!fp)
+        return -1;
+
+    fprintf(fp, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    pthread_mutex_lock(&bufs_lock);
+    for (struct trace_buf *b = bufs; b; b = b->next) {
+        pthread_mutex_lock(&b->lock);
+        fprintf(fp, "%s\n{\"ph\": \"M\", \"name\": \"thread_name\", "
+                "\"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                first ? "" : ",", pid, b->tid, b->name);
+        first = 0;
+        unsigned long n = b->count < TRACE_EVENTS ? b->count : TRACE_EVENTS;
+        for (unsigned long i = b->count - n; i < b->count; i++) {
+            struct trace_event *e = &b->ev[i % TRACE_EVENTS];
+            double ts = e->start / 1e3, end = e->end / 1e3;
+            if (e->async) {
+                fprintf(fp, ",\n{\"ph\": \"b\", \"cat\": \"request\", "
+                        "\"name\": \"%s\", \"id\": %lu, \"pid\": %d, "
+                        "\"tid\": %d, \"ts\": %.3f}", e->stage,
+                        (unsigned long) e->id, pid, b->tid, ts);
+                fprintf(fp, ",\n{\"ph\": \"e\", \"cat\": \"request\", "
+                        "\"name\": \"%s\", \"id\": %lu, \"pid\": %d, "
+                        "\"tid\": %d, \"ts\": %.3f}", e->stage,
+                        (unsigned long) e->id, pid, b->tid, end);
+            } else {
+                fprintf(fp, ",\n{\"ph\": \"X\", \"cat\": \"request\", "
+                        "\"name\": \"%s\", \"pid\": %d, \"tid\": %d, "
+                        "\"ts\": %.3f, \"dur\": %.3f, "
+                        "\"args\": {\"request\": %lu}}", e->stage, pid,
+                        b->tid, ts, end - ts, (unsigned long) e->id);
+            }
+        }
+        pthread_mutex_unlock(&b->lock);
+    }
+    pthread_mutex_unlock(&bufs_lock);
+    fprintf(fp, "\n]}\n");
+    return fclose(fp) == 0 ? 0 : -1;
+}
@@ -0,0 +1,44 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+//
+// Request lifecycle tracing, written out as Chrome trace-event JSON
+// (chrome://tracing, ui.perfetto.dev).
+//
+// 1 in trace_sample requests is traced (0 = tracing off). Stages are
+// timed with CLOCK_MONOTONIC into a ring buffer owned by the thread that
+// ran them, so recording takes no shared lock. Each request has an id;
+// stages run on a worker find it through the thread's current request.
+//
+
+extern int trace_sample; // wserver -R
+
+// id for a new request, 0 if it is not sampled
+uint64_t trace_request(void);
+
+// the request this thread is working on (0 = none / not traced)
+void trace_set_current(uint64_t id);
+
+// name for this thread's track in the viewer
+void trace_thread_name(const char *name);
+
+// start of a stage of the current request: now, or 0 if untraced
+uint64_t trace_begin(void);
+
+// stage of the current request that started at t (no-op if t == 0)
+void trace_end(const char *stage, uint64_t t);
+
+// stage of request id from start to end, on this thread's track
+void trace_span(const char *stage, uint64_t id, uint64_t start, uint64_t end);
+
+// time request id spent between threads (e.g. queued), as an async span
+void trace_async(const char *stage, uint64_t id, uint64_t start, uint64_t end);
+
+uint64_t trace_now(void);
+
+// write every thread's buffered events to path; 0 on success
+int trace_dump(const char *path);
+
+#endif // __TRACE_H__
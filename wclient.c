@@ -4,24 +4,55 @@
 // To run, try: 
 //      client hostname portnumber filename
 //
+// To talk to a server listening on a unix domain socket, pass the
+// socket path as unix:<path> in place of the hostname (port is ignored):
+//      client unix:/tmp/wserver.sock 0 filename
+//
 // Sends one HTTP request to the specified HTTP server.
 // Prints out the HTTP response.
 //
-// For testing your server, you will want to modify this client.  
-// For example:
-// You may want to make this multi-threaded so that you can 
-// send many requests simultaneously to the server.
+// With any of the options below it is a load generator instead:
+//      client [-c conns] [-n requests | -d secs] [-r rate] [-k]
+//             [-f urifile] [-w secs] hostname portnumber [filename]
 //
-// You may also want to be able to request different URIs; 
-// you may want to get more URIs from the command line 
-// or read the list from a file. 
+//   -c  concurrent connections, one thread each (default 1)
+//   -n  requests to measure (default 1000), or -d seconds to run
+//   -r  open loop: start this many requests per second in total, on
+//       schedule, whether or not earlier ones have finished; without
+//       it every connection sends its next request when the last ends
+//   -k  keep connections open between requests when the server allows
+//   -f  file of "uri [weight] [class]" lines to pick requests from;
+//       class defaults to dynamic for cgi uris and static otherwise
+//   -w  seconds of warmup that are not measured
 //
-// When we test your server, we will be using modifications to this client.
+// Results go to stdout as one JSON object. Latencies are reported
+// twice: "service" is send to last byte, "latency" is corrected for
+// coordinated omission. In open loop it is measured from when the
+// request was due; in closed loop a slow response also records the
+// requests it held back, one per mean service time.
 //
-
+// Or it replays an access log written by wserver -l:
+//      client -l logfile [-x speed] [-c conns] [-n requests | -d secs]
+//             [-k] [-w secs] hostname portnumber
+//
+//   -l  send the logged requests with the gaps between them kept,
+//       divided by -x (2 = twice as fast); -c is how many may be in
+//       flight at once (default 64), so bursts overlap as they did
+//   -n, -d  replay only the first requests, or seconds, of the log
+//
+// Latency is then measured from when each request was due, and compared
+// with the response time in the log: "ratio" is replayed / recorded per
+// request, and a status that differs from the logged one is counted.
+//
+#define _GNU_SOURCE // strcasestr()
+#include <pthread.h>
+#include <time.h>
 #include "io_helper.h"
+#include "hist.h"
 
 #define MAXBUF (8192)
+#define MAX_CLASSES 8
+#define REPLAY_CONNS 64 // default -c for -l
 
 //
 // Send an HTTP request for the specified file 
@@ -38,17 +69,43 @@ void client_send(int fd, char *filename) {
     write_or_die(fd, buf, strlen(buf));
 }
 
+//
+// Print a chunked body: "<hex size>\r\n<data>\r\n" until a 0 chunk.
+// Complains if the connection ends before the last chunk.
+//
+void client_print_chunked(int fd) {
+    char buf[MAXBUF];
+    long size;
+    
+    while (readline_or_die(fd, buf, MAXBUF) > 0) {
+      if ((size = strtol(buf, NULL, 16)) == 0)
+          return; // last chunk
+      while (size > 0) {
+          int want = size < MAXBUF ? size : MAXBUF;
+          int n = read(fd, buf, want);
+          if (n <= 0)
+              break;
+          fwrite(buf, 1, n, stdout);
+          size -= n;
+      }
+      readline_or_die(fd, buf, MAXBUF); // CRLF after the data
+    }
+    fprintf(stderr, "wclient: response truncated\n");
+}
+
 //
 // Read the HTTP response and print it out
 //
 void client_print(int fd) {
     char buf[MAXBUF];  
-    int n;
+    int n, chunked = 0;
     
     // Read and display the HTTP Header 
     n = readline_or_die(fd, buf, MAXBUF);
     while (strcmp(buf, "\r\n") && (n > 0)) {
       printf("Header: %s", buf);
+      if (strncasecmp(buf, "Transfer-Encoding:", 18) == 0 && strstr(buf, "chunked"))
+          chunked = 1;
       n = readline_or_die(fd, buf, MAXBUF);
   
       // If you want to look for certain HTTP tags... 
@@ -59,6 +116,10 @@ void client_print(int fd) {
     }
     
     // Read and display the HTTP Body 
+    if (chunked) {
+      client_print_chunked(fd);
+      return;
+    }
     n = readline_or_die(fd, buf, MAXBUF);
     while (n > 0) {
       printf("%s", buf);
@@ -66,22 +127,703 @@ void client_print(int fd) {
     }
 }
 
+//
+// Load generator
+//
+struct uri_entry {
+    char *uri;
+    double weight;
+    int cls;
+};
+
+struct bench_stats {
+    struct hist service, latency;
+    struct hist cls_latency[MAX_CLASSES];
+    unsigned long cls_requests[MAX_CLASSES];
+    unsigned long requests, errors, connects, bytes;
+    unsigned long status[6];   // by first digit
+    struct hist recorded;      // replay: logged response times
+    struct hist ratio;         // replay: replayed / recorded, in 1/1000
+    unsigned long mismatched;  // replay: status differs from the log
+};
+
+// one client connection with a read buffer
+struct bench_conn {
+    int fd;
+    char buf[MAXBUF];
+    size_t off, len;
+};
+
+// one logged request, see accesslog.h in the server
+struct replay_rec {
+    uint64_t at;               // ns after the first request, scaled by -x
+    uint64_t recorded;         // its response time then, ns
+    int status;
+    int cls;
+    char *method, *uri, *proto;
+};
+
+static struct uri_entry *uris;
+static int nuris;
+static double total_weight;
+static char *class_names[MAX_CLASSES];
+static int nclasses;
+
+static int conns = 1, keepalive = 0;
+static long max_requests = 0;
+static double duration = 0, rate = 0, warmup = 0;
+
+static struct replay_rec *recs;
+static long nrecs, next_rec;
+static double speed = 1;
+
+static struct sockaddr_storage server_addr;
+static socklen_t server_len;
+static char *host_header;
+
+static pthread_mutex_t bench_lock = PTHREAD_MUTEX_INITIALIZER;
+static long measured;                 // requests claimed for measurement
+static uint64_t t_start, t_measure, t_end;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int class_index(char *name) {
+    for (int i = 0; i < nclasses; i++) {
+      if (!strcmp(class_names[i], name))
+          return i;
+    }
+    if (nclasses == MAX_CLASSES) {
+      fprintf(stderr, "wclient: more than %d classes\n", MAX_CLASSES);
+      exit(1);
+    }
+    class_names[nclasses] = strdup(name);
+    return nclasses++;
+}
+
+static void add_uri(char *uri, double weight, char *cls) {
+    uris = realloc(uris, (nuris + 1) * sizeof(*uris));
+    assert(uris != NULL);
+    uris[nuris].uri = strdup(uri);
+    uris[nuris].weight = weight;
+    uris[nuris].cls = class_index(cls ? cls : strstr(uri, "cgi") ? "dynamic" : "static");
+    total_weight += weight;
+    nuris++;
+}
+
+static void load_uris(char *path) {
+    char line[MAXBUF], uri[MAXBUF], cls[64];
+    double weight;
+    FILE *fp = fopen(path, "r");
+    
+    if (!fp) {
+      perror(path);
+      exit(1);
+    }
+    while (fgets(line, sizeof(line), fp)) {
+      if (line[0] == '#')
+          continue;
+      int n = sscanf(line, "%8191s %lf %63s", uri, &weight, cls);
+      if (n < 1)
+          continue;
+      if (n < 2 || weight <= 0)
+          weight = 1;
+      add_uri(uri, weight, n == 3 ? cls : NULL);
+    }
+    fclose(fp);
+    if (nuris == 0) {
+      fprintf(stderr, "wclient: no uris in %s\n", path);
+      exit(1);
+    }
+}
+
+static struct uri_entry *pick_uri(unsigned int *seed) {
+    double r = (double) rand_r(seed) / ((double) RAND_MAX + 1) * total_weight;
+    for (int i = 0; i < nuris - 1; i++) {
+      if ((r -= uris[i].weight) < 0)
+          return &uris[i];
+    }
+    return &uris[nuris - 1];
+}
+
+// resolve once up front; open_client_fd() is not safe to call from threads
+static void resolve(char *host, int port) {
+    if (strncmp(host, "unix:", 5) == 0) {
+      struct sockaddr_un *sun = (struct sockaddr_un *) &server_addr;
+      sun->sun_family = AF_UNIX;
+      snprintf(sun->sun_path, sizeof(sun->sun_path), "%s", host + 5);
+      server_len = sizeof(*sun);
+      host_header = "localhost";
+      return;
+    }
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM }, *res;
+    char portstr[16];
+    sprintf(portstr, "%d", port);
+    if (getaddrinfo(host, portstr, &hints, &res) != 0) {
+      fprintf(stderr, "wclient: cannot resolve %s\n", host);
+      exit(1);
+    }
+    memcpy(&server_addr, res->ai_addr, res->ai_addrlen);
+    server_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    host_header = host;
+}
+
+static int bench_connect(struct bench_conn *c) {
+    c->off = c->len = 0;
+    c->fd = socket(server_addr.ss_family, SOCK_STREAM, 0);
+    if (c->fd < 0)
+      return -1;
+    if (connect(c->fd, (struct sockaddr *) &server_addr, server_len) < 0) {
+      close(c->fd);
+      c->fd = -1;
+      return -1;
+    }
+    return 0;
+}
+
+static void bench_close(struct bench_conn *c) {
+    if (c->fd >= 0)
+      close(c->fd);
+    c->fd = -1;
+}
+
+// next line (with its \n) into line; returns its length, 0 at EOF, -1 on error
+static int conn_line(struct bench_conn *c, char *line, size_t cap) {
+    size_t n = 0;
+    while (n + 1 < cap) {
+      if (c->off == c->len) {
+          ssize_t rc = read(c->fd, c->buf, sizeof(c->buf));
+          if (rc <= 0)
+              return n ? -1 : (int) rc;
+          c->off = 0;
+          c->len = rc;
+      }
+      char ch = c->buf[c->off++];
+      line[n++] = ch;
+      if (ch == '\n')
+          break;
+    }
+    line[n] = '\0';
+    return n;
+}
+
+// discard n body bytes, or everything up to EOF if n < 0
+static long conn_skip(struct bench_conn *c, long n) {
+    long got = 0;
+    while (n < 0 || got < n) {
+      if (c->off == c->len) {
+          ssize_t rc = read(c->fd, c->buf, sizeof(c->buf));
+          if (rc < 0)
+              return -1;
+          if (rc == 0)
+              return n < 0 ? got : -1;
+          c->off = 0;
+          c->len = rc;
+      }
+      size_t k = c->len - c->off;
+      if (n >= 0 && (long) k > n - got)
+          k = n - got;
+      c->off += k;
+      got += k;
+    }
+    return got;
+}
+
+// read one response; returns the status code or -1, and sets *reuse if
+// the connection can carry another request
+static int bench_response(struct bench_conn *c, unsigned long *bytes, int *reuse) {
+    char line[MAXBUF];
+    int major, minor, status = 0, chunked = 0, close_after, keep = 0;
+    long length = -1, n;
+    
+    if (conn_line(c, line, sizeof(line)) <= 0 ||
+        sscanf(line, "HTTP/%d.%d %d", &major, &minor, &status) != 3)
+      return -1;
+    close_after = major == 1 && minor == 0; // 1.0 closes unless it says otherwise
+    while ((n = conn_line(c, line, sizeof(line))) > 0 && strcmp(line, "\r\n") && strcmp(line, "\n")) {
+      if (strncasecmp(line, "Content-Length:", 15) == 0)
+          length = atol(line + 15);
+      else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line, "chunked"))
+          chunked = 1;
+      else if (strncasecmp(line, "Connection:", 11) == 0 && strcasestr(line, "close"))
+          keep = -1;
+      else if (strncasecmp(line, "Connection:", 11) == 0 && strcasestr(line, "keep-alive"))
+          keep = 1;
+    }
+    if (n <= 0)
+      return -1;
+    
+    if (chunked) {
+      for (;;) {
+          if (conn_line(c, line, sizeof(line)) <= 0)
+              return -1;
+          long size = strtol(line, NULL, 16);
+          if (size == 0)
+              break;
+          if (conn_skip(c, size + 2) < 0)   // data and its CRLF
+              return -1;
+          *bytes += size;
+      }
+      if (conn_line(c, line, sizeof(line)) <= 0)  // blank line after the last chunk
+          return -1;
+    } else if (length >= 0) {
+      if (conn_skip(c, length) < 0)
+          return -1;
+      *bytes += length;
+    } else {
+      if ((n = conn_skip(c, -1)) < 0)
+          return -1;
+      *bytes += n;
+      close_after = 1;
+    }
+    if (keep)
+      close_after = keep < 0;
+    *reuse = keepalive && !close_after;
+    return status;
+}
+
+// 1 if the caller should send another request; *measure says whether
+// it counts (it does not during warmup)
+static int bench_next(int *measure) {
+    uint64_t t = now_ns();
+    if (t < t_measure) {
+      *measure = 0;
+      return 1;
+    }
+    *measure = 1;
+    if (max_requests > 0) {
+      pthread_mutex_lock(&bench_lock);
+      int more = measured < max_requests;
+      if (more)
+          measured++;
+      pthread_mutex_unlock(&bench_lock);
+      return more;
+    }
+    return t < t_end;
+}
+
+static void sleep_until(uint64_t due) {
+    uint64_t t;
+    while ((t = now_ns()) < due) {
+      uint64_t wait = due - t;
+      struct timespec ts = { wait / 1000000000ull, wait % 1000000000ull };
+      nanosleep(&ts, NULL);
+    }
+}
+
+// send one request and read the response; returns its status or -1
+static int bench_exchange(struct bench_conn *c, struct bench_stats *st,
+                          char *req, int len, unsigned long *bytes) {
+    int reuse = 0, status = -1;
+    
+    // a kept-alive connection the server has since closed gets one retry
+    for (int fresh = c->fd < 0; status < 0; fresh = 1) {
+      if (fresh) {
+          bench_close(c);
+          if (bench_connect(c) < 0)
+              break;
+          st->connects++;
+      }
+      if (write(c->fd, req, len) == len)
+          status = bench_response(c, bytes, &reuse);
+      if (fresh)
+          break;
+    }
+    if (!reuse)
+      bench_close(c);
+    return status;
+}
+
+static void *bench_worker(void *arg) {
+    struct bench_stats *st = arg;
+    struct bench_conn c = { .fd = -1 };
+    unsigned int seed = (unsigned int) (uintptr_t) st ^ (unsigned int) now_ns();
+    char req[MAXBUF];
+    int measure;
+    
+    // open loop: this thread's share of the schedule, offset so the
+    // connections do not all fire at once
+    uint64_t interval = rate > 0 ? (uint64_t) (1e9 * conns / rate) : 0;
+    uint64_t due = t_start + (interval ? (uint64_t) (seed % interval) : 0);
+    
+    while (bench_next(&measure)) {
+      struct uri_entry *u = pick_uri(&seed);
+      
+      if (interval)
+          sleep_until(due);
+      
+      int len = snprintf(req, sizeof(req),
+                         "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                         u->uri, host_header, keepalive ? "keep-alive" : "close");
+      uint64_t sent = now_ns();
+      unsigned long bytes = 0;
+      int status = bench_exchange(&c, st, req, len, &bytes);
+      uint64_t end = now_ns();
+      
+      if (measure) {
+          st->requests++;
+          if (status < 0) {
+              st->errors++;
+          } else {
+              st->bytes += bytes;
+              st->status[status / 100 < 6 ? status / 100 : 0]++;
+              uint64_t service = end - sent, latency;
+              hist_record(&st->service, service);
+              if (interval) {
+                  latency = end - (due < sent ? due : sent);
+                  hist_record(&st->latency, latency);
+                  hist_record(&st->cls_latency[u->cls], latency);
+              } else {
+                  uint64_t mean = (uint64_t) hist_mean(&st->service);
+                  hist_record_corrected(&st->latency, service, mean);
+                  hist_record_corrected(&st->cls_latency[u->cls], service, mean);
+              }
+              st->cls_requests[u->cls]++;
+          }
+      }
+      due += interval;
+    }
+    bench_close(&c);
+    return NULL;
+}
+
+//
+// Replay
+//
+
+// start of the value of "key" in a one-line JSON object, or NULL
+static char *json_field(char *line, const char *key) {
+    size_t klen = strlen(key);
+    for (char *p = line; (p = strchr(p, '"')) != NULL; p++) {
+      if (strncmp(p + 1, key, klen) == 0 && p[klen + 1] == '"') {
+          p += klen + 2;
+          while (*p == ' ' || *p == '\t')
+              p++;
+          if (*p != ':')
+              continue;
+          p++;
+          while (*p == ' ' || *p == '\t')
+              p++;
+          return p;
+      }
+    }
+    return NULL;
+}
+
+// the JSON string at p, unescaped into a malloc'd string; NULL if it is not one
+static char *json_strdup(char *p) {
+    char *out, *o;
+    
+    if (!p || *p++ != '"')
+      return NULL;
+    out = o = malloc(strlen(p) + 1);
+    assert(out != NULL);
+    for (; *p && *p != '"'; p++) {
+      if (*p != '\\') {
+          *o++ = *p;
+          continue;
+      }
+      switch (*++p) {
+      case 'n': *o++ = '\n'; break;
+      case 't': *o++ = '\t'; break;
+      case 'r': *o++ = '\r'; break;
+      case 'u': {   // the server only escapes control characters this way
+          char hex[5] = "";
+          int k;
+          for (k = 0; k < 4 && isxdigit((unsigned char) p[1 + k]); k++)
+              hex[k] = p[1 + k];
+          *o++ = (char) strtol(hex, NULL, 16);
+          p += k;
+          break;
+      }
+      case '\0': p--; break;
+      default: *o++ = *p;
+      }
+    }
+    *o = '\0';
+    return out;
+}
+
+static int rec_cmp(const void *a, const void *b) {
+    const struct replay_rec *x = a, *y = b;
+    return x->at < y->at ? -1 : x->at > y->at;
+}
+
+// read the log, order it by arrival and turn arrival times into offsets
+static void load_log(char *path) {
+    char line[4 * MAXBUF];
+    long cap = 0;
+    FILE *fp = fopen(path, "r");
+    
+    if (!fp) {
+      perror(path);
+      exit(1);
+    }
+    while (fgets(line, sizeof(line), fp)) {
+      char *ts = json_field(line, "ts"), *resp = json_field(line, "resp_us");
+      char *status = json_field(line, "status");
+      char *uri = json_strdup(json_field(line, "uri"));
+      if (!ts || !uri) {
+          free(uri);
+          continue;
+      }
+      if (nrecs == cap) {
+          cap = cap ? 2 * cap : 1024;
+          recs = realloc(recs, cap * sizeof(*recs));
+          assert(recs != NULL);
+      }
+      struct replay_rec *r = &recs[nrecs++];
+      r->at = (uint64_t) (strtod(ts, NULL) * 1e6);   // us for now
+      r->recorded = resp ? (uint64_t) (strtod(resp, NULL) * 1e3) : 0;
+      r->status = status ? atoi(status) : 0;
+      r->uri = uri;
+      r->method = json_strdup(json_field(line, "method"));
+      r->proto = json_strdup(json_field(line, "proto"));
+      if (!r->method)
+          r->method = strdup("GET");
+      if (!r->proto || strcmp(r->proto, "HTTP/1.0")) {   // h2 goes as 1.1
+          free(r->proto);
+          r->proto = strdup("HTTP/1.1");
+      }
+      r->cls = class_index(strstr(uri, "cgi") ? "dynamic" : "static");
+    }
+    fclose(fp);
+    if (nrecs == 0) {
+      fprintf(stderr, "wclient: no requests in %s\n", path);
+      exit(1);
+    }
+    
+    // the log is in completion order
+    qsort(recs, nrecs, sizeof(*recs), rec_cmp);
+    uint64_t first = recs[0].at;
+    for (long i = 0; i < nrecs; i++) {
+      recs[i].at = (uint64_t) ((recs[i].at - first) * 1e3 / speed);
+      if ((max_requests > 0 && i >= max_requests) ||
+          (duration > 0 && recs[i].at >= duration * 1e9)) {
+          nrecs = i;
+          break;
+      }
+    }
+}
+
+static void *replay_worker(void *arg) {
+    struct bench_stats *st = arg;
+    struct bench_conn c = { .fd = -1 };
+    char req[2 * MAXBUF];
+    
+    for (;;) {
+      pthread_mutex_lock(&bench_lock);
+      long i = next_rec++;
+      pthread_mutex_unlock(&bench_lock);
+      if (i >= nrecs)
+          break;
+      struct replay_rec *r = &recs[i];
+      uint64_t due = t_start + r->at;
+      sleep_until(due);
+      
+      int len = snprintf(req, sizeof(req),
+                         "%s %s %s\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                         r->method, r->uri, r->proto, host_header,
+                         keepalive ? "keep-alive" : "close");
+      if (len >= (int) sizeof(req)) {
+          st->requests++;
+          st->errors++;
+          continue;
+      }
+      uint64_t sent = now_ns();
+      unsigned long bytes = 0;
+      int status = bench_exchange(&c, st, req, len, &bytes);
+      uint64_t end = now_ns();
+      
+      if (due < t_measure)
+          continue;
+      st->requests++;
+      if (status < 0) {
+          st->errors++;
+          continue;
+      }
+      st->bytes += bytes;
+      st->status[status / 100 < 6 ? status / 100 : 0]++;
+      if (r->status && status != r->status)
+          st->mismatched++;
+      // a request that could not start on time still counts from its due time
+      uint64_t latency = end - due;
+      hist_record(&st->service, end - sent);
+      hist_record(&st->latency, latency);
+      hist_record(&st->cls_latency[r->cls], latency);
+      st->cls_requests[r->cls]++;
+      if (r->recorded) {
+          hist_record(&st->recorded, r->recorded);
+          hist_record(&st->ratio, latency * 1000 / r->recorded);
+      }
+    }
+    bench_close(&c);
+    return NULL;
+}
+
+static void print_hist(const char *name, struct hist *h) {
+    printf("\"%s\": {\"count\": %lu, \"min\": %.1f, \"mean\": %.1f, "
+           "\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}",
+           name, (unsigned long) h->n, h->n ? h->min / 1e3 : 0, hist_mean(h) / 1e3,
+           hist_percentile(h, 50) / 1e3, hist_percentile(h, 90) / 1e3,
+           hist_percentile(h, 99) / 1e3, hist_percentile(h, 99.9) / 1e3,
+           h->max / 1e3);
+}
+
+static int bench_run(char *host, int port) {
+    pthread_t *tids = malloc(conns * sizeof(*tids));
+    struct bench_stats *stats = calloc(conns, sizeof(*stats));
+    struct bench_stats *all = calloc(1, sizeof(*all));
+    assert(tids != NULL && stats != NULL && all != NULL);
+    
+    signal(SIGPIPE, SIG_IGN); // a server closing early is counted, not fatal
+    resolve(host, port);
+    for (int i = 0; i <= conns; i++) {
+      struct bench_stats *st = i < conns ? &stats[i] : all;
+      hist_init(&st->service);
+      hist_init(&st->latency);
+      hist_init(&st->recorded);
+      hist_init(&st->ratio);
+      for (int k = 0; k < MAX_CLASSES; k++)
+          hist_init(&st->cls_latency[k]);
+    }
+    
+    t_start = now_ns();
+    t_measure = t_start + (uint64_t) (warmup * 1e9);
+    t_end = t_measure + (uint64_t) (duration * 1e9);
+    for (int i = 0; i < conns; i++) {
+      if (pthread_create(&tids[i], NULL, nrecs ? replay_worker : bench_worker,
+                         &stats[i]) != 0) {
+          perror("pthread_create");
+          exit(1);
+      }
+    }
+    for (int i = 0; i < conns; i++)
+      pthread_join(tids[i], NULL);
+    uint64_t elapsed = now_ns() - t_measure;
+    
+    for (int i = 0; i < conns; i++) {
+      struct bench_stats *st = &stats[i];
+      hist_merge(&all->service, &st->service);
+      hist_merge(&all->latency, &st->latency);
+      hist_merge(&all->recorded, &st->recorded);
+      hist_merge(&all->ratio, &st->ratio);
+      all->mismatched += st->mismatched;
+      for (int k = 0; k < nclasses; k++) {
+          hist_merge(&all->cls_latency[k], &st->cls_latency[k]);
+          all->cls_requests[k] += st->cls_requests[k];
+      }
+      all->requests += st->requests;
+      all->errors += st->errors;
+      all->connects += st->connects;
+      all->bytes += st->bytes;
+      for (int k = 0; k < 6; k++)
+          all->status[k] += st->status[k];
+    }
+    
+    printf("{\"mode\": \"%s\", \"connections\": %d, \"rate\": %.1f, "
+           "\"keepalive\": %s, \"warmup_s\": %.3f, \"elapsed_s\": %.3f,\n",
+           nrecs ? "replay" : rate > 0 ? "open" : "closed", conns, rate, keepalive ? "true" : "false",
+           warmup, elapsed / 1e9);
+    printf(" \"requests\": %lu, \"errors\": %lu, \"connects\": %lu, \"bytes\": %lu, "
+           "\"throughput_rps\": %.1f,\n",
+           all->requests, all->errors, all->connects, all->bytes,
+           elapsed ? all->requests / (elapsed / 1e9) : 0);
+    printf(" \"status\": {\"2xx\": %lu, \"3xx\": %lu, \"4xx\": %lu, \"5xx\": %lu},\n",
+           all->status[2], all->status[3], all->status[4], all->status[5]);
+    printf(" ");
+    print_hist("service_us", &all->service);
+    printf(",\n ");
+    print_hist("latency_us", &all->latency);
+    if (nrecs) {
+      struct hist *r = &all->ratio;
+      printf(",\n \"replay\": {\"requests\": %ld, \"speed\": %.3f, "
+             "\"status_mismatch\": %lu,\n  ", nrecs, speed, all->mismatched);
+      print_hist("recorded_us", &all->recorded);
+      printf(",\n  \"ratio\": {\"count\": %lu, \"mean\": %.3f, \"p50\": %.3f, "
+             "\"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}}",
+             (unsigned long) r->n, hist_mean(r) / 1e3, hist_percentile(r, 50) / 1e3,
+             hist_percentile(r, 90) / 1e3, hist_percentile(r, 99) / 1e3, r->max / 1e3);
+    }
+    printf(",\n \"classes\": {");
+    for (int k = 0; k < nclasses; k++) {
+      printf("%s\n  \"%s\": {\"requests\": %lu, ", k ? "," : "", class_names[k],
+             all->cls_requests[k]);
+      print_hist("latency_us", &all->cls_latency[k]);
+      printf("}");
+    }
+    printf("}}\n");
+    
+    int rc = all->errors ? 1 : 0;
+    free(tids);
+    free(stats);
+    free(all);
+    return rc;
+}
+
 int main(int argc, char *argv[]) {
-    char *host, *filename;
-    int port;
+    char *host, *filename, *urifile = NULL, *logfile = NULL;
+    int port, c, bench = 0, conns_set = 0;
     int clientfd;
     
-    if (argc != 4) {
+    while ((c = getopt(argc, argv, "c:n:d:r:kf:w:l:x:")) != -1) {
+      bench = 1;
+      switch (c) {
+      case 'c': conns = atoi(optarg); conns_set = 1; break;
+      case 'n': max_requests = atol(optarg); break;
+      case 'd': duration = atof(optarg); break;
+      case 'r': rate = atof(optarg); break;
+      case 'k': keepalive = 1; break;
+      case 'f': urifile = optarg; break;
+      case 'w': warmup = atof(optarg); break;
+      case 'l': logfile = optarg; break;
+      case 'x': speed = atof(optarg); break;
+      default: bench = -1;
+      }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    
+    if (bench < 0 || argc < 3 || argc > 4 || (!bench && argc != 4) ||
+        conns < 1 || max_requests < 0 || duration < 0 || rate < 0 || warmup < 0 ||
+        speed <= 0 || (logfile && (rate > 0 || urifile))) {
       fprintf(stderr, "Usage: %s <host> <port> <filename>\n", argv[0]);
+      fprintf(stderr, "       %s [-c conns] [-n requests | -d secs] [-r rate] [-k] "
+              "[-f urifile] [-w secs] <host> <port> [filename]\n", argv[0]);
+      fprintf(stderr, "       %s -l logfile [-x speed] [-c conns] [-n requests | -d secs] "
+              "[-k] [-w secs] <host> <port>\n", argv[0]);
       exit(1);
     }
     
     host = argv[1];
     port = atoi(argv[2]);
-    filename = argv[3];
+    filename = argc == 4 ? argv[3] : "/";
+    
+    if (logfile) {
+      if (!conns_set)
+          conns = REPLAY_CONNS;
+      load_log(logfile);
+      exit(bench_run(host, port));
+    }
+    if (bench) {
+      if (max_requests == 0 && duration == 0)
+          max_requests = 1000;
+      if (urifile)
+          load_uris(urifile);
+      else
+          add_uri(filename, 1, NULL);
+      exit(bench_run(host, port));
+    }
     
     /* Open a single connection to the specified host and port */
-    clientfd = open_client_fd_or_die(host, port);
+    if (strncmp(host, "unix:", 5) == 0)
+      clientfd = open_client_fd_unix_or_die(host + 5);
+    else
+      clientfd = open_client_fd_or_die(host, port);
     
     client_send(clientfd, filename);
     client_print(clientfd);
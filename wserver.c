@@ -4,6 +4,7 @@
 #include <unistd.h> // for getopt(), optarg, getpid()
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/select.h> // select() over both listeners
 #include <sys/stat.h> // off_t
 #include <pthread.h>  // pthreads, mutexes, condvars
 #include <signal.h>   // for signal handling
@@ -12,13 +13,22 @@
 
 #include "request.h"
 #include "io_helper.h"
+#include "h2.h"
+#include "coalesce.h"
+#include "cost.h"
+#include "http_parse.h"
+#include "trace.h"
+#include "accesslog.h"
 
 #define MAXBUF 8192
 
 char default_root[] = ".";
 
 static volatile sig_atomic_t stop = 0; // flag to signal shutdown
-static int listen_fd_global;           // listening socket
+static int listen_fd_global = -1;      // listening socket
+static int unix_fd_global = -1;        // unix domain listening socket
+static volatile sig_atomic_t dump_trace = 0; // SIGUSR1 asked for a trace
+static char trace_path[MAXBUF];        // where traces are written
 
 void *worker(void *arg);
 
@@ -26,12 +36,24 @@ void *worker(void *arg);
 int threads = 1;         // number of worker threads
 int buffers = 1;         // size of the request queue
 char *schedalg = "FIFO"; // fifo or sff
+char *unix_path = NULL;  // unix domain socket path, if any
+mode_t unix_mode = 0666; // permissions on the socket file
+int dyn_threads = 0;     // dynamic pool size, 0 = one shared pool
+int dyn_buffers = 0;     // dynamic queue size, defaults to -b
+char *dyn_schedalg;      // dynamic policy, defaults to -s
+int borrow = 0;          // idle dynamic workers may take static jobs
 
 // one request in the queue
 struct request_entry
 {
-  int conn_fd;    // client connection socket
-  off_t filesize; // file size for sff
+  int conn_fd;              // client connection socket
+  off_t filesize;           // size of the file served
+  uint64_t cost;            // expected service time (ns) for sff
+  int route;                // cost model route, see cost.h
+  struct h2_stream *stream; // http/2 stream instead of a connection
+  uint64_t trace_id;        // 0 unless sampled for tracing
+  uint64_t queued_at;       // when it was queued, if traced
+  uint64_t arrived;         // wall clock at accept, for the access log
 };
 
 // circular buffer, synchronize primitives
@@ -41,10 +63,29 @@ struct request_queue
   int head, tail, count;
   int capacity;
 
-  pthread_mutex_t mutex;    // protects queue state
   pthread_cond_t not_empty; // workers wait here if count==0
   pthread_cond_t not_full;  // master waits here if count==capacity
-} queue;
+};
+
+// a queue and the workers that serve it
+struct pool
+{
+  char *name;
+  int threads;
+  char *schedalg;
+  struct request_queue queue;
+  pthread_t *thread_ids;
+};
+
+#define STATIC_POOL 0
+#define DYNAMIC_POOL 1
+
+struct pool pools[2];
+int npools = 1;
+int sff = 0; // some pool uses sff, so the cost model is kept up to date
+
+// one lock for all queues, so a worker can look at both when borrowing
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 // external parser for uri
 extern int request_parse_uri(
@@ -52,28 +93,117 @@ extern int request_parse_uri(
     char *filename,
     char *cgiargs);
 
+// with a single pool everything goes to pools[0]
+static struct pool *pool_for(int is_static)
+{
+  return (npools > 1 && !is_static) ? &pools[DYNAMIC_POOL]
+                                    : &pools[STATIC_POOL];
+}
+
+// add a job to a pool's queue, blocking while it is full
+void enqueue(struct pool *p, struct request_entry e)
+{
+  struct request_queue *q = &p->queue;
+
+  pthread_mutex_lock(&queue_mutex);
+  while (q->count == q->capacity)
+    pthread_cond_wait(&q->not_full, &queue_mutex);
+  if (e.trace_id)
+    e.queued_at = trace_now();
+  q->buf[q->tail] = e;
+  q->tail = (q->tail + 1) % q->capacity;
+  q->count++;
+  pthread_cond_signal(&q->not_empty);
+  if (borrow && p == &pools[STATIC_POOL] && npools > 1)
+    pthread_cond_signal(&pools[DYNAMIC_POOL].queue.not_empty);
+  pthread_mutex_unlock(&queue_mutex);
+}
+
+// queue entry for a request, ranked by expected cost when sff is used
+static struct request_entry make_entry(int is_static, char *filename,
+                                       char *cgiargs, off_t size)
+{
+  struct request_entry e = {.conn_fd = -1, .filesize = size,
+                            .route = COST_NONE};
+  if (sff)
+    e.cost = cost_estimate(is_static, filename, cgiargs, size, &e.route);
+  return e;
+}
+
+// http/2 streams are scheduled one by one, like connections
+void enqueue_stream(struct h2_stream *st, int is_static,
+                    char *filename, char *cgiargs, off_t size)
+{
+  struct request_entry e = make_entry(is_static, filename, cgiargs, size);
+  e.stream = st;
+  e.trace_id = trace_request();
+  if (access_log_fd >= 0)
+    e.arrived = access_log_now();
+  enqueue(pool_for(is_static), e);
+}
+
+// wake every worker, e.g. on shutdown
+static void wake_all(void)
+{
+  for (int i = 0; i < npools; i++)
+    pthread_cond_broadcast(&pools[i].queue.not_empty);
+}
+
 // signal handler for sigint/term
 void handle_sigint(int sig)
 {
-  stop = 1;                                 // stop main loop
-  pthread_cond_broadcast(&queue.not_empty); // wake any waiting worker
+  stop = 1;  // stop main loop
+  wake_all(); // wake any waiting worker
   if (listen_fd_global >= 0)
   {
     close(listen_fd_global); // close listening socket
     listen_fd_global = -1;   // flag for close
   }
+  if (unix_fd_global >= 0)
+  {
+    close(unix_fd_global);
+    unix_fd_global = -1;
+  }
+}
+
+// a trace dump waits for the accept loop; no stdio in a handler
+void handle_sigusr1(int sig)
+{
+  (void)sig;
+  dump_trace = 1;
+}
+
+static void write_trace(void)
+{
+  if (trace_dump(trace_path) == 0)
+    printf("[pid %d] trace written to %s\n", getpid(), trace_path);
+  else
+    printf("[pid %d] could not write trace %s\n", getpid(), trace_path);
+  fflush(stdout);
 }
 
-// ./wserver [-d <basedir>] [-p <portnum>]
+// ./wserver [-d <basedir>] [-p <portnum>] [-u <socketpath>] [-m <mode>] [-c]
+//            [-T <dynthreads>] [-B <dynbuffers>] [-S <dynschedalg>] [-x]
+//            [-R <n>] [-l <logfile>]
 //
+// -T n gives dynamic (cgi) requests their own pool of n workers and queue;
+//    -t/-b/-s then size the static pool, -B/-S the dynamic one
+// -x lets idle dynamic workers serve queued static requests
+// -p 0 disables the tcp listener, so only the unix socket is served
+// -c lets identical concurrent requests to idempotent CGIs share one run
+// -R n traces 1 in n requests; the trace (Chrome trace-event JSON) goes to
+//    wserver-trace-<pid>.json in the starting directory on SIGUSR1 and exit
+// -l appends one JSON line per request to logfile, see accesslog.h;
+//    wclient -l replays such a log
 int main(int argc, char *argv[])
 {
   int c;
   char *root_dir = default_root;
+  char *log_path = NULL;
   int port = 10000;
 
   /* parse flags */
-  while ((c = getopt(argc, argv, "d:p:t:b:s:")) != -1)
+  while ((c = getopt(argc, argv, "d:p:t:b:s:u:m:cT:B:S:xR:l:")) != -1)
   {
     switch (c)
     {
@@ -92,59 +222,160 @@ int main(int argc, char *argv[])
     case 's': // scheduling
       schedalg = optarg;
       break;
+    case 'u': // unix socket path
+      unix_path = optarg;
+      break;
+    case 'm': // unix socket permissions, octal
+      unix_mode = strtol(optarg, NULL, 8);
+      break;
+    case 'c': // coalesce identical dynamic requests
+      coalesce_enabled = 1;
+      break;
+    case 'T': // dynamic pool threads
+      dyn_threads = atoi(optarg);
+      break;
+    case 'B': // dynamic pool buffer
+      dyn_buffers = atoi(optarg);
+      break;
+    case 'S': // dynamic pool scheduling
+      dyn_schedalg = optarg;
+      break;
+    case 'x': // borrow idle dynamic workers
+      borrow = 1;
+      break;
+    case 'R': // trace sampling
+      trace_sample = atoi(optarg);
+      break;
+    case 'l': // access log
+      log_path = optarg;
+      break;
     default:
       fprintf(stderr,
               "usage: wserver [-d basedir] [-p port] "
-              "[-t threads] [-b buffers] [-s schedalg]\n");
+              "[-t threads] [-b buffers] [-s schedalg] "
+              "[-u socketpath] [-m mode] [-c] "
+              "[-T dynthreads] [-B dynbuffers] [-S dynschedalg] [-x] "
+              "[-R n] [-l logfile]\n");
       exit(1);
     }
   }
 
   // validate flags
+  if (dyn_buffers == 0)
+    dyn_buffers = buffers;
+  if (!dyn_schedalg)
+    dyn_schedalg = schedalg;
   if (threads < 1 || buffers < 1 ||
-      (strcasecmp(schedalg, "FIFO") && strcasecmp(schedalg, "SFF")))
+      (strcasecmp(schedalg, "FIFO") && strcasecmp(schedalg, "SFF")) ||
+      dyn_threads < 0 || dyn_buffers < 1 ||
+      (strcasecmp(dyn_schedalg, "FIFO") && strcasecmp(dyn_schedalg, "SFF")) ||
+      trace_sample < 0 || port < 0 || (port == 0 && !unix_path))
   {
     fprintf(stderr,
             "usage: wserver [-d basedir] [-p port] "
-            "[-t threads>0] [-b buffers>0] [-s FIFO|SFF]\n");
+            "[-t threads>0] [-b buffers>0] [-s FIFO|SFF] "
+            "[-u socketpath] [-m mode] [-c] "
+            "[-T dynthreads>=0] [-B dynbuffers>0] [-S FIFO|SFF] [-x] "
+            "[-R n>=0] [-l logfile]\n");
+    exit(1);
+  }
+
+  // traces go where we were started, not into the document root
+  if (trace_sample > 0)
+  {
+    char cwd[MAXBUF / 2];
+    if (!getcwd(cwd, sizeof(cwd)))
+      strcpy(cwd, ".");
+    snprintf(trace_path, sizeof(trace_path), "%s/wserver-trace-%d.json",
+             cwd, getpid());
+  }
+
+  // so is the access log
+  if (log_path && access_log_open(log_path) < 0)
+  {
+    perror(log_path);
     exit(1);
   }
 
+  // the unix socket too, so a relative -u path is not taken inside the
+  // document root; it is removed on exit by its absolute name
+  static char unix_abs[MAXBUF];
+  if (unix_path)
+  {
+    unix_fd_global = open_listen_fd_unix(unix_path, unix_mode);
+    if (unix_fd_global < 0)
+      exit(1);
+    char cwd[MAXBUF / 2];
+    if (unix_path[0] != '/' && getcwd(cwd, sizeof(cwd)))
+    {
+      snprintf(unix_abs, sizeof(unix_abs), "%s/%s", cwd, unix_path);
+      unix_path = unix_abs;
+    }
+  }
+
   // change to working dir(root)
   chdir_or_die(root_dir);
 
-  // open listening socket
-  listen_fd_global = open_listen_fd_or_die(port);
+  // open listening socket(s)
+  if (port > 0)
+  {
+    listen_fd_global = open_listen_fd_or_die(port);
+    printf("[pid %d] listening on port %d, root \"%s\"\n",
+           getpid(), port, root_dir);
+  }
+  if (unix_path)
+  {
+    printf("[pid %d] listening on unix socket %s, root \"%s\"\n",
+           getpid(), unix_path, root_dir);
+  }
   int listen_fd = listen_fd_global;
-  printf("[pid %d] listening on port %d, root \"%s\"\n",
-         getpid(), port, root_dir);
+  int unix_fd = unix_fd_global;
   fflush(stdout);
 
-  // initialize circular buffer
-  queue.capacity = buffers;
-  queue.head = queue.tail = queue.count = 0;
-  queue.buf = malloc(queue.capacity * sizeof *queue.buf);
-  if (!queue.buf)
+  // set up the pools: static (or everything), then dynamic if asked
+  pools[STATIC_POOL] = (struct pool){
+      .name = "static", .threads = threads, .schedalg = schedalg};
+  pools[STATIC_POOL].queue.capacity = buffers;
+  if (dyn_threads > 0)
   {
-    perror("malloc");
-    exit(1);
+    pools[DYNAMIC_POOL] = (struct pool){
+        .name = "dynamic", .threads = dyn_threads, .schedalg = dyn_schedalg};
+    pools[DYNAMIC_POOL].queue.capacity = dyn_buffers;
+    npools = 2;
   }
+  else
+    borrow = 0; // nothing to borrow from
 
-  // init mutex and condition variables
-  if (pthread_mutex_init(&queue.mutex, NULL) != 0)
+  // initialize circular buffers and condition variables
+  for (int i = 0; i < npools; i++)
   {
-    perror("pthread_mutex_init");
-    exit(1);
-  }
-  if (pthread_cond_init(&queue.not_empty, NULL) != 0)
-  {
-    perror("pthread_cond_init not_empty");
-    exit(1);
+    struct request_queue *q = &pools[i].queue;
+    q->head = q->tail = q->count = 0;
+    q->buf = malloc(q->capacity * sizeof *q->buf);
+    if (!q->buf)
+    {
+      perror("malloc");
+      exit(1);
+    }
+    if (pthread_cond_init(&q->not_empty, NULL) != 0)
+    {
+      perror("pthread_cond_init not_empty");
+      exit(1);
+    }
+    if (pthread_cond_init(&q->not_full, NULL) != 0)
+    {
+      perror("pthread_cond_init not_full");
+      exit(1);
+    }
   }
-  if (pthread_cond_init(&queue.not_full, NULL) != 0)
+  sff = strcasecmp(schedalg, "SFF") == 0 ||
+        (npools > 1 && strcasecmp(dyn_schedalg, "SFF") == 0);
+  if (npools > 1)
   {
-    perror("pthread_cond_init not_full");
-    exit(1);
+    printf("[pid %d] pools: static %d threads %s, dynamic %d threads %s%s\n",
+           getpid(), threads, schedalg, dyn_threads, dyn_schedalg,
+           borrow ? ", borrowing" : "");
+    fflush(stdout);
   }
 
   // signal handling for shutdown
@@ -153,31 +384,68 @@ int main(int argc, char *argv[])
   sa.sa_flags = 0;
   sigaction(SIGINT, &sa, NULL);
   sigaction(SIGTERM, &sa, NULL);
-
-  // spawn worker threads
-  pthread_t *thread_ids = malloc(threads * sizeof *thread_ids);
-  if (!thread_ids)
+  if (trace_sample > 0)
   {
-    perror("malloc");
-    exit(1);
+    sa.sa_handler = handle_sigusr1; // interrupts accept(), see below
+    sigaction(SIGUSR1, &sa, NULL);
+    trace_thread_name("accept");
   }
-  for (int i = 0; i < threads; i++)
+
+  // spawn worker threads
+  for (int p = 0; p < npools; p++)
   {
-    if (pthread_create(&thread_ids[i], NULL, worker, NULL) != 0)
+    pools[p].thread_ids = malloc(pools[p].threads * sizeof(pthread_t));
+    if (!pools[p].thread_ids)
     {
-      perror("pthread_create");
+      perror("malloc");
       exit(1);
     }
+    for (int i = 0; i < pools[p].threads; i++)
+    {
+      if (pthread_create(&pools[p].thread_ids[i], NULL, worker, &pools[p]) != 0)
+      {
+        perror("pthread_create");
+        exit(1);
+      }
+    }
   }
 
+  // peek at the request line when it decides the pool or the sff rank
+  int peek = npools > 1 || sff;
+
   // accept loop(producer)
   while (!stop)
   {
-    struct sockaddr_in client_addr;
+    struct sockaddr_storage client_addr;
     socklen_t client_len = sizeof(client_addr);
 
+    if (dump_trace)
+    {
+      dump_trace = 0;
+      write_trace();
+    }
+
+    // with two listeners, wait until one of them has a connection
+    int ready_fd = (listen_fd >= 0) ? listen_fd : unix_fd;
+    if (listen_fd >= 0 && unix_fd >= 0)
+    {
+      fd_set rfds;
+      FD_ZERO(&rfds);
+      FD_SET(listen_fd, &rfds);
+      FD_SET(unix_fd, &rfds);
+      int maxfd = listen_fd > unix_fd ? listen_fd : unix_fd;
+      if (select(maxfd + 1, &rfds, NULL, NULL, NULL) < 0)
+      {
+        if (stop)
+          break; // shutdown
+        continue;
+      }
+      if (FD_ISSET(unix_fd, &rfds))
+        ready_fd = unix_fd;
+    }
+
     // accept connection
-    int conn_fd = accept(listen_fd,
+    int conn_fd = accept(ready_fd,
                          (struct sockaddr *)&client_addr,
                          &client_len);
     if (conn_fd < 0)
@@ -188,111 +456,177 @@ int main(int argc, char *argv[])
         continue; // retry
     }
 
-    // sff: peek at request-line and stat file size
-    off_t size = 0;
-    if (strcasecmp(schedalg, "SFF") == 0)
+    // peek at request-line: classify, and estimate cost for sff
+    struct request_entry e = {.conn_fd = conn_fd, .route = COST_NONE};
+    int is_static = 1;
+    uint64_t trace_id = trace_request();
+    uint64_t accepted = trace_id ? trace_now() : 0;
+    uint64_t arrived = access_log_fd >= 0 ? access_log_now() : 0;
+    if (peek)
     {
-      char buf[MAXBUF + 1], *eol;
+      char buf[MAXBUF];
+      struct http_request req;
       int n = recv(conn_fd, buf, MAXBUF, MSG_PEEK);
+      http_parse_init(&req);
       if (n > 0)
+        http_parse(&req, buf, n); // only the request line is needed
+      if (req.state != HTTP_STATE_LINE)
       {
-        buf[n] = '\0';             // make it c-string
-        eol = strstr(buf, "\r\n"); // find end of first line
-        if (eol)
+        // reject ".." in uri, security purposes
+        if (http_slice_contains(req.uri, ".."))
+        {
+          close_or_die(conn_fd);
+          continue;
+        }
+        // an h2 preface only starts the connection's reader
+        char uri[MAXBUF];
+        if (!http_slice_eq(req.method, "PRI") &&
+            http_slice_copy(req.uri, uri, sizeof(uri)))
         {
-          *eol = '\0';
-          char method[MAXBUF], uri[MAXBUF], version[MAXBUF];
-          sscanf(buf, "%s %s %s", method, uri, version);
-
-          // reject ".." in uri, security purposes
-          if (strstr(uri, ".."))
-          {
-            close_or_die(conn_fd);
-            continue;
-          }
           char filename[MAXBUF], cgiargs[MAXBUF];
-          request_parse_uri(uri, filename, cgiargs);
+          off_t size = 0;
+          is_static = request_parse_uri(uri, filename, cgiargs);
           struct stat sbuf;
           if (stat(filename, &sbuf) == 0)
             size = sbuf.st_size;
+          e = make_entry(is_static, filename, cgiargs, size);
+          e.conn_fd = conn_fd;
         }
       }
     }
 
     // enqueue request
-    pthread_mutex_lock(&queue.mutex);
-    while (queue.count == queue.capacity)
-      pthread_cond_wait(&queue.not_full, &queue.mutex);
-    queue.buf[queue.tail] = (struct request_entry){
-        .conn_fd = conn_fd,
-        .filesize = size};
-    queue.tail = (queue.tail + 1) % queue.capacity;
-    queue.count++;
-    pthread_cond_signal(&queue.not_empty);
-    pthread_mutex_unlock(&queue.mutex);
+    e.trace_id = trace_id;
+    e.arrived = arrived;
+    uint64_t peeked = trace_id ? trace_now() : 0;
+    enqueue(pool_for(is_static), e);
+    if (trace_id)
+    {
+      trace_span("peek", trace_id, accepted, peeked);
+      trace_span("enqueue", trace_id, peeked, trace_now());
+    }
   }
 
   // shut down
-  pthread_cond_broadcast(&queue.not_empty);
-  for (int i = 0; i < threads; i++)
+  pthread_mutex_lock(&queue_mutex);
+  wake_all();
+  pthread_mutex_unlock(&queue_mutex);
+  for (int p = 0; p < npools; p++)
   {
-    pthread_join(thread_ids[i], NULL);
+    for (int i = 0; i < pools[p].threads; i++)
+    {
+      pthread_join(pools[p].thread_ids[i], NULL);
+    }
+    free(pools[p].thread_ids);
   }
-  free(thread_ids);
+  if (coalesce_enabled)
+    coalesce_report();
+  if (sff)
+    cost_report();
+  if (trace_sample > 0)
+    write_trace();
 
   // clean up
-  free(queue.buf);
+  for (int p = 0; p < npools; p++)
+    free(pools[p].queue.buf);
   if (listen_fd_global >= 0)
   {
     close_or_die(listen_fd_global);
   }
+  if (unix_fd_global >= 0)
+  {
+    close_or_die(unix_fd_global);
+  }
+  if (unix_path)
+    unlink(unix_path);
   return 0;
 }
 
+// queue a worker of pool p should take from next, or NULL if none;
+// only dynamic workers borrow, since a static worker that picked up a
+// cgi could be stuck for seconds, which is what the split avoids
+static struct pool *pick_pool(struct pool *p)
+{
+  if (p->queue.count > 0)
+    return p;
+  if (borrow && p == &pools[DYNAMIC_POOL] &&
+      pools[STATIC_POOL].queue.count > 0)
+    return &pools[STATIC_POOL];
+  return NULL;
+}
+
 // worker thread: dequeue + handle
 
 void *worker(void *arg)
 {
-  while (!stop || queue.count > 0)
+  struct pool *self = arg;
+
+  trace_thread_name(npools > 1 ? self->name : "worker");
+
+  for (;;)
   {
-    pthread_mutex_lock(&queue.mutex);
-    while (queue.count == 0 && !stop)
-      pthread_cond_wait(&queue.not_empty, &queue.mutex);
-    if (queue.count == 0 && stop)
+    struct pool *p;
+    pthread_mutex_lock(&queue_mutex);
+    while ((p = pick_pool(self)) == NULL && !stop)
+      pthread_cond_wait(&self->queue.not_empty, &queue_mutex);
+    if (!p) // stop, and nothing left to serve
     {
-      pthread_mutex_unlock(&queue.mutex);
+      pthread_mutex_unlock(&queue_mutex);
       break;
     }
+    struct request_queue *queue = &p->queue;
 
-    // choose index: fifo or sff
-    int idx = queue.head;
-    if (strcasecmp(schedalg, "SFF") == 0)
+    // choose index: fifo or sff (shortest expected job)
+    int idx = queue->head;
+    if (strcasecmp(p->schedalg, "SFF") == 0)
     {
-      for (int i = 1; i < queue.count; i++)
+      for (int i = 1; i < queue->count; i++)
       {
-        int cand = (queue.head + i) % queue.capacity;
-        if (queue.buf[cand].filesize < queue.buf[idx].filesize)
+        int cand = (queue->head + i) % queue->capacity;
+        if (queue->buf[cand].cost < queue->buf[idx].cost)
           idx = cand;
       }
     }
 
     // remove entry
-    struct request_entry req = queue.buf[idx];
-    if (idx == queue.head)
-      queue.head = (queue.head + 1) % queue.capacity;
+    struct request_entry req = queue->buf[idx];
+    if (idx == queue->head)
+      queue->head = (queue->head + 1) % queue->capacity;
     else
     {
-      for (int i = idx; i != queue.head; i = (i - 1 + queue.capacity) % queue.capacity)
-        queue.buf[i] = queue.buf[(i - 1 + queue.capacity) % queue.capacity];
-      queue.head = (queue.head + 1) % queue.capacity;
+      for (int i = idx; i != queue->head; i = (i - 1 + queue->capacity) % queue->capacity)
+        queue->buf[i] = queue->buf[(i - 1 + queue->capacity) % queue->capacity];
+      queue->head = (queue->head + 1) % queue->capacity;
     }
-    queue.count--;
-    pthread_cond_signal(&queue.not_full);
-    pthread_mutex_unlock(&queue.mutex);
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue_mutex);
 
-    // process request
-    request_handle(req.conn_fd);
-    close_or_die(req.conn_fd);
+    // process request, timing it for the cost model
+    uint64_t start = sff || req.trace_id ? cost_now() : 0; // = trace_now()
+    if (req.trace_id)
+    {
+      trace_async("queued", req.trace_id, req.queued_at, start);
+      trace_set_current(req.trace_id);
+    }
+    if (access_log_fd >= 0)
+      access_log_begin(req.arrived);
+    if (req.stream)
+      h2_stream_handle(req.stream);
+    else
+    {
+      request_handle(req.conn_fd);
+      close_or_die(req.conn_fd);
+    }
+    if (req.trace_id)
+    {
+      trace_span("request", req.trace_id, start, trace_now());
+      trace_set_current(0);
+    }
+    if (access_log_fd >= 0)
+      access_log_end();
+    if (sff)
+      cost_observe(req.route, req.filesize, cost_now() - start);
   }
   return NULL;
 }